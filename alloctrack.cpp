@@ -0,0 +1,253 @@
+#include "alloctrack.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+
+namespace
+{
+    /**
+     * counters of one thread. Only its owner writes, except the last slot shared by the threads beyond kMaxThreads
+     */
+    struct ThreadCounters
+    {
+        std::atomic<std::uint64_t> allocations[alloctrack::kPhaseCount];
+        std::atomic<std::uint64_t> bytes[alloctrack::kPhaseCount];
+    };
+
+    // static storage, nothing here may allocate
+    ThreadCounters counters[alloctrack::kMaxThreads];
+    std::atomic<int> slotCount {0};
+    std::atomic<std::uint64_t> violationCount {0};
+    std::atomic<void (*)(std::size_t)> violationHandler {nullptr};
+
+    thread_local int localSlot = -1;
+    thread_local alloctrack::ThreadState localState;
+
+    void defaultViolationHandler(std::size_t)
+    {
+        assert(!"heap allocation while allocations are forbidden, see Context::setFixedCapacity");
+    }
+
+    void noteAllocation(std::size_t size)
+    {
+        const bool tracking = alloctrack::detail::tracking.load(std::memory_order_relaxed);
+        if (!tracking && !localState.forbidden)
+            return;
+
+        if (localState.forbidden) {
+            violationCount.fetch_add(1, std::memory_order_relaxed);
+            void (*handler)(std::size_t) = violationHandler.load(std::memory_order_relaxed);
+            (handler ? handler : defaultViolationHandler)(size);
+        }
+
+        if (tracking) {
+            if (localSlot < 0)
+                localSlot = std::min(slotCount.fetch_add(1, std::memory_order_relaxed), alloctrack::kMaxThreads - 1);
+            const int phase = localState.phase;
+            counters[localSlot].allocations[phase].fetch_add(1, std::memory_order_relaxed);
+            counters[localSlot].bytes[phase].fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    void *allocate(std::size_t size)
+    {
+        noteAllocation(size);
+        return std::malloc(size == 0 ? 1 : size);
+    }
+
+    void *allocateAligned(std::size_t size, std::size_t alignment)
+    {
+        noteAllocation(size);
+        if (size == 0)
+            size = 1;
+#ifdef _WIN32
+        return _aligned_malloc(size, alignment);
+#else
+        void *memory = nullptr;
+        if (posix_memalign(&memory, std::max(alignment, sizeof(void *)), size) != 0)
+            return nullptr;
+        return memory;
+#endif
+    }
+
+    void releaseAligned(void *memory)
+    {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+
+    void *allocateOrThrow(std::size_t size)
+    {
+        void *memory = allocate(size);
+        if (!memory)
+            throw std::bad_alloc();
+        return memory;
+    }
+
+    void *allocateAlignedOrThrow(std::size_t size, std::size_t alignment)
+    {
+        void *memory = allocateAligned(size, alignment);
+        if (!memory)
+            throw std::bad_alloc();
+        return memory;
+    }
+}
+
+std::atomic<bool> alloctrack::detail::tracking {false};
+
+const char *alloctrack::phaseName(Phase phase)
+{
+    switch (phase) {
+        case Phase::Other:      return "other";
+        case Phase::Emit:       return "emit";
+        case Phase::Reorder:    return "reorder";
+        case Phase::Rates:      return "rates";
+        case Phase::Integrate:  return "integrate";
+        case Phase::Broadphase: return "broadphase";
+        case Phase::Solve:      return "solve";
+        case Phase::Hooks:      return "hooks";
+        case Phase::Velocities: return "velocities";
+    }
+    return "";
+}
+
+alloctrack::Counter alloctrack::ThreadReport::total() const
+{
+    Counter sum;
+    for (const Counter &counter : phases) {
+        sum.allocations += counter.allocations;
+        sum.bytes += counter.bytes;
+    }
+    return sum;
+}
+
+alloctrack::Counter alloctrack::Report::phase(Phase phase) const
+{
+    Counter sum;
+    for (const ThreadReport &thread : threads) {
+        sum.allocations += thread.phases[static_cast<int>(phase)].allocations;
+        sum.bytes += thread.phases[static_cast<int>(phase)].bytes;
+    }
+    return sum;
+}
+
+alloctrack::Counter alloctrack::Report::total() const
+{
+    Counter sum;
+    for (const ThreadReport &thread : threads) {
+        const Counter counter = thread.total();
+        sum.allocations += counter.allocations;
+        sum.bytes += counter.bytes;
+    }
+    return sum;
+}
+
+alloctrack::ThreadState alloctrack::threadState()
+{
+    return localState;
+}
+
+void alloctrack::setThreadState(const ThreadState &state)
+{
+    localState = state;
+}
+
+void alloctrack::start()
+{
+    for (ThreadCounters &thread : counters) {
+        for (int p = 0; p < kPhaseCount; ++p) {
+            thread.allocations[p].store(0, std::memory_order_relaxed);
+            thread.bytes[p].store(0, std::memory_order_relaxed);
+        }
+    }
+    detail::tracking.store(true, std::memory_order_relaxed);
+}
+
+void alloctrack::stop()
+{
+    detail::tracking.store(false, std::memory_order_relaxed);
+}
+
+alloctrack::Report alloctrack::report()
+{
+    // the report itself is not counted
+    const bool tracking = detail::tracking.exchange(false, std::memory_order_relaxed);
+
+    Report result;
+    const int slots = std::min(slotCount.load(std::memory_order_relaxed), kMaxThreads);
+    for (int slot = 0; slot < slots; ++slot) {
+        ThreadReport thread;
+        thread.slot = slot;
+        for (int p = 0; p < kPhaseCount; ++p) {
+            thread.phases[p].allocations = counters[slot].allocations[p].load(std::memory_order_relaxed);
+            thread.phases[p].bytes = counters[slot].bytes[p].load(std::memory_order_relaxed);
+        }
+        if (thread.total().allocations > 0)
+            result.threads.push_back(thread);
+    }
+
+    detail::tracking.store(tracking, std::memory_order_relaxed);
+    return result;
+}
+
+int alloctrack::threadSlot()
+{
+    return localSlot;
+}
+
+std::uint64_t alloctrack::violations()
+{
+    return violationCount.load(std::memory_order_relaxed);
+}
+
+void alloctrack::setViolationHandler(void (*handler)(std::size_t))
+{
+    violationHandler.store(handler, std::memory_order_relaxed);
+}
+
+// replacement of the global allocation functions, every form forwards to the four above
+
+void *operator new(std::size_t size) { return allocateOrThrow(size); }
+void *operator new[](std::size_t size) { return allocateOrThrow(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocateAligned(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocateAligned(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { std::free(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { std::free(memory); }
+
+void operator delete(void *memory, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept { releaseAligned(memory); }
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept { releaseAligned(memory); }
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept { releaseAligned(memory); }
@@ -0,0 +1,203 @@
+#ifndef SOLVER_ALLOCTRACK_H
+#define SOLVER_ALLOCTRACK_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Count and size the heap allocations (global operator new) made during each phase of Context::step, per thread.
+ * The global operator new and delete are replaced by the core library: when tracking is off and no
+ * allocation is forbidden an allocation only reads one atomic flag and one thread local.
+ * The phase and the forbidden flag belong to the thread stepping a context, and the thread pool hands them to
+ * the workers for the chunks of each dispatch: contexts stepped at the same time on different threads (batch
+ * runs) keep their own phase and their own guarantee, and are told apart by their thread in the report.
+ * Allocations made with malloc directly are not seen.
+ */
+namespace alloctrack
+{
+    enum class Phase
+    {
+        Other,      // outside of any step, or between two phases
+        Emit,       // expired spheres and emitters
+        Reorder,    // Morton reordering of the storage
+        Rates,      // multirate strides
+        Integrate,
+        Broadphase, // grid update and contact candidates
+        Solve,      // constraint and contact iterations
+        Hooks,      // substep hooks, user code
+        Velocities  // velocities and damping
+    };
+    constexpr int kPhaseCount = 9;
+    constexpr int kMaxThreads = 64; // threads beyond share the last slot
+
+    [[nodiscard]] const char *phaseName(Phase phase);
+
+    struct Counter
+    {
+        std::uint64_t allocations = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    /**
+     * allocations of one thread, per phase
+     */
+    struct ThreadReport
+    {
+        int slot = 0; // see threadSlot
+        std::array<Counter, kPhaseCount> phases {};
+
+        [[nodiscard]] Counter total() const;
+    };
+
+    /**
+     * every thread that allocated since start, in slot order
+     */
+    struct Report
+    {
+        std::vector<ThreadReport> threads;
+
+        [[nodiscard]] Counter phase(Phase phase) const;
+        [[nodiscard]] Counter total() const;
+    };
+
+    namespace detail
+    {
+        extern std::atomic<bool> tracking;
+    }
+
+    /**
+     * phase and forbidden flag of a thread, see the namespace
+     */
+    struct ThreadState
+    {
+        int phase = 0;          // a Phase
+        bool forbidden = false; // any allocation is a violation
+    };
+
+    [[nodiscard]] ThreadState threadState();
+    void setThreadState(const ThreadState &state);
+
+    /**
+     * clear the counters and start counting on every thread, the forbidden allocations are still reported
+     * while it is off
+     */
+    void start();
+
+    void stop();
+
+    [[nodiscard]] inline bool isTracking() { return detail::tracking.load(std::memory_order_relaxed); }
+
+    /**
+     * counters since start, allocates the report: not to be called while allocations are forbidden
+     */
+    [[nodiscard]] Report report();
+
+    /**
+     * slot of the calling thread in the reports, given by its first counted allocation. -1 if it has none yet
+     */
+    [[nodiscard]] int threadSlot();
+
+    /**
+     * allocations made while a ForbidScope was alive, counted whether tracking is on or not
+     */
+    [[nodiscard]] std::uint64_t violations();
+
+    /**
+     * called on the allocating thread for each forbidden allocation, it must not allocate itself.
+     * The default handler asserts in debug builds and does nothing else
+     * @param handler nullptr restores the default one
+     */
+    void setViolationHandler(void (*handler)(std::size_t size));
+
+    /**
+     * the allocations of the calling thread, and of the workers it dispatches to, are counted in a phase
+     * during the lifetime of the scope
+     */
+    class PhaseScope
+    {
+    public:
+        explicit PhaseScope(Phase phase) : previous(threadState())
+        {
+            ThreadState state = previous;
+            state.phase = static_cast<int>(phase);
+            setThreadState(state);
+        }
+
+        ~PhaseScope() { setThreadState(previous); }
+
+        PhaseScope(const PhaseScope &) = delete;
+        PhaseScope &operator=(const PhaseScope &) = delete;
+
+    private:
+        ThreadState previous;
+    };
+
+    /**
+     * any allocation of the calling thread, or of the workers it dispatches to, during the lifetime of the scope
+     * is a violation. Scopes nest, the previous state is restored
+     * @param active false for a scope that does nothing
+     */
+    class ForbidScope
+    {
+    public:
+        explicit ForbidScope(bool active = true) : previous(threadState())
+        {
+            ThreadState state = previous;
+            state.forbidden = state.forbidden || active;
+            setThreadState(state);
+        }
+
+        ~ForbidScope() { setThreadState(previous); }
+
+        ForbidScope(const ForbidScope &) = delete;
+        ForbidScope &operator=(const ForbidScope &) = delete;
+
+    private:
+        ThreadState previous;
+    };
+
+    /**
+     * lift a ForbidScope for an allocation that is not part of the work, the first event of a thread in trace
+     */
+    class AllowScope
+    {
+    public:
+        AllowScope() : previous(threadState())
+        {
+            ThreadState state = previous;
+            state.forbidden = false;
+            setThreadState(state);
+        }
+
+        ~AllowScope() { setThreadState(previous); }
+
+        AllowScope(const AllowScope &) = delete;
+        AllowScope &operator=(const AllowScope &) = delete;
+
+    private:
+        ThreadState previous;
+    };
+
+    /**
+     * give the calling thread the state of another one for the lifetime of the scope, what a worker does
+     * for the chunks of a dispatch
+     */
+    class AdoptScope
+    {
+    public:
+        explicit AdoptScope(const ThreadState &state) : previous(threadState()) { setThreadState(state); }
+        ~AdoptScope() { setThreadState(previous); }
+
+        AdoptScope(const AdoptScope &) = delete;
+        AdoptScope &operator=(const AdoptScope &) = delete;
+
+    private:
+        ThreadState previous;
+    };
+}
+
+#endif //SOLVER_ALLOCTRACK_H
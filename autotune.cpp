@@ -0,0 +1,292 @@
+#include "autotune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "multithreading.h"
+#include "trace.h"
+
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * a pile of small spheres at the bottom completing the scene when it has too few spheres for the timings
+     * to mean anything (an empty scene at startup)
+     */
+    std::vector<Sphere> filling(const Context &scene, int minSpheres)
+    {
+        std::vector<Sphere> spheres;
+        const vec2 size = scene.sceneSize();
+        const float radius = 5.f;
+        const float spacing = 2.2f * radius;
+        const int columns = std::max(1, static_cast<int>((size.x - 2.f * spacing) / spacing));
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> jitter(-0.1f * radius, 0.1f * radius);
+        for (int i = 0; static_cast<int>(scene.bodies().size + spheres.size()) < minSpheres; ++i) {
+            Sphere sphere(radius);
+            sphere.setMass(1.f);
+            sphere.position = vec2(spacing + static_cast<float>(i % columns) * spacing + jitter(random),
+                                   size.y - spacing - static_cast<float>(i / columns) * spacing);
+            sphere.prevPosition = sphere.position;
+            spheres.push_back(sphere);
+        }
+        return spheres;
+    }
+
+    /**
+     * largest diameter of the spheres the scene is timed with, 0 if there is none
+     */
+    float largestDiameter(const Context &scene, const std::vector<Sphere> &filled)
+    {
+        float diameter = 0.f;
+        for (const Sphere &sphere : scene.bodies()) diameter = std::max(diameter, 2.f * sphere.radius);
+        for (const Sphere &sphere : filled) diameter = std::max(diameter, 2.f * sphere.radius);
+        return diameter;
+    }
+
+    /**
+     * median time of a step of a fresh copy of the scene, with its settings and obstacles, so every candidate
+     * does the same work
+     */
+    double timeSteps(const Context &scene, const std::vector<Sphere> &filled, float cellSize,
+                     const autotune::Options &options)
+    {
+        Context scratch(cellSize);
+        scratch.seed(1);
+        scene.copySceneTo(scratch);
+        scratch.spawnSpheres(filled);
+
+        for (int i = 0; i < options.warmupSteps; ++i) scratch.step(options.frameDt);
+
+        std::vector<double> times;
+        for (int i = 0; i < std::max(1, options.measuredSteps); ++i) {
+            const auto start = Clock::now();
+            scratch.step(options.frameDt);
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    std::vector<int> threadCandidates(const autotune::Options &options)
+    {
+        if (!options.threadCounts.empty())
+            return options.threadCounts;
+
+        const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        std::vector<int> counts;
+        for (int count = 1; count < cores; count *= 2) counts.push_back(count);
+        counts.push_back(cores);
+        return counts;
+    }
+
+    std::vector<float> cellCandidates(const autotune::Options &options, const Context &scene, float diameter)
+    {
+        if (!options.cellSizes.empty())
+            return options.cellSizes;
+
+        // a contact has to stay between neighbor cells, so a cell is never smaller than a few diameters
+        std::vector<float> sizes = {scene.cellSize()};
+        for (float factor : {2.5f, 3.f, 4.f, 6.f, 8.f, 12.f, 16.f}) sizes.push_back(factor * diameter);
+
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+        return sizes;
+    }
+
+    /**
+     * one line of the settings file: host threads chunksPerThread cellSize diameter msPerStep
+     */
+    bool parseLine(const std::string &line, std::string &host, autotune::Settings &settings)
+    {
+        if (line.empty() || line[0] == '#')
+            return false;
+        std::istringstream stream(line);
+        return static_cast<bool>(stream >> host >> settings.threads >> settings.chunksPerThread
+                                        >> settings.cellSize >> settings.diameter >> settings.msPerStep);
+    }
+}
+
+autotune::Settings autotune::calibrate(const Context &scene, const Options &options)
+{
+    trace::Scope scope("autotune");
+
+    const int previousThreads = multithreading::maxThreadAllowed();
+    const int previousChunks  = multithreading::chunksPerThread();
+
+    const std::vector<Sphere> filled = filling(scene, options.minSpheres);
+    const float diameter = largestDiameter(scene, filled);
+    const std::vector<int> threads = threadCandidates(options);
+    const std::vector<int> chunks = options.chunkCounts.empty() ? std::vector<int>{1} : options.chunkCounts;
+    const std::vector<float> cellSizes = cellCandidates(options, scene, diameter);
+
+    Settings best;
+    best.threads = *std::max_element(threads.begin(), threads.end());
+    best.chunksPerThread = 1;
+    best.cellSize = scene.cellSize();
+    best.diameter = diameter;
+    best.msPerStep = -1.0;
+
+    auto consider = [&](Settings candidate) {
+        multithreading::setMaxThreadCount(candidate.threads);
+        multithreading::setChunksPerThread(candidate.chunksPerThread);
+        candidate.msPerStep = timeSteps(scene, filled, candidate.cellSize, options);
+        if (best.msPerStep < 0.0 || candidate.msPerStep < best.msPerStep)
+            best = candidate;
+    };
+
+    // the parameters barely depend on each other, so they are searched one after the other
+    // instead of timing every combination
+    const Settings start = best;
+    for (float cellSize : cellSizes) {
+        Settings candidate = start;
+        candidate.cellSize = cellSize;
+        consider(candidate);
+    }
+    const Settings withCell = best;
+    for (int count : threads) {
+        Settings candidate = withCell;
+        candidate.threads = count;
+        consider(candidate);
+    }
+    const Settings withThreads = best;
+    for (int count : chunks) {
+        Settings candidate = withThreads;
+        candidate.chunksPerThread = count;
+        consider(candidate);
+    }
+
+    multithreading::setMaxThreadCount(previousThreads);
+    multithreading::setChunksPerThread(previousChunks);
+    return best;
+}
+
+void autotune::apply(const Settings &settings, Context &context)
+{
+    multithreading::setMaxThreadCount(settings.threads);
+    multithreading::setChunksPerThread(settings.chunksPerThread);
+    context.setCellSize(settings.cellSize);
+}
+
+std::string autotune::hostKey()
+{
+    std::string name;
+#ifdef _WIN32
+    if (const char *computer = std::getenv("COMPUTERNAME"))
+        name = computer;
+#else
+    char buffer[256] = {};
+    if (gethostname(buffer, sizeof(buffer) - 1) == 0)
+        name = buffer;
+#endif
+    if (name.empty())
+        name = "unknown";
+    std::replace_if(name.begin(), name.end(), [](char c) { return c == ' ' || c == '\t'; }, '_');
+
+    // the same host with more or less cores (a resized virtual machine) is tuned again
+    return name + "/" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::string autotune::defaultPath()
+{
+    if (const char *path = std::getenv("SOLVER_AUTOTUNE_FILE"))
+        return path;
+#ifdef _WIN32
+    const char *home = std::getenv("USERPROFILE");
+#else
+    const char *home = std::getenv("HOME");
+#endif
+    return home ? std::string(home) + "/.solver_autotune" : std::string(".solver_autotune");
+}
+
+bool autotune::load(const std::string &path, Settings &settings, std::string *error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot open " + path;
+        return false;
+    }
+
+    const std::string key = hostKey();
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string host;
+        Settings read;
+        if (parseLine(line, host, read) && host == key && read.threads > 0 && read.chunksPerThread > 0
+            && read.cellSize > 0.f && read.diameter > 0.f) {
+            settings = read;
+            return true;
+        }
+    }
+    if (error)
+        *error = "no settings for " + key + " in " + path;
+    return false;
+}
+
+bool autotune::save(const std::string &path, const Settings &settings, std::string *error)
+{
+    const std::string key = hostKey();
+
+    // keep the lines of the other hosts
+    std::vector<std::string> kept;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (file && std::getline(file, line)) {
+            std::string host;
+            Settings read;
+            if (parseLine(line, host, read) && host != key)
+                kept.push_back(line);
+        }
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    file << "# host threads chunksPerThread cellSize diameter msPerStep\n";
+    for (const std::string &line : kept) file << line << '\n';
+    file << key << ' ' << settings.threads << ' ' << settings.chunksPerThread << ' ' << settings.cellSize
+         << ' ' << settings.diameter << ' ' << settings.msPerStep << '\n';
+
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+autotune::Settings autotune::loadOrCalibrate(const Context &scene, bool retune, const Options &options)
+{
+    const std::string path = defaultPath();
+    Settings settings;
+    if (!retune && load(path, settings)) {
+        // the cell size was tuned for spheres of another size, it follows them
+        const float diameter = largestDiameter(scene, filling(scene, options.minSpheres));
+        if (diameter > 0.f) {
+            settings.cellSize *= diameter / settings.diameter;
+            settings.diameter = diameter;
+        }
+        return settings;
+    }
+
+    settings = calibrate(scene, options);
+    save(path, settings);
+    return settings;
+}
@@ -0,0 +1,80 @@
+#ifndef SOLVER_AUTOTUNE_H
+#define SOLVER_AUTOTUNE_H
+
+#include <string>
+#include <vector>
+
+#include "context.h"
+
+
+/**
+ * Choose the thread count, the dispatch granularity (chunks per thread) and the cell size of the grid
+ * that give the fastest step on this machine, by timing a few steps of each candidate.
+ * The result is saved per host so the next launches only read it back.
+ */
+namespace autotune
+{
+    struct Settings
+    {
+        int threads         = 1;
+        int chunksPerThread = 1;
+        float cellSize      = 200.f;
+        float diameter      = 0.f; // largest sphere diameter of the scene the cell size was tuned on
+        double msPerStep    = 0.0; // median step time of the chosen settings, for information
+    };
+
+    struct Options
+    {
+        std::vector<int> threadCounts;  // empty = 1, 2, 4... up to the number of cores
+        std::vector<int> chunkCounts {1, 2, 4, 8};
+        std::vector<float> cellSizes;   // empty = multiples of the largest diameter, plus the current size
+        int minSpheres    = 4000;       // a scene with fewer spheres is filled with a pile of small spheres
+        int warmupSteps   = 2;
+        int measuredSteps = 6;
+        float frameDt     = 1.f / 60.f;
+    };
+
+    /**
+     * time the candidates on a copy of the scene (see Context::copySceneTo), the scene itself is not stepped.
+     * The candidates are searched one parameter after the other: cell size, then threads, then chunks.
+     * The thread pool is left with the settings it had before
+     * @param scene
+     * @param options
+     */
+    Settings calibrate(const Context &scene, const Options &options = Options());
+
+    /**
+     * configure the thread pool and the grid of the context
+     */
+    void apply(const Settings &settings, Context &context);
+
+    /**
+     * name of the machine and number of cores, the key the settings are saved under
+     */
+    [[nodiscard]] std::string hostKey();
+
+    /**
+     * file the settings are saved in: $SOLVER_AUTOTUNE_FILE, else ~/.solver_autotune
+     */
+    [[nodiscard]] std::string defaultPath();
+
+    /**
+     * read the settings saved for this host
+     * @return false if the file can not be read or has nothing for this host
+     */
+    bool load(const std::string &path, Settings &settings, std::string *error = nullptr);
+
+    /**
+     * save the settings of this host, the lines of the other hosts are kept
+     */
+    bool save(const std::string &path, const Settings &settings, std::string *error = nullptr);
+
+    /**
+     * the saved settings of this host if there are some, their cell size scaled from the spheres it was tuned
+     * on to the largest ones of the scene. Else calibrate and save them
+     * @param retune calibrate even if settings were saved
+     */
+    Settings loadOrCalibrate(const Context &scene, bool retune = false, const Options &options = Options());
+}
+
+#endif //SOLVER_AUTOTUNE_H
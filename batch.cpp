@@ -0,0 +1,189 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "multithreading.h"
+#include "trace.h"
+
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    batch::SceneResult runScene(const batch::SceneSpec &spec)
+    {
+        batch::SceneResult result;
+        result.name = spec.name;
+
+        Context context(spec.cellSize, spec.subSteps, spec.solverIterations, spec.damping);
+        context.seed(spec.seed);
+        context.initialize(spec.sceneSize);
+        if (spec.setup)
+            spec.setup(context);
+
+        long long iterations = 0;
+        const auto start = Clock::now();
+        for (int frame = 0; frame < spec.frames; ++frame) {
+            if (spec.input)
+                spec.input(context, frame);
+            context.step(spec.frameDt);
+
+            const StepStats &stats = context.lastStepStats();
+            iterations += stats.iterations;
+            result.broadphaseRebuilds += stats.broadphaseRebuilds;
+        }
+        result.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        result.residual = context.lastStepStats().residual;
+        result.iterationsPerFrame = spec.frames > 0 ? static_cast<double>(iterations) / spec.frames : 0.0;
+        result.springs = static_cast<int>(context.springs().size);
+
+        const BufferView<const Sphere> spheres = context.bodies();
+        result.spheres = static_cast<int>(spheres.size);
+        for (const Sphere &sphere : spheres) {
+            const float speed2 = dot(sphere.velocity, sphere.velocity);
+            result.maxSpeed = std::max(result.maxSpeed, std::sqrt(speed2));
+            if (sphere.invMass > 0.f)
+                result.kineticEnergy += 0.5 * speed2 / sphere.invMass;
+        }
+
+        if (spec.measure)
+            result.metric = spec.measure(context);
+        return result;
+    }
+
+    struct Column
+    {
+        const char *name;
+        double (*value)(const batch::SceneResult &);
+    };
+
+    const Column kColumns[] = {
+            {"ms",        [](const batch::SceneResult &r) { return r.milliseconds; }},
+            {"spheres",   [](const batch::SceneResult &r) { return static_cast<double>(r.spheres); }},
+            {"energy",    [](const batch::SceneResult &r) { return r.kineticEnergy; }},
+            {"maxSpeed",  [](const batch::SceneResult &r) { return static_cast<double>(r.maxSpeed); }},
+            {"residual",  [](const batch::SceneResult &r) { return static_cast<double>(r.residual); }},
+            {"iter/frame",[](const batch::SceneResult &r) { return r.iterationsPerFrame; }},
+            {"rebuilds",  [](const batch::SceneResult &r) { return static_cast<double>(r.broadphaseRebuilds); }},
+            {"metric",    [](const batch::SceneResult &r) { return r.metric; }},
+    };
+}
+
+std::vector<batch::SceneResult> batch::run(const std::vector<SceneSpec> &scenes, int threads, std::FILE *progress)
+{
+    std::vector<SceneResult> results(scenes.size());
+    if (scenes.empty())
+        return results;
+
+    if (threads <= 0)
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    threads = std::min(threads, static_cast<int>(scenes.size()));
+
+    // scenes are taken one at a time, so a long scene does not hold back a whole share of the list
+    std::atomic<int> next {0};
+    std::atomic<int> done {0};
+    std::mutex printLock;
+
+    auto worker = [&](int index) {
+        multithreading::setSerialOnThisThread(true);
+        trace::setThreadName("batch " + std::to_string(index));
+
+        for (int i = next.fetch_add(1); i < static_cast<int>(scenes.size()); i = next.fetch_add(1)) {
+            results[i] = runScene(scenes[i]);
+
+            const int finished = done.fetch_add(1) + 1;
+            if (progress) {
+                std::lock_guard<std::mutex> locker(printLock);
+                std::fprintf(progress, "[%d/%zu] %s %.1f ms\n", finished, scenes.size(),
+                             results[i].name.c_str(), results[i].milliseconds);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+    worker(0);
+    for (std::thread &thread : workers) thread.join();
+
+    // the calling thread may go back to stepping a scene with the whole pool
+    multithreading::setSerialOnThisThread(false);
+    return results;
+}
+
+void batch::printSummary(const std::vector<SceneResult> &results, double wallSeconds, std::FILE *out)
+{
+    std::size_t nameWidth = 5;
+    for (const SceneResult &result : results) nameWidth = std::max(nameWidth, result.name.size());
+    const int width = static_cast<int>(nameWidth);
+
+    std::fprintf(out, "%-*s", width, "scene");
+    for (const Column &column : kColumns) std::fprintf(out, " %12s", column.name);
+    std::fprintf(out, "\n");
+
+    for (const SceneResult &result : results) {
+        std::fprintf(out, "%-*s", width, result.name.c_str());
+        for (const Column &column : kColumns) std::fprintf(out, " %12.4g", column.value(result));
+        std::fprintf(out, "\n");
+    }
+    if (results.empty())
+        return;
+
+    const char *rows[] = {"min", "mean", "max"};
+    for (int row = 0; row < 3; ++row) {
+        std::fprintf(out, "%-*s", width, rows[row]);
+        for (const Column &column : kColumns) {
+            double low = column.value(results.front());
+            double high = low;
+            double sum = 0.0;
+            for (const SceneResult &result : results) {
+                const double value = column.value(result);
+                low = std::min(low, value);
+                high = std::max(high, value);
+                sum += value;
+            }
+            const double value = row == 0 ? low : row == 1 ? sum / static_cast<double>(results.size()) : high;
+            std::fprintf(out, " %12.4g", value);
+        }
+        std::fprintf(out, "\n");
+    }
+
+    double sceneSeconds = 0.0;
+    for (const SceneResult &result : results) sceneSeconds += result.milliseconds * 1e-3;
+    std::fprintf(out, "\n%zu scenes in %.2f s (%.2f scenes/s), %.2f s of stepping summed over the scenes\n",
+                 results.size(), wallSeconds, wallSeconds > 0.0 ? static_cast<double>(results.size()) / wallSeconds : 0.0,
+                 sceneSeconds);
+}
+
+bool batch::writeCsv(const std::string &path, const std::vector<SceneResult> &results, std::string *error)
+{
+    std::ofstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+
+    file << "scene,springs";
+    for (const Column &column : kColumns) file << ',' << column.name;
+    file << '\n';
+    for (const SceneResult &result : results) {
+        file << result.name << ',' << result.springs;
+        for (const Column &column : kColumns) file << ',' << column.value(result);
+        file << '\n';
+    }
+
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
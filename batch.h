@@ -0,0 +1,78 @@
+#ifndef SOLVER_BATCH_H
+#define SOLVER_BATCH_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "context.h"
+
+
+/**
+ * Throughput mode: many small independent scenes stepped side by side, one scene per thread at a time.
+ * Each scene is solved single threaded (see multithreading::setSerialOnThisThread) so the scenes do not
+ * contend on the thread pool, the parallelism is between the scenes. Used for parameter sweeps.
+ */
+namespace batch
+{
+    /**
+     * parameters of one scene, the context is built from them in the thread that runs it
+     */
+    struct SceneSpec
+    {
+        std::string name;
+        float cellSize       = 200.f;
+        int subSteps         = 4;
+        int solverIterations = 4;
+        float damping        = 0.998f;
+        vec2 sceneSize       = vec2(800.f, 600.f);
+        std::uint32_t seed   = 1;
+
+        int frames    = 600;
+        float frameDt = 1.f / 60.f;
+
+        std::function<void (Context &)> setup;             // called once before the first step, can be empty
+        std::function<void (Context &, int frame)> input;  // called before each step, can be empty
+        std::function<double (const Context &)> measure;   // custom metric of the final state, can be empty
+    };
+
+    /**
+     * state of a scene at the end of its run
+     */
+    struct SceneResult
+    {
+        std::string name;
+        double milliseconds   = 0.0; // wall time of the steps
+        int spheres           = 0;
+        int springs           = 0;
+        double kineticEnergy  = 0.0;
+        float maxSpeed        = 0.f;
+        float residual        = 0.f; // largest correction of the last iteration of the last frame
+        double iterationsPerFrame = 0.0;
+        int broadphaseRebuilds = 0;  // summed over the frames
+        double metric         = 0.0; // SceneSpec::measure, 0 without it
+    };
+
+    /**
+     * run every scene, the results are in the order of the specs whatever the order they finished in
+     * @param scenes
+     * @param threads number of scenes run at the same time, 0 for the number of cores
+     * @param progress if not nullptr, a line is printed each time a scene is done
+     */
+    std::vector<SceneResult> run(const std::vector<SceneSpec> &scenes, int threads = 0, std::FILE *progress = nullptr);
+
+    /**
+     * one line per scene then min / mean / max of each column
+     * @param wallSeconds duration of run, for the throughput
+     */
+    void printSummary(const std::vector<SceneResult> &results, double wallSeconds, std::FILE *out);
+
+    /**
+     * the results as a CSV table with a header line
+     */
+    bool writeCsv(const std::string &path, const std::vector<SceneResult> &results, std::string *error = nullptr);
+}
+
+#endif //SOLVER_BATCH_H
@@ -0,0 +1,99 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace
+{
+    /**
+     * mean relative stretch of the springs, how well the soft body keeps its shape
+     */
+    double meanSpringStrain(const Context &context)
+    {
+        const BufferView<const Sphere> spheres = context.bodies();
+        const BufferView<const SpringLink> springs = context.springs();
+        if (springs.empty())
+            return 0.0;
+
+        double sum = 0.0;
+        for (const SpringLink &spring : springs) {
+            const vec2 delta = spheres[spring.b].position - spheres[spring.a].position;
+            const float length = std::sqrt(dot(delta, delta));
+            if (spring.restLength > 0.f)
+                sum += std::abs(length - spring.restLength) / spring.restLength;
+        }
+        return sum / static_cast<double>(springs.size);
+    }
+
+    /**
+     * sweep of substeps x damping x cell size x stiffness of a soft body falling in the flow of an emitter
+     */
+    std::vector<batch::SceneSpec> makeSweep(int frames)
+    {
+        const int substeps[]      = {1, 2, 4};
+        const float dampings[]    = {0.99f, 0.998f};
+        const float cellSizes[]   = {50.f, 200.f};
+        const float stiffnesses[] = {0.1f, 0.3f, 0.6f};
+
+        std::vector<batch::SceneSpec> scenes;
+        for (int substep : substeps) {
+            for (float damping : dampings) {
+                for (float cellSize : cellSizes) {
+                    for (float stiffness : stiffnesses) {
+                        batch::SceneSpec spec;
+                        char name[64];
+                        std::snprintf(name, sizeof(name), "s%d_d%.3f_c%.0f_k%.1f", substep, damping, cellSize, stiffness);
+                        spec.name = name;
+                        spec.subSteps = substep;
+                        spec.damping = damping;
+                        spec.cellSize = cellSize;
+                        spec.frames = frames;
+                        spec.seed = 1;
+                        spec.setup = [stiffness](Context &context) {
+                            Emitter emitter;
+                            emitter.position = vec2(context.sceneSize().x * 0.5f, 40.f);
+                            emitter.rate = 200.f;
+                            emitter.lifetime = 8.f;
+                            context.addEmitter(emitter);
+                            context.createSoftBody(vec2(context.sceneSize().x * 0.3f, 150.f), 15, 5.f, 25.f, 1.5f, stiffness);
+                        };
+                        spec.measure = meanSpringStrain;
+                        scenes.push_back(spec);
+                    }
+                }
+            }
+        }
+        return scenes;
+    }
+}
+
+/**
+ * run a parameter sweep as a batch of independent scenes and print the summary
+ * usage: SOLVER_batch [frames] [threads] [results.csv]
+ */
+int main(int argc, char *argv[])
+{
+    const int frames  = argc > 1 ? std::max(1, std::atoi(argv[1])) : 600;
+    const int threads = argc > 2 ? std::max(0, std::atoi(argv[2])) : 0;
+
+    const std::vector<batch::SceneSpec> scenes = makeSweep(frames);
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<batch::SceneResult> results = batch::run(scenes, threads, stderr);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    batch::printSummary(results, seconds, stdout);
+
+    if (argc > 3) {
+        std::string error;
+        if (!batch::writeCsv(argv[3], results, &error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
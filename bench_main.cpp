@@ -0,0 +1,310 @@
+#include "benchmark.h"
+#include "constraints.h"
+#include "sdfconstraint.h"
+#include "solver.h"
+#include "multithreading.h"
+
+#ifdef SOLVER_BENCH_RENDER
+#include "renderer.h"
+#include <QImage>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <thread>
+
+
+namespace
+{
+    constexpr float kRadius  = 5.f;
+    constexpr float kSpacing = 9.f; // less than a diameter, most neighbors are touching
+
+    volatile float sink = 0.f; // keep the result of the kernels alive
+
+    /**
+     * count spheres on a jittered square lattice around center
+     */
+    std::vector<Sphere> scatter(int count, const vec2 &center, float spacing, std::uint32_t seed = 1)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> jitter(-0.25f * spacing, 0.25f * spacing);
+
+        const int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<float>(count)))));
+        const vec2 origin = center - vec2(0.5f * side * spacing, 0.5f * side * spacing);
+
+        std::vector<Sphere> spheres(count);
+        for (int i = 0; i < count; ++i) {
+            Sphere &sphere = spheres[i];
+            sphere.radius = kRadius;
+            sphere.setMass(1.f);
+            sphere.position = origin + vec2(static_cast<float>(i % side) * spacing + jitter(rng),
+                                            static_cast<float>(i / side) * spacing + jitter(rng));
+            sphere.prevPosition = sphere.position;
+        }
+        return spheres;
+    }
+
+    /**
+     * fixture of a kernel working on the spheres of a grid, they are restored before every run
+     */
+    struct GridState
+    {
+        Grid grid {200.f};
+        std::vector<Sphere> pristine;
+
+        explicit GridState(int count) : pristine(scatter(count, vec2(0.f, 0.f), kSpacing))
+        {
+            grid.bodies = pristine;
+            grid.rebuild();
+        }
+
+        void reset() { std::copy(pristine.begin(), pristine.end(), grid.bodies.begin()); }
+    };
+
+    bench::Case projectCase(const std::string &name, std::shared_ptr<StaticConstraint> constraint, const vec2 &center)
+    {
+        return {"project/" + name, false, [constraint, center](int count) {
+            auto pristine = std::make_shared<std::vector<Sphere>>(scatter(count, center, 2.f * kRadius));
+            auto spheres = std::make_shared<std::vector<Sphere>>(*pristine);
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.reset = [pristine, spheres]() { std::copy(pristine->begin(), pristine->end(), spheres->begin()); };
+            fixture.run = [constraint, spheres]() {
+                float total = 0.f;
+                for (Sphere &sphere : *spheres) total += constraint->project(sphere);
+                sink = total;
+            };
+            return fixture;
+        }};
+    }
+
+    std::vector<bench::Case> makeCases()
+    {
+        std::vector<bench::Case> cases;
+
+        cases.push_back({"resolveSpherePair", false, [](int count) {
+            // independent overlapping pairs, the first one of each pair is the reference
+            auto pristine = std::make_shared<std::vector<Sphere>>(scatter(2 * count, vec2(0.f, 0.f), 4.f * kRadius));
+            for (int i = 0; i < count; ++i) {
+                (*pristine)[2 * i + 1].position = (*pristine)[2 * i].position + vec2(1.5f * kRadius, 0.3f * kRadius);
+            }
+            auto spheres = std::make_shared<std::vector<Sphere>>(*pristine);
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.reset = [pristine, spheres]() { std::copy(pristine->begin(), pristine->end(), spheres->begin()); };
+            fixture.run = [spheres, count]() {
+                float total = 0.f;
+                for (int i = 0; i < count; ++i) total += solver::resolveSpherePair((*spheres)[2 * i], (*spheres)[2 * i + 1]);
+                sink = total;
+            };
+            return fixture;
+        }});
+
+        cases.push_back({"updateGrid", false, [](int count) {
+            auto state = std::make_shared<GridState>(count);
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.run = [state]() { state->grid.rebuild(); };
+            return fixture;
+        }});
+
+        cases.push_back({"buildContactList", true, [](int count) {
+            auto state = std::make_shared<GridState>(count);
+            auto contacts = std::make_shared<ContactList>();
+            contacts->skin = 4.f;
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.run = [state, contacts]() { solver::buildContactList(state->grid, *contacts); };
+            return fixture;
+        }});
+
+        cases.push_back({"solveSphereContacts", true, [](int count) {
+            auto state = std::make_shared<GridState>(count);
+            auto contacts = std::make_shared<ContactList>();
+            contacts->skin = 4.f;
+            solver::buildContactList(state->grid, *contacts);
+            bench::Fixture fixture;
+            fixture.items = std::max(1, static_cast<int>(contacts->pairs.size()));
+            fixture.reset = [state]() { state->reset(); };
+            fixture.run = [state, contacts]() { sink = solver::solveSphereContacts(state->grid, *contacts); };
+            return fixture;
+        }});
+
+        cases.push_back({"forEachSphere", true, [](int count) {
+            // trivial task, what is left is the cost of the dispatch and of the indirect call of the task
+            auto state = std::make_shared<GridState>(count);
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.run = [state]() {
+                multithreading::forEachSphere(state->grid, [](Sphere &sphere) { sphere.velocity *= 0.999f; });
+            };
+            return fixture;
+        }});
+
+        cases.push_back({"satisfySpringConstraints", false, [](int count) {
+            // chains of 16 spheres stretched by 20%
+            auto state = std::make_shared<GridState>(count);
+            auto springs = std::make_shared<std::vector<SpringLink>>();
+            for (int i = 0; i + 1 < count; ++i) {
+                if ((i + 1) % 16 == 0)
+                    continue;
+                SpringLink spring;
+                spring.a = i;
+                spring.b = i + 1;
+                spring.restLength = (state->pristine[i + 1].position - state->pristine[i].position).length() / 1.2f;
+                spring.stiffness = 0.5f;
+                springs->push_back(spring);
+            }
+            bench::Fixture fixture;
+            fixture.items = std::max(1, static_cast<int>(springs->size()));
+            fixture.reset = [state]() { state->reset(); };
+            fixture.run = [state, springs]() { sink = solver::satisfySpringConstraints(state->grid, *springs, 4); };
+            return fixture;
+        }});
+
+        // each sphere is near the surface of the obstacle, about half of them are penetrating
+        cases.push_back(projectCase("plane", std::make_shared<PlaneConstraint>(vec2(0.f, -1.f), -1000.f), vec2(0.f, 1000.f)));
+        cases.push_back(projectCase("sphere", std::make_shared<SphereConstraint>(vec2(0.f, 0.f), 2000.f), vec2(2000.f, 0.f)));
+        cases.push_back(projectCase("bowl", std::make_shared<BowlConstraint>(vec2(0.f, 0.f), 2000.f), vec2(2000.f, 0.f)));
+        cases.push_back(projectCase("segment", std::make_shared<SegmentConstraint>(vec2(-4000.f, 0.f), vec2(4000.f, 0.f), 2.f),
+                                    vec2(0.f, 0.f)));
+
+        const std::vector<std::vector<vec2>> square = {{{-1000.f, -1000.f}, {1000.f, -1000.f}, {1000.f, 1000.f},
+                                                        {-1000.f, 1000.f}, {-1000.f, -1000.f}}};
+        cases.push_back(projectCase("sdf", SdfConstraint::fromPolylines(square, 8.f), vec2(1000.f, 0.f)));
+
+#ifdef SOLVER_BENCH_RENDER
+        cases.push_back({"render", false, [](int count) {
+            auto context = std::make_shared<Context>();
+            context->initialize(vec2(800.f, 600.f));
+            context->spawnSpheres(scatter(count, vec2(400.f, 300.f), 600.f / std::sqrt(static_cast<float>(count))));
+            auto image = std::make_shared<QImage>(800, 600, QImage::Format_ARGB32_Premultiplied);
+            bench::Fixture fixture;
+            fixture.items = count;
+            fixture.run = [context, image]() {
+                image->fill(Qt::white);
+                QPainter painter(image.get());
+                painter.setRenderHint(QPainter::Antialiasing);
+                renderer::render(painter, *context);
+            };
+            return fixture;
+        }});
+#endif
+        return cases;
+    }
+
+    std::vector<int> parseList(const char *text)
+    {
+        std::vector<int> values;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            const int value = std::atoi(item.c_str());
+            if (value > 0)
+                values.push_back(value);
+        }
+        return values;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+                     "usage: SOLVER_bench [--counts 1000,10000,100000] [--threads 1,2,4] [--filter name]\n"
+                     "                    [--samples 5] [--save baseline.txt] [--compare baseline.txt] [--threshold 10]\n"
+                     "--threshold is the slowdown in percent above which a case is reported as a regression\n");
+    }
+}
+
+/**
+ * microbenchmarks of the solver kernels. The time is the fastest sample, per element (sphere, pair, spring)
+ * exit code 1 when --compare found a regression
+ */
+int main(int argc, char *argv[])
+{
+    std::vector<int> counts = {1000, 10000, 100000};
+    std::vector<int> threads = {1, 2, 4, static_cast<int>(std::thread::hardware_concurrency())};
+    std::string filter, savePath, comparePath;
+    int samples = 5;
+    double threshold = 10.0;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--counts") && hasValue) {
+            counts = parseList(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--threads") && hasValue) {
+            threads = parseList(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--filter") && hasValue) {
+            filter = argv[++i];
+        } else if (!std::strcmp(argv[i], "--samples") && hasValue) {
+            samples = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--save") && hasValue) {
+            savePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--compare") && hasValue) {
+            comparePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--threshold") && hasValue) {
+            threshold = std::atof(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    threads.erase(std::remove(threads.begin(), threads.end(), 0), threads.end());
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+    if (counts.empty() || threads.empty()) {
+        usage();
+        return 2;
+    }
+
+#ifndef NDEBUG
+    std::fprintf(stderr, "warning: built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers\n");
+#endif
+
+    std::vector<bench::Result> results;
+    std::printf("%-28s %8s %7s %12s %12s\n", "case", "count", "threads", "ns/item", "us/run");
+
+    for (const bench::Case &benchCase : makeCases()) {
+        if (!filter.empty() && benchCase.name.find(filter) == std::string::npos)
+            continue;
+
+        for (int count : counts) {
+            bench::Fixture fixture = benchCase.setup(count);
+            for (int threadCount : threads) {
+                if (!benchCase.threaded && threadCount != threads.front())
+                    break;
+
+                multithreading::setMaxThreadCount(benchCase.threaded ? threadCount : 1);
+                const bench::Result result = bench::measure(benchCase.name, fixture, count,
+                                                            benchCase.threaded ? threadCount : 1, samples);
+                std::printf("%-28s %8d %7d %12.2f %12.1f\n", result.name.c_str(), result.count, result.threads,
+                            result.nsPerItem, result.usPerRun);
+                std::fflush(stdout);
+                results.push_back(result);
+            }
+        }
+    }
+
+    std::string error;
+    if (!savePath.empty() && !bench::saveResults(savePath, results, &error))
+        std::fprintf(stderr, "%s\n", error.c_str());
+
+    if (comparePath.empty())
+        return 0;
+
+    std::vector<bench::Result> baseline;
+    if (!bench::loadResults(comparePath, baseline, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+
+    std::printf("\n");
+    const int regressions = bench::compare(results, baseline, threshold / 100.0, stdout);
+    std::printf("%d regression(s) above %.0f%%\n", regressions, threshold);
+    return regressions > 0 ? 1 : 0;
+}
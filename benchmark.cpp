@@ -0,0 +1,123 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr double kSampleSeconds = 0.005;
+    constexpr int kMaxRunsPerSample = 1 << 16;
+
+    double timedRun(bench::Fixture &fixture)
+    {
+        if (fixture.reset)
+            fixture.reset();
+        const auto start = Clock::now();
+        fixture.run();
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    const bench::Result *findResult(const std::vector<bench::Result> &results, const bench::Result &key)
+    {
+        for (const bench::Result &result : results) {
+            if (result.name == key.name && result.count == key.count && result.threads == key.threads)
+                return &result;
+        }
+        return nullptr;
+    }
+}
+
+bench::Result bench::measure(const std::string &name, Fixture &fixture, int count, int threads, int samples)
+{
+    Result result;
+    result.name = name;
+    result.count = count;
+    result.threads = threads;
+
+    // warm up the caches and the thread pool, and find how many runs fill a sample
+    const double first = std::max(1e-9, timedRun(fixture));
+    const int runs = std::clamp(static_cast<int>(kSampleSeconds / first), 1, kMaxRunsPerSample);
+
+    std::vector<double> perRun;
+    for (int sample = 0; sample < std::max(1, samples); ++sample) {
+        double total = 0.0;
+        for (int run = 0; run < runs; ++run) total += timedRun(fixture);
+        perRun.push_back(total / runs);
+    }
+
+    // the fastest sample is the one the least disturbed by the rest of the machine
+    const double fastest = *std::min_element(perRun.begin(), perRun.end());
+    result.usPerRun = fastest * 1e6;
+    result.nsPerItem = fastest * 1e9 / std::max(1, fixture.items);
+    return result;
+}
+
+bool bench::saveResults(const std::string &path, const std::vector<Result> &results, std::string *error)
+{
+    std::ofstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+
+    file << "# name count threads nsPerItem\n";
+    for (const Result &result : results)
+        file << result.name << ' ' << result.count << ' ' << result.threads << ' ' << result.nsPerItem << '\n';
+    return true;
+}
+
+bool bench::loadResults(const std::string &path, std::vector<Result> &results, std::string *error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot open " + path;
+        return false;
+    }
+
+    std::string text;
+    int lineNumber = 0;
+    while (std::getline(file, text)) {
+        ++lineNumber;
+        if (text.empty() || text[0] == '#')
+            continue;
+
+        std::istringstream line(text);
+        Result result;
+        if (!(line >> result.name >> result.count >> result.threads >> result.nsPerItem)) {
+            if (error)
+                *error = path + " line " + std::to_string(lineNumber) + ": expects name count threads nsPerItem";
+            return false;
+        }
+        results.push_back(result);
+    }
+    return true;
+}
+
+int bench::compare(const std::vector<Result> &results, const std::vector<Result> &baseline, double threshold, std::FILE *out)
+{
+    int regressions = 0;
+    std::fprintf(out, "%-28s %8s %7s %12s %12s %8s\n", "case", "count", "threads", "baseline ns", "now ns", "change");
+
+    for (const Result &result : results) {
+        const Result *reference = findResult(baseline, result);
+        if (!reference || reference->nsPerItem <= 0.0) {
+            std::fprintf(out, "%-28s %8d %7d %12s %12.2f %8s\n", result.name.c_str(), result.count, result.threads,
+                         "-", result.nsPerItem, "new");
+            continue;
+        }
+
+        const double change = result.nsPerItem / reference->nsPerItem - 1.0;
+        const bool regressed = change > threshold;
+        regressions += regressed ? 1 : 0;
+        std::fprintf(out, "%-28s %8d %7d %12.2f %12.2f %+7.1f%%%s\n", result.name.c_str(), result.count, result.threads,
+                     reference->nsPerItem, result.nsPerItem, 100.0 * change, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
@@ -0,0 +1,64 @@
+#ifndef SOLVER_BENCHMARK_H
+#define SOLVER_BENCHMARK_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+/**
+ * Minimal harness for the microbenchmarks of the solver kernels (see bench_main.cpp).
+ * A case is measured for each particle count and each thread count, the results can be saved
+ * as a baseline and compared with a later run to catch regressions.
+ */
+namespace bench
+{
+    /**
+     * state of a case for one particle count. reset is called before every run and is not timed,
+     * so a kernel that changes its input (a projection, a contact) always start from the same state
+     */
+    struct Fixture
+    {
+        std::function<void ()> reset;
+        std::function<void ()> run;
+        int items = 0; // element processed by one run, the time is reported per element
+    };
+
+    struct Case
+    {
+        std::string name;
+        bool threaded = false; // single threaded cases are only measured with one thread
+        std::function<Fixture (int count)> setup;
+    };
+
+    struct Result
+    {
+        std::string name;
+        int count      = 0;
+        int threads    = 1;
+        double nsPerItem = 0.0; // fastest of the samples
+        double usPerRun  = 0.0;
+    };
+
+    /**
+     * time the runs of a fixture, enough runs are done per sample to last a few milliseconds
+     * @param samples the fastest sample is kept
+     */
+    Result measure(const std::string &name, Fixture &fixture, int count, int threads, int samples = 5);
+
+    /**
+     * one line per result: name count threads nsPerItem
+     */
+    bool saveResults(const std::string &path, const std::vector<Result> &results, std::string *error = nullptr);
+    bool loadResults(const std::string &path, std::vector<Result> &results, std::string *error = nullptr);
+
+    /**
+     * print each result next to its baseline and flag the ones slower than the baseline by more than threshold
+     * @param threshold relative slowdown tolerated, 0.1 for 10%
+     * @return number of regressions
+     */
+    int compare(const std::vector<Result> &results, const std::vector<Result> &baseline, double threshold, std::FILE *out);
+}
+
+#endif //SOLVER_BENCHMARK_H
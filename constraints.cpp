@@ -1,83 +1,119 @@
 #include "constraints.h"
-#include <QtMath>
+#include <algorithm>
 
-PlaneConstraint::PlaneConstraint(const QVector2D &normal, float distance)
+PlaneConstraint::PlaneConstraint(const vec2 &normal, float distance)
 {
-    QVector2D n = normal;
+    vec2 n = normal;
     if (n.isNull()) {
-        n = QVector2D(0.f, 1.f); // just a non zero vector to not raise an ecept. maybe we should
+        n = vec2(0.f, 1.f); // just a non zero vector to not raise an ecept. maybe we should
     } else {
-        n.normalize();
+        n = n.normalized();
     }
     m_normal = n;
     m_distance = distance;
 }
 
-void PlaneConstraint::project(Sphere &sphere) const
+float PlaneConstraint::project(Sphere &sphere) const
 {
     if (sphere.invMass <= 0.f)
-        return;
+        return 0.f;
 
-    auto center = QVector2D(sphere.position);
-    float signedDistance = QVector2D::dotProduct(m_normal, center) - m_distance - sphere.radius; // compute this distance between the plane and the frontier of the sphere
+    float signedDistance = dot(m_normal, sphere.position) - m_distance - sphere.radius; // compute this distance between the plane and the frontier of the sphere
 
     if (signedDistance < 0.f) {
-        QVector2D correction = -signedDistance * m_normal;
-        sphere.position += QPointF(correction.x(), correction.y());
+        sphere.position += -signedDistance * m_normal;
+        return -signedDistance;
     }
+    return 0.f;
 }
 
-SphereConstraint::SphereConstraint(const QPointF &center, float radius) :
-    m_center(center), m_radius(qMax(0.f, radius)){}
+SphereConstraint::SphereConstraint(const vec2 &center, float radius) :
+    m_center(center), m_radius(std::max(0.f, radius)){}
 
-void SphereConstraint::project(Sphere &sphere) const
+float SphereConstraint::project(Sphere &sphere) const
 {
     if (sphere.invMass <= 0.f)
-        return;
+        return 0.f;
 
-    auto delta = QVector2D(sphere.position - m_center);
+    vec2 delta = sphere.position - m_center;
     float dist = delta.length();
     float minDist = m_radius + sphere.radius;
 
     if (dist >= minDist)
-        return;
+        return 0.f;
 
     if (dist < 1e-5f) { // if the two are superposed we send the sphere in random direction with distance one
-        delta = QVector2D(1.f, 0.f);
+        delta = vec2(1.f, 0.f);
         dist = 1.f;
     }
 
-    QVector2D normal = delta / dist;
+    vec2 normal = delta / dist;
     float penetration = minDist - dist;
-    QVector2D correction = normal * penetration;
 
-    sphere.position += QPointF(correction.x(), correction.y());
+    sphere.position += normal * penetration;
+    return penetration;
 }
 
-BowlConstraint::BowlConstraint(const QPointF &center, float radius) : m_center(center), m_radius(qMax(0.f, radius)) {}
+BowlConstraint::BowlConstraint(const vec2 &center, float radius) : m_center(center), m_radius(std::max(0.f, radius)) {}
 
-void BowlConstraint::project(Sphere &sphere) const
+float BowlConstraint::project(Sphere &sphere) const
 {
     if (sphere.invMass <= 0.f || m_radius <= 0.f)
-        return;
+        return 0.f;
 
-    auto delta = QVector2D(sphere.position - m_center);
+    vec2 delta = sphere.position - m_center;
     float dist = delta.length();
 
-    float maxDist = qMax(0.f, m_radius - sphere.radius);
+    float maxDist = std::max(0.f, m_radius - sphere.radius);
     if (dist <= maxDist)
-        return;
+        return 0.f;
 
     if (dist < 1e-5f) {
         // Si la sphère est exactement au centre, on l’éloigne un peu
-        delta = QVector2D(0.f, -1.f);
+        delta = vec2(0.f, -1.f);
         dist = 1.f;
     }
 
-    QVector2D normal = delta / dist;
+    vec2 normal = delta / dist;
     float penetration = dist - maxDist;
-    QVector2D correction = normal * penetration;
 
     // On la ramène vers l’intérieur de la cuvette
-    sphere.position -= QPointF(correction.x(), correction.y());
-}
\ No newline at end of file
+    sphere.position -= normal * penetration;
+    return penetration;
+}
+
+SegmentConstraint::SegmentConstraint(const vec2 &a, const vec2 &b, float thickness) :
+    m_a(a), m_b(b), m_thickness(std::max(0.f, thickness)) {}
+
+float SegmentConstraint::project(Sphere &sphere) const
+{
+    if (sphere.invMass <= 0.f)
+        return 0.f;
+
+    const vec2 ab = m_b - m_a;
+    const float lengthSquared = ab.lengthSquared();
+    const float t = lengthSquared > 0.f ? std::clamp(dot(sphere.position - m_a, ab) / lengthSquared, 0.f, 1.f) : 0.f;
+    const vec2 closest = m_a + ab * t;
+
+    vec2 delta = sphere.position - closest;
+    float dist = delta.length();
+    const float minDist = m_thickness + sphere.radius;
+    if (dist >= minDist)
+        return 0.f;
+
+    if (dist < 1e-5f) { // center on the segment, push along its normal
+        delta = lengthSquared > 0.f ? vec2(-ab.y, ab.x) : vec2(0.f, -1.f);
+        dist = delta.length();
+    }
+
+    const float penetration = minDist - dist;
+    sphere.position += delta / dist * penetration;
+    return penetration;
+}
+
+box2 SegmentConstraint::bounds() const
+{
+    box2 box = box2::around(m_a, m_thickness);
+    box.expand(box2::around(m_b, m_thickness));
+    return box;
+}
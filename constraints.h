@@ -2,8 +2,6 @@
 #define SOLVER_CONSTRAINTS_H
 
 #include "physicalbody.h"
-#include <QVector2D>
-#include <QPointF>
 
 
 /**
@@ -17,8 +15,15 @@ public:
     /**
      * Resolve a colision with a sphere
      * @param sphere
+     * @return length of the correction applied to the sphere, 0 if it was already satisfied
      */
-    virtual void project(Sphere &sphere) const = 0;
+    virtual float project(Sphere &sphere) const = 0;
+
+    /**
+     * region where the constraint can act on a sphere, grown by the radius of the sphere.
+     * obstacles with an infinite box (planes, bowls) are tested against every sphere
+     */
+    [[nodiscard]] virtual box2 bounds() const { return box2::infinite(); }
 };
 
 
@@ -30,16 +35,16 @@ class PlaneConstraint : public StaticConstraint
 public:
     PlaneConstraint() = default;
 
-    PlaneConstraint(const QVector2D &normal, float distance);
+    PlaneConstraint(const vec2 &normal, float distance);
 
     /**
      * Compute the signed distance between the sphere and the plane and correct accordingly
      * @param sphere
      */
-    void project(Sphere &sphere) const override;
+    float project(Sphere &sphere) const override;
 
 private:
-    QVector2D m_normal = QVector2D(0.f, 1.f);
+    vec2 m_normal = vec2(0.f, 1.f);
     float m_distance = 0.f;
 };
 
@@ -52,40 +57,71 @@ class SphereConstraint : public StaticConstraint
 public:
     SphereConstraint() = default;
 
-    SphereConstraint(const QPointF &center, float radius);
+    SphereConstraint(const vec2 &center, float radius);
 
     /**
      * compute the penetration and resolve acordingly
      * @param sphere
      */
-    void project(Sphere &sphere) const override;
+    float project(Sphere &sphere) const override;
 
-    [[nodiscard]] const QPointF &center() const { return m_center; }
+    [[nodiscard]] box2 bounds() const override { return box2::around(m_center, m_radius); }
+
+    [[nodiscard]] const vec2 &center() const { return m_center; }
     [[nodiscard]] float radius() const { return m_radius; }
 
 private:
-    QPointF m_center = QPointF(0.0, 0.0);
+    vec2 m_center = vec2(0.f, 0.f);
     float m_radius = 10.f;
 };
 
+/**
+ * A segment constraint is a wall between two points with a thickness (a capsule). Spheres are pushed out on
+ * the closest side, it is the building block of level geometry.
+ */
+class SegmentConstraint : public StaticConstraint
+{
+public:
+    SegmentConstraint() = default;
+
+    SegmentConstraint(const vec2 &a, const vec2 &b, float thickness);
+
+    /**
+     * compute the distance to the closest point of the segment and resolve acordingly
+     * @param sphere
+     */
+    float project(Sphere &sphere) const override;
+
+    [[nodiscard]] box2 bounds() const override;
+
+    [[nodiscard]] const vec2 &a() const { return m_a; }
+    [[nodiscard]] const vec2 &b() const { return m_b; }
+    [[nodiscard]] float thickness() const { return m_thickness; }
+
+private:
+    vec2 m_a = vec2(0.f, 0.f);
+    vec2 m_b = vec2(1.f, 0.f);
+    float m_thickness = 0.f;
+};
+
 class BowlConstraint : public StaticConstraint
 {
 public:
     BowlConstraint() = default;
 
-    BowlConstraint(const QPointF &center, float radius);
+    BowlConstraint(const vec2 &center, float radius);
 
     /**
      * Compute the penetration and resolve acrodingly
      * @param sphere
      */
-    void project(Sphere &sphere) const override;
+    float project(Sphere &sphere) const override;
 
-    [[nodiscard]] const QPointF &center() const { return m_center; }
+    [[nodiscard]] const vec2 &center() const { return m_center; }
     [[nodiscard]] float radius() const { return m_radius; }
 
 private:
-    QPointF m_center = QPointF(0.0, 0.0);
+    vec2 m_center = vec2(0.f, 0.f);
     float m_radius = 100.f;
 };
 
@@ -0,0 +1,125 @@
+#ifndef SOLVER_CONTACTLIST_H
+#define SOLVER_CONTACTLIST_H
+
+#include <cstdint>
+#include <vector>
+#include "vec2.h"
+
+
+/**
+ * two spheres close enough to touch, index in Grid::bodies
+ */
+struct ContactPair
+{
+    int a = -1;
+    int b = -1;
+};
+
+/**
+ * pairs between a cell and itself or one of its neighbor.
+ * the narrow phase lock both cells before resolving the pairs in [begin, end)
+ */
+struct ContactBatch
+{
+    int firstCell  = 0;
+    int secondCell = 0;
+    int begin      = 0;
+    int end        = 0;
+    int ownerCell  = 0; // cell whose neighbors were searched to find the pairs
+};
+
+/**
+ * pairs and batches found by one thread of the broadphase, the ranges of the batches are local to the buffer.
+ * Kept by the list so that the threads reuse their memory from one build to the next
+ */
+struct BroadphaseBuffer
+{
+    std::vector<ContactPair> pairs;
+    std::vector<ContactBatch> batches;
+    std::vector<int> sortedCell;     // scratch of the sort and sweep, see ContactList::sweepThreshold
+    std::vector<int> sortedNeighbor;
+};
+
+/**
+ * range of Grid::activeCells searched in one go by a thread, and what it found in the buffer of the thread
+ */
+struct BroadphaseChunk
+{
+    int activeBegin = 0;
+    int buffer      = 0;
+    int pairBegin   = 0;
+    int pairEnd     = 0;
+    int batchBegin  = 0;
+    int batchEnd    = 0;
+};
+
+/**
+ * spheres of an overloaded cell sorted along x, see ContactList::sweepThreshold
+ */
+struct SweepOrder
+{
+    std::vector<int> handles; // order of the last build, as handles so that it survives the reordering of the spheres
+    std::vector<int> sorted;  // index in Grid::bodies, valid for the current build
+    float reach = 0.f;        // largest radius plus margin of the spheres of the cell
+    cell2 cell {};            // coordinates of the cell it belongs to
+};
+
+/**
+ * Verlet list: every pair closer than the sum of the radius plus the margins of the two spheres.
+ * It stay valid as long as no sphere moved further than its margin since it was built,
+ * so the broadphase is done once and reused by every solver iteration (and following substeps).
+ *
+ * The margin of a sphere is half the skin, grown by its displacement over the substep when the
+ * contacts are speculative: a fast sphere then get the pairs it may hit before the end of the substep.
+ */
+struct ContactList
+{
+    float skin = 0.f;
+    bool speculative = true; // resolve the impacts predicted along the path of the substep, see solveSphereContacts
+    bool deterministic = false; // solve the batches in a fixed order, see solveSphereContacts
+    bool valid = false;
+
+    std::vector<ContactPair> pairs;
+    std::vector<ContactBatch> batches;
+
+    // deterministic order: batches are grouped by owner cell, the groups of a color touch disjoint cells
+    std::vector<int> groupStarts; // first batch of each group, then batches.size()
+    std::vector<int> colorStarts; // first group of each color, then the number of groups
+    std::vector<vec2> referencePositions; // position of each sphere when the list was built
+    std::vector<float> margins;           // distance each sphere can move from its reference position
+
+    // ghosts (see Context::addGhosts): the spheres from ghostBegin on change at every substep, the build only
+    // pairs the spheres before it and the pairs with the ghosts follow the built ones, see refreshGhostPairs
+    int ghostBegin = -1; // -1 = no ghost
+    int builtPairs = 0;  // sizes of pairs, batches, groupStarts and colorStarts at the end of the build
+    int builtBatches = 0;
+    int builtGroups = 0;
+    int builtColors = 0;
+    std::vector<int> ghostCells; // scratch, cells holding a ghost
+
+    // collision filter of each sphere packed in one word, only checked when a sphere has a non default filter
+    bool filtered = false;
+    std::vector<std::uint64_t> filterKeys;
+
+    // sort and sweep: the pairs of a cell holding more than sweepThreshold spheres are found by sweeping its
+    // spheres sorted along x instead of testing all of them (0 = never). The order is kept from one build to
+    // the next, an insertion sort only has to fix the few spheres that passed each other
+    int sweepThreshold = 32;
+    int buildCount = 0;
+    std::vector<SweepOrder> sweepPool; // orders of the overloaded cells, an entry goes back to sweepFree with its memory
+    std::vector<int> sweepActive;      // entries of sweepPool held by a cell since the last build
+    std::vector<int> sweepFree;        // the other entries of sweepPool
+    std::vector<int> sweepCells;       // overloaded cells of the current build
+    std::vector<int> sweepSlots;       // entry of sweepPool of each cell of Grid::cells, -1 if it is not overloaded
+    std::vector<std::uint64_t> sweepStamps; // scratch, per sphere
+
+    // scratch of the build, one buffer per thread of the pool
+    std::vector<BroadphaseBuffer> buffers;
+    std::vector<BroadphaseChunk> chunks;
+    std::vector<ContactBatch> sortedBatches;
+    std::vector<int> colorGroups;
+
+    void invalidate() { valid = false; }
+};
+
+#endif //SOLVER_CONTACTLIST_H
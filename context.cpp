@@ -3,37 +3,25 @@
 //
 
 #include "context.h"
+#include "alloctrack.h"
+#include "scenefile.h"
+#include "trace.h"
 
 
-namespace
+void Context::initialize(const vec2 &initialSize)
 {
-    inline int clampIndex(int value, qsizetype size)
-    {
-        if (size <= 0)
-            return 0;
-
-        const int maxIndex = static_cast<int>(size - 1);
-        return std::clamp(value, 0, maxIndex);
-    }
-}
-
-
-
-void Context::initialize(const QSize &initialSize)
-{
-    QSize size = initialSize.isEmpty() ? QSize(800, 600) : initialSize;
+    vec2 size = (initialSize.x <= 0.f || initialSize.y <= 0.f) ? vec2(800.f, 600.f) : initialSize;
     sceneSize_ = size;
-    initializeGrid(size);
     rebuildStaticConstraints();
 }
 
-void Context::resizeScene(const QSize &newSize)
+void Context::resizeScene(const vec2 &newSize)
 {
-    if (newSize.isEmpty())
+    if (newSize.x <= 0.f || newSize.y <= 0.f)
         return;
 
+    // the grid does not depend on the size of the scene, only the walls move
     sceneSize_ = newSize;
-    rebuildGrid(newSize);
     rebuildStaticConstraints();
 }
 
@@ -42,245 +30,796 @@ void Context::step(float frameDt)
     if (frameDt <= 0.f)
         return;
 
+    trace::Scope frameScope("frame", frameCount);
+    alloctrack::ForbidScope forbidScope(hasFixedCapacity());
     const float dt = frameDt / static_cast<float>(subSteps);
+    stepStats = StepStats();
+
+    {
+        alloctrack::PhaseScope phase(alloctrack::Phase::Emit);
+        stepStats.removed = removeExpired(frameDt);
+        emitFromEmitters(frameDt);
+    }
+
+    if (reorderInterval > 0 && frameCount % reorderInterval == 0) {
+        alloctrack::PhaseScope phase(alloctrack::Phase::Reorder);
+        reorderBodies();
+    }
+    ++frameCount;
+
+    // the strides are chosen once per frame, every stride ends with the last substep
+    stepRates = nullptr;
+    rates.sphereStrides.clear();
+    if (multirateSettings.enabled && subSteps > 1 && !substepBegin && !substepEnd) {
+        alloctrack::PhaseScope phase(alloctrack::Phase::Rates);
+        solver::assignSubstepRates(grid_, contactList, multirateSettings, subSteps, dt, rates);
+        stepRates = &rates;
+    }
 
     for (int stepIndex = 0; stepIndex < subSteps; ++stepIndex) {
-        solver::integrateBodies(grid_, dt);
-        updateGrid();
+        trace::Scope substepScope("substep", stepIndex);
+        {
+            alloctrack::PhaseScope phase(alloctrack::Phase::Integrate);
+            if (stepRates) {
+                rates.substep = stepIndex;
+                stepStats.sphereSubsteps += solver::freezeSleeping(grid_, rates, frozenInvMass);
+            } else {
+                stepStats.sphereSubsteps += grid_.bodyCount();
+            }
+            solver::integrateBodies(grid_, dt, stepRates);
+        }
 
-        for (int iter = 0; iter < solverIterations; ++iter) {
-            solver::satisfyStaticConstraints(grid_, staticConstraints);
-            updateGrid();
+        if (substepBegin) {
+            trace::Scope scope("substep begin hook");
+            alloctrack::PhaseScope phase(alloctrack::Phase::Hooks);
+            substepBegin(*this);
+        }
 
-            solver::satisfySpringConstraints(grid_, springLinks, subSteps);
+        // the candidate list is only rebuilt when a sphere may have reached a pair that is not in it,
+        // the pairs with the ghosts are found again at every substep
+        if (solver::contactListNeedsRebuild(grid_, contactList)) {
+            alloctrack::PhaseScope phase(alloctrack::Phase::Broadphase);
             updateGrid();
+            solver::buildContactList(grid_, contactList, stepRates);
+            ++stepStats.broadphaseRebuilds;
+        } else if (ownedCount >= 0) {
+            alloctrack::PhaseScope phase(alloctrack::Phase::Broadphase);
+            solver::refreshGhostPairs(grid_, contactList);
+        }
 
-            solver::solveSphereContacts(
-                    grid_,
-                    gridCols,
-                    gridRows,
-                    [this](int col, int row) { return isValidCell(col, row); });
-            updateGrid();
+        alloctrack::PhaseScope solvePhase(alloctrack::Phase::Solve);
+        if (hasSchedule) {
+            solveScheduled();
+        } else {
+            for (int iter = 0; iter < solverIterations; ++iter) {
+                trace::Scope iterationScope("iteration", iter);
+                float residual = 0.f;
+                for (int c = 0; c < kConstraintClassCount; ++c) {
+                    const float classResidual = solvePass(static_cast<ConstraintClass>(c));
+                    ++stepStats.passes[c];
+                    stepStats.classResiduals[c] = classResidual;
+                    residual = std::max(residual, classResidual);
+                }
+
+                ++stepStats.iterations;
+                stepStats.residual = residual;
+
+                if (iter + 1 >= minSolverIterations && residual < convergenceTolerance)
+                    break;
+            }
+        }
+
+        if (substepEnd) {
+            trace::Scope scope("substep end hook");
+            alloctrack::PhaseScope phase(alloctrack::Phase::Hooks);
+            substepEnd(*this);
+        }
+
+        alloctrack::PhaseScope velocityPhase(alloctrack::Phase::Velocities);
+        solver::updateVelocities(grid_, dt, stepRates);
+        solver::applyVelocityDamping(grid_, dampingFactor, stepRates);
+        if (stepRates)
+            solver::thawSleeping(grid_, rates, frozenInvMass);
+    }
+    stepRates = nullptr;
+
+    // the spheres moved since the grid was built, the spatial queries have to search that much further
+    alloctrack::PhaseScope phase(alloctrack::Phase::Broadphase);
+    grid_.refreshReach();
+    stepStats.contactPairs = static_cast<int>(contactList.pairs.size());
+}
+
+void Context::setConvergenceCriteria(float tolerance, int minIterations, int maxIterations)
+{
+    convergenceTolerance = std::max(0.f, tolerance);
+    solverIterations     = std::max(1, maxIterations);
+    minSolverIterations  = std::clamp(minIterations, 1, solverIterations);
+}
+
+float Context::solvePass(ConstraintClass constraintClass)
+{
+    switch (constraintClass) {
+        case ConstraintClass::Static:   return solver::satisfyStaticConstraints(grid_, obstacles);
+        case ConstraintClass::Springs:  return solver::satisfySpringConstraints(grid_, springLinks, subSteps, stepRates);
+        case ConstraintClass::Shapes:   return solver::satisfyShapeConstraints(grid_, clusters, subSteps, stepRates);
+        case ConstraintClass::Contacts: return solver::solveSphereContacts(grid_, contactList, stepRates);
+    }
+    return 0.f;
+}
+
+void Context::solveScheduled()
+{
+    std::array<int, kConstraintClassCount> passes {};
+    std::array<bool, kConstraintClassCount> satisfied {};
+    int longest = 0;
+    for (int c = 0; c < kConstraintClassCount; ++c) {
+        passes[c] = scheduledPasses(static_cast<ConstraintClass>(c));
+        longest = std::max(longest, passes[c]);
+    }
+
+    std::array<int, kConstraintClassCount> done {};
+    for (int iter = 0; iter < longest; ++iter) {
+        trace::Scope iterationScope("iteration", iter);
+        float residual = 0.f;
+        bool solved = false;
+
+        for (int c = 0; c < kConstraintClassCount; ++c) {
+            if (iter >= passes[c] || satisfied[c])
+                continue;
+
+            const float classResidual = solvePass(static_cast<ConstraintClass>(c));
+            ++done[c];
+            ++stepStats.passes[c];
+            stepStats.classResiduals[c] = classResidual;
+            residual = std::max(residual, classResidual);
+            satisfied[c] = iter + 1 >= minSolverIterations && classResidual < convergenceTolerance;
+            solved = true;
+
+            // the spheres it moved may violate the classes satisfied before, a contact pushing them into a wall
+            if (classResidual >= convergenceTolerance) {
+                for (int other = 0; other < kConstraintClassCount; ++other) {
+                    if (other != c)
+                        satisfied[other] = false;
+                }
+            }
+
+            // a strong pass (a static push, stiff springs) can move a sphere out of reach of its candidates
+            if (schedules[c].refreshContacts && solver::contactListNeedsRebuild(grid_, contactList)) {
+                alloctrack::PhaseScope phase(alloctrack::Phase::Broadphase);
+                updateGrid();
+                solver::buildContactList(grid_, contactList, stepRates);
+                ++stepStats.broadphaseRebuilds;
+            }
         }
 
-        solver::updateVelocities(grid_, dt);
-        solver::applyVelocityDamping(grid_, dampingFactor);
+        if (!solved)
+            break;
+        ++stepStats.iterations;
+        stepStats.residual = residual;
+
+        if (iter + 1 >= minSolverIterations && residual < convergenceTolerance)
+            break;
+    }
+
+    for (int c = 0; c < kConstraintClassCount; ++c) {
+        const ConstraintSchedule &schedule = schedules[c];
+        if (!schedule.adaptive)
+            continue;
+        if (!satisfied[c] && done[c] >= passes[c])
+            adaptivePasses[c] = std::min(passes[c] + 1, schedule.maxIterations);
+        else if (satisfied[c] && done[c] < passes[c])
+            adaptivePasses[c] = std::max(passes[c] - 1, schedule.minIterations);
     }
 }
 
-void Context::addUserSphere(const QPointF &position)
+void Context::setSchedule(ConstraintClass constraintClass, const ConstraintSchedule &schedule)
+{
+    const int c = static_cast<int>(constraintClass);
+    schedules[c] = schedule;
+    schedules[c].minIterations = std::max(1, schedule.minIterations);
+    schedules[c].maxIterations = std::max(schedules[c].minIterations, schedule.maxIterations);
+
+    const int start = schedule.iterations > 0 ? schedule.iterations : solverIterations;
+    adaptivePasses[c] = std::clamp(start, schedules[c].minIterations, schedules[c].maxIterations);
+    hasSchedule = true;
+}
+
+int Context::scheduledPasses(ConstraintClass constraintClass) const
+{
+    const int c = static_cast<int>(constraintClass);
+    if (!hasSchedule)
+        return solverIterations;
+    if (schedules[c].adaptive)
+        return adaptivePasses[c];
+    return schedules[c].iterations > 0 ? schedules[c].iterations : solverIterations;
+}
+
+void Context::clearSchedules()
+{
+    schedules = {};
+    hasSchedule = false;
+}
+
+void Context::setMultirate(const MultirateSettings &settings)
+{
+    multirateSettings = settings;
+    multirateSettings.maxStride = std::clamp(settings.maxStride, 1, kMaxSubstepStride);
+    multirateSettings.motionBudget = std::max(0.f, settings.motionBudget);
+}
+
+void Context::setContactSkin(float skin)
+{
+    contactList.skin = std::max(0.f, skin);
+    contactList.invalidate();
+}
+
+void Context::setCellSize(float size)
+{
+    targetCellSize = size;
+    grid_.setCellSize(size);
+    contactList.invalidate();
+}
+
+void Context::copySceneTo(Context &target) const
+{
+    target.subSteps             = subSteps;
+    target.solverIterations     = solverIterations;
+    target.dampingFactor        = dampingFactor;
+    target.minSolverIterations  = minSolverIterations;
+    target.convergenceTolerance = convergenceTolerance;
+    target.hasSchedule    = hasSchedule;
+    target.schedules      = schedules;
+    target.adaptivePasses = adaptivePasses;
+    target.multirateSettings = multirateSettings;
+    target.contactList.skin           = contactList.skin;
+    target.contactList.speculative    = contactList.speculative;
+    target.contactList.deterministic  = contactList.deterministic;
+    target.contactList.sweepThreshold = contactList.sweepThreshold;
+    target.contactList.invalidate();
+    target.clusterModel_   = clusterModel_;
+    target.reorderInterval = reorderInterval;
+    target.killZones_      = killZones_;
+
+    target.sceneSize_ = sceneSize_;
+    target.levelObstacles = levelObstacles;
+    target.rebuildStaticConstraints();
+
+    // the springs and clusters hold indices in the storage, kept by inserting the spheres in the same order
+    const int owned = ownedCount < 0 ? grid_.bodyCount() : ownedCount;
+    for (int i = 0; i < owned; ++i)
+        target.insertSphere(grid_.bodies[i]);
+    target.springLinks = springLinks;
+    target.clusters    = clusters;
+    target.nextGroupId = nextGroupId;
+}
+
+void Context::setSpeculativeContacts(bool enabled)
+{
+    contactList.speculative = enabled;
+    contactList.invalidate();
+}
+
+void Context::setFixedCapacity(const FixedCapacity &capacity)
+{
+    capacityBudget.spheres       = std::max(1, capacity.spheres);
+    capacityBudget.springs       = std::max(0, capacity.springs);
+    capacityBudget.contacts      = capacity.contacts > 0 ? capacity.contacts : 4 * capacityBudget.spheres;
+    capacityBudget.cellOccupancy = std::max(1, capacity.cellOccupancy);
+
+    // a sphere per cell at worst
+    const int spheres = capacityBudget.spheres;
+    grid_.reserve(spheres, spheres, capacityBudget.cellOccupancy);
+    springLinks.reserve(capacityBudget.springs);
+    emitBuffer.reserve(spheres);
+    frozenInvMass.reserve(spheres);
+    removedFlags.reserve(spheres);
+    removedGroups.reserve(spheres);
+    remappedIndices.reserve(spheres);
+    solver::reserveContactList(contactList, spheres, spheres, capacityBudget.contacts, capacityBudget.cellOccupancy);
+    solver::reserveSubstepRates(rates, spheres, spheres);
+    reorder::reserve(reorderScratch, spheres, capacityBudget.springs);
+}
+
+void Context::setSweepThreshold(int threshold)
+{
+    contactList.sweepThreshold = std::max(0, threshold);
+    contactList.invalidate();
+    // a lower threshold overloads more cells
+    if (hasFixedCapacity())
+        solver::reserveContactList(contactList, capacityBudget.spheres, capacityBudget.spheres,
+                                   capacityBudget.contacts, capacityBudget.cellOccupancy);
+}
+
+void Context::setDeterministic(bool enabled)
+{
+    contactList.deterministic = enabled;
+    contactList.invalidate();
+}
+
+std::vector<Sphere> Context::takeSpheresIf(const std::function<bool (const Sphere &)> &predicate)
+{
+    if (!predicate)
+        return {};
+
+    std::vector<char> marked(grid_.bodies.size(), 0);
+    for (std::size_t i = 0; i < marked.size(); ++i) marked[i] = predicate(grid_.bodies[i]) ? 1 : 0;
+    std::vector<Sphere> taken;
+    removeMarked(marked, &taken);
+    return taken;
+}
+
+int Context::removeMarked(const std::vector<char> &marked, std::vector<Sphere> *taken)
+{
+    const int count = grid_.bodyCount();
+    std::vector<int> &newIndex = remappedIndices;
+    newIndex.assign(count, -1);
+    int kept = 0;
+
+    for (int i = 0; i < count; ++i) {
+        if (i < static_cast<int>(marked.size()) && marked[i]) {
+            if (taken)
+                taken->push_back(grid_.bodies[i]);
+            if (i < static_cast<int>(grid_.bodyHandle.size()))
+                grid_.releaseHandle(grid_.bodyHandle[i]);
+            continue;
+        }
+        newIndex[i] = kept;
+        if (kept != i) {
+            grid_.bodies[kept] = grid_.bodies[i];
+            grid_.bodyHandle[kept] = grid_.bodyHandle[i];
+        }
+        ++kept;
+    }
+
+    if (kept == count)
+        return 0;
+
+    grid_.bodies.resize(kept);
+    grid_.bodyHandle.resize(kept);
+
+    auto remap = [&newIndex, count](int index) { return index >= 0 && index < count ? newIndex[index] : -1; };
+
+    for (int &index : grid_.handleIndex) {
+        if (index >= 0)
+            index = remap(index);
+    }
+
+    // compacted in place, the springs keep their capacity
+    std::size_t keptSprings = 0;
+    for (SpringLink spring : springLinks) {
+        spring.a = remap(spring.a);
+        spring.b = remap(spring.b);
+        if (spring.a >= 0 && spring.b >= 0)
+            springLinks[keptSprings++] = spring;
+    }
+    springLinks.resize(keptSprings);
+    remapClusters(newIndex);
+
+    updateGrid();
+    contactList.invalidate();
+    return count - kept;
+}
+
+bool Context::removeSphere(int handle)
+{
+    const Sphere *target = sphere(handle);
+    if (!target)
+        return false;
+
+    std::vector<char> marked(grid_.bodies.size(), 0);
+    marked[target - grid_.bodies.data()] = 1;
+    removeMarked(marked);
+    return true;
+}
+
+int Context::removeSpheres(const std::vector<int> &handles)
+{
+    std::vector<char> marked(grid_.bodies.size(), 0);
+    bool any = false;
+    for (int handle : handles) {
+        if (const Sphere *target = sphere(handle)) {
+            marked[target - grid_.bodies.data()] = 1;
+            any = true;
+        }
+    }
+    return any ? removeMarked(marked) : 0;
+}
+
+int Context::removeGroup(int groupId)
+{
+    if (groupId < 0)
+        return 0;
+    return static_cast<int>(takeSpheresIf([groupId](const Sphere &sphere) { return sphere.groupId == groupId; }).size());
+}
+
+int Context::removeExpired(float frameDt)
+{
+    if (!hasMortalSpheres && killZones_.empty())
+        return 0;
+
+    trace::Scope scope("remove expired");
+    const int count = grid_.bodyCount();
+    std::vector<char> &marked = removedFlags;
+    marked.assign(count, 0);
+    std::vector<int> &deadGroups = removedGroups;
+    deadGroups.clear();
+    bool mortal = false;
+    bool anyDead = false;
+
+    for (int i = 0; i < count; ++i) {
+        Sphere &sphere = grid_.bodies[i];
+        bool dead = false;
+        if (sphere.lifetime >= 0.f) {
+            sphere.lifetime -= frameDt;
+            dead = sphere.lifetime < 0.f;
+            mortal = true;
+        }
+        for (std::size_t z = 0; z < killZones_.size() && !dead; ++z)
+            dead = killZones_[z].contains(sphere.position);
+
+        if (dead) {
+            marked[i] = 1;
+            anyDead = true;
+            if (sphere.groupId >= 0)
+                deadGroups.push_back(sphere.groupId);
+        }
+    }
+    hasMortalSpheres = mortal;
+    if (!anyDead)
+        return 0;
+
+    // a dead node takes its whole cluster
+    if (!deadGroups.empty()) {
+        std::sort(deadGroups.begin(), deadGroups.end());
+        deadGroups.erase(std::unique(deadGroups.begin(), deadGroups.end()), deadGroups.end());
+        for (int i = 0; i < count; ++i) {
+            const int group = grid_.bodies[i].groupId;
+            if (group >= 0 && std::binary_search(deadGroups.begin(), deadGroups.end(), group))
+                marked[i] = 1;
+        }
+    }
+    return removeMarked(marked);
+}
+
+void Context::setSubstepHooks(std::function<void (Context &)> begin, std::function<void (Context &)> end)
+{
+    substepBegin = std::move(begin);
+    substepEnd = std::move(end);
+}
+
+void Context::addGhosts(const std::vector<Sphere> &ghosts)
+{
+    if (ownedCount < 0)
+        ownedCount = grid_.bodyCount();
+
+    for (const Sphere &ghost : ghosts) {
+        grid_.bodies.push_back(ghost);
+        grid_.insert(grid_.bodyCount() - 1);
+    }
+    contactList.ghostBegin = ownedCount;
+}
+
+void Context::clearGhosts()
+{
+    if (ownedCount < 0)
+        return;
+
+    grid_.bodies.resize(ownedCount);
+
+    // cells are only refreshed by a rebuild, dropping the ghost indices is enough and cheaper
+    for (std::vector<int> &cell : grid_.cells) {
+        cell.erase(std::remove_if(cell.begin(), cell.end(), [this](int index) { return index >= ownedCount; }),
+                   cell.end());
+    }
+    grid_.refreshActiveCells();
+    ownedCount = -1;
+    contactList.ghostBegin = -1;
+    solver::refreshGhostPairs(grid_, contactList);
+}
+
+bool Context::setCollisionFilter(int handle, const CollisionFilter &filter)
+{
+    if (!sphere(handle))
+        return false;
+    grid_.bodies[grid_.handleIndex[handle]].filter = filter;
+    contactList.invalidate();
+    return true;
+}
+
+int Context::setGroupCollisionFilter(int groupId, const CollisionFilter &filter)
+{
+    if (groupId < 0)
+        return 0;
+    int changed = 0;
+    for (Sphere &body : grid_.bodies) {
+        if (body.groupId == groupId) {
+            body.filter = filter;
+            ++changed;
+        }
+    }
+    if (changed > 0)
+        contactList.invalidate();
+    return changed;
+}
+
+const Sphere *Context::sphere(int handle) const
+{
+    if (handle < 0 || handle >= static_cast<int>(grid_.handleIndex.size()))
+        return nullptr;
+    const int index = grid_.handleIndex[handle];
+    if (index < 0 || index >= grid_.bodyCount())
+        return nullptr;
+    return &grid_.bodies[index];
+}
+
+int Context::addUserSphere(const vec2 &position)
 {
     Sphere sphere;
     sphere.position = position;
     sphere.prevPosition = sphere.position;
     sphere.radius = 30.f;
     sphere.setMass(std::max(1.f, sphere.radius * 0.5f));
-    sphere.color = QColor(
-            QRandomGenerator::global()->bounded(256),
-            QRandomGenerator::global()->bounded(256),
-            QRandomGenerator::global()->bounded(256));
+    sphere.color = randomColor();
 
-    insertSphere(sphere);
+    const int index = insertSphere(sphere);
+    return index < 0 ? -1 : grid_.bodyHandle[index];
 }
 
-void Context::emitCenterSphere(float timeSeconds)
+void Context::emitCenterSphere(float timeSeconds, float lifetime)
 {
     Sphere sphere;
     sphere.radius = 5.f;
+    sphere.lifetime = lifetime;
     sphere.position = sceneCenter();
     sphere.prevPosition = sphere.position;
     sphere.setMass(1.f);
-    sphere.color = QColor(
-            QRandomGenerator::global()->bounded(256),
-            QRandomGenerator::global()->bounded(256),
-            QRandomGenerator::global()->bounded(256));
+    sphere.color = randomColor();
 
     const float k = 220.f;
-    sphere.velocity = QVector2D(std::cos(timeSeconds) * k, k);
+    sphere.velocity = vec2(std::cos(timeSeconds) * k, k);
 
     insertSphere(sphere);
 }
 
-void Context::createSpringCluster(const QPointF &center)
+int Context::spawnSpheres(const std::vector<Sphere> &spheres, std::vector<int> *handles)
 {
-    const float radius      = 18.f;
-    const float halfSpacing = 26.f;
-    const float mass        = 6.f;
-    const QColor color(220, 80, 80);
+    if (spheres.empty())
+        return -1;
+
+    const int firstIndex  = grid_.bodyCount();
+    int total             = firstIndex + static_cast<int>(spheres.size());
+    if (hasFixedCapacity())
+        total = std::min(total, capacityBudget.spheres);
+    if (total <= firstIndex)
+        return -1;
+
+    // after removals the storage keeps its capacity, so a steady emitter does not allocate anymore
+    grid_.bodies.reserve(total);
+    grid_.bodyHandle.reserve(total);
+    if (handles)
+        handles->clear();
+
+    int firstHandle = -1;
+    for (int i = 0; i < total - firstIndex; ++i) {
+        const Sphere &sphere = spheres[i];
+        const int bodyIndex = grid_.bodyCount();
+        grid_.bodies.push_back(sphere);
+        const int handle = grid_.acquireHandle(bodyIndex);
+        if (firstHandle < 0)
+            firstHandle = handle;
+        if (handles)
+            handles->push_back(handle);
+        hasMortalSpheres = hasMortalSpheres || sphere.lifetime >= 0.f;
+    }
+
+    // one pass over the new spheres only, the cells of the old ones are untouched
+    for (int i = firstIndex; i < total; ++i) {
+        grid_.insert(i);
+    }
+
+    return firstHandle;
+}
 
-    const int clusterId = nextGroupId++;
+int Context::instantiatePrefab(const Prefab &prefab, const std::vector<PrefabTransform> &transforms)
+{
+    if (prefab.nodes.empty() || transforms.empty())
+        return -1;
+
+    const int nodeCount  = static_cast<int>(prefab.nodes.size());
+    // a copy is never cut, its springs would point to missing nodes
+    if (hasFixedCapacity()
+        && grid_.bodyCount() + nodeCount * static_cast<int>(transforms.size()) > capacityBudget.spheres)
+        return -1;
+    const int firstGroup = nextGroupId;
+    const int firstIndex = grid_.bodyCount();
+
+    std::vector<Sphere> spheres;
+    spheres.reserve(nodeCount * transforms.size());
+    springLinks.reserve(springLinks.size() + prefab.springs.size() * transforms.size());
+
+    // the rest shape is the same for every copy, the rotation of a copy is found by the fit
+    ShapeCluster shape;
+    if (prefab.shapeMatching) {
+        std::vector<vec2> rest;
+        std::vector<float> invMasses;
+        for (const Sphere &node : prefab.nodes) {
+            rest.push_back(node.position);
+            invMasses.push_back(node.invMass);
+        }
+        shape.setRestShape(rest, invMasses);
+        shape.stiffness = prefab.shapeStiffness;
+        shape.linearDeformation = prefab.linearDeformation;
+        clusters.reserve(clusters.size() + transforms.size());
+    }
 
-    struct NodeSpec { QPointF offset; int node{}; };
-    const NodeSpec nodes[4] = {
-            { QPointF(0.0, -halfSpacing), 0 },
-            { QPointF(halfSpacing, 0.0),  1 },
-            { QPointF(0.0, halfSpacing),  2 },
-            { QPointF(-halfSpacing, 0.0), 3 }
-    };
+    for (int instance = 0; instance < static_cast<int>(transforms.size()); ++instance) {
+        const PrefabTransform &transform = transforms[instance];
+        const int groupId = nextGroupId++;
+        const int base    = firstIndex + instance * nodeCount;
+
+        const float c = std::cos(transform.angle);
+        const float s = std::sin(transform.angle);
+
+        for (const Sphere &node : prefab.nodes) {
+            Sphere sphere = node;
+            const vec2 &offset = node.position;
+            sphere.position = transform.position + vec2(c * offset.x - s * offset.y,
+                                                         s * offset.x + c * offset.y);
+            sphere.prevPosition = sphere.position;
+            sphere.velocity = transform.velocity;
+            sphere.groupId = groupId;
+            spheres.push_back(sphere);
+        }
 
-    for (const NodeSpec &spec : nodes) {
-        Sphere sphere;
-        sphere.radius = radius;
-        sphere.position = center + spec.offset;
-        sphere.prevPosition = sphere.position;
-        sphere.setMass(mass);
-        sphere.color = color;
-        sphere.groupId = clusterId;
-        sphere.nodeIndex = spec.node;
+        // rest length does not depend on the rotation, the springs are copied as they are
+        for (SpringLink spring : prefab.springs) {
+            spring.groupId = groupId;
+            spring.a = base + spring.aNode;
+            spring.b = base + spring.bNode;
+            springLinks.push_back(spring);
+        }
 
-        insertSphere(sphere);
+        if (prefab.shapeMatching) {
+            shape.groupId = groupId;
+            shape.bodies.resize(nodeCount);
+            for (int node = 0; node < nodeCount; ++node)
+                shape.bodies[node] = base + node;
+            clusters.push_back(shape);
+        }
     }
 
-    auto addSpring = [&](int aNode, int bNode, float stiffness = 0.92f) {
-        SpringLink spring;
-        spring.groupId = clusterId;
-        spring.aNode = aNode;
-        spring.bNode = bNode;
+    spawnSpheres(spheres);
+    return firstGroup;
+}
 
-        QPointF posA = center + nodes[aNode].offset;
-        QPointF posB = center + nodes[bNode].offset;
-        spring.restLength = QVector2D(posB - posA).length();
-        spring.stiffness = stiffness;
+int Context::addEmitter(const Emitter &emitter)
+{
+    emitters.push_back(emitter);
+    return static_cast<int>(emitters.size()) - 1;
+}
 
-        springLinks.append(spring);
-    };
+Emitter *Context::emitter(int id)
+{
+    return (id >= 0 && id < static_cast<int>(emitters.size())) ? &emitters[id] : nullptr;
+}
 
-    addSpring(0, 1);
-    addSpring(1, 2);
-    addSpring(2, 3);
-    addSpring(3, 0);
-    addSpring(0, 2, 0.95f);
-    addSpring(1, 3, 0.95f);
+void Context::seed(std::uint32_t value)
+{
+    rng.seed(value);
 }
 
+void Context::createSpringCluster(const vec2 &center)
+{
+    static const Prefab springCluster = prefab::springCluster();
+    static const Prefab shapeCluster = prefab::shapeMatched(prefab::springCluster(), 0.92f);
 
-void Context::createSoftBody(const QPointF &center,
+    PrefabTransform transform;
+    transform.position = center;
+    instantiatePrefab(clusterModel_ == ClusterModel::ShapeMatching ? shapeCluster : springCluster, { transform });
+}
+
+
+void Context::createSoftBody(const vec2 &center,
                              int pairCount  ,
                              float radius  ,
                              float spacing  ,
                              float mass   ,
                              float stiffness )
 {
-    if (pairCount < 3)
-        pairCount = 3;
-
-    const int clusterId = nextGroupId++;
-
-    struct NodeSpec {
-        QPointF offset;
-        int node = 0;
-    };
-
-    std::vector<NodeSpec> nodes;
-    nodes.reserve(pairCount * 2);
-
-    const float halfWidth = 0.5f * spacing * static_cast<float>(pairCount - 1);
-    const float halfHeight = spacing * 0.5f;
-
-    for (int i = 0; i < pairCount; ++i) {
-        const float x = static_cast<float>(i) * spacing - halfWidth;
-        nodes.push_back({ QPointF(x, -halfHeight), static_cast<int>(nodes.size()) });
-    }
-
-    for (int i = 0; i < pairCount; ++i) {
-        const float x = static_cast<float>(i) * spacing - halfWidth;
-        nodes.push_back({ QPointF(x, halfHeight), static_cast<int>(nodes.size()) });
+    // the layout is only rebuilt when the parameters change
+    const SoftBodyParams params { pairCount, radius, spacing, mass, stiffness, clusterModel_ };
+    if (softBodyPrefab.nodes.empty() || !(params == softBodyParams)) {
+        softBodyPrefab = prefab::softBody(pairCount, radius, spacing, mass, stiffness);
+        if (clusterModel_ == ClusterModel::ShapeMatching)
+            softBodyPrefab = prefab::shapeMatched(softBodyPrefab, stiffness);
+        softBodyParams = params;
     }
 
-    for (const NodeSpec &spec : nodes) {
-        Sphere s;
-        s.radius        = radius;
-        s.position      = center + spec.offset;
-        s.prevPosition  = s.position;
-        s.setMass(mass);
-        s.groupId       = clusterId;
-        s.nodeIndex     = spec.node;
-        s.color         = QColor(240, 140, 70);
-        insertSphere(s);
-    }
-
-    auto addSpring = [&](int nodeA, int nodeB) {
-        SpringLink spring;
-        spring.groupId = clusterId;
-        spring.aNode   = nodeA;
-        spring.bNode   = nodeB;
-
-        const QPointF posA = center + nodes[nodeA].offset;
-        const QPointF posB = center + nodes[nodeB].offset;
-        spring.restLength  = QVector2D(posB - posA).length();
-        spring.stiffness   = stiffness;
-
-        springLinks.append(spring);
-    };
-
-    const int topBase    = 0;
-    const int bottomBase = pairCount;
-
-    for (int i = 0; i < pairCount; ++i) {
-        const int next   = (i + 1) % pairCount;
-        const int ai     = topBase + i;
-        const int bi     = bottomBase + i;
-        const int anext  = topBase + next;
-        const int bnext  = bottomBase + next;
-
-        addSpring(ai, bi);
-        addSpring(ai, anext);
-        addSpring(bi, bnext);
-        addSpring(ai, bnext);
-        addSpring(bi, anext);
-    }
+    PrefabTransform transform;
+    transform.position = center;
+    instantiatePrefab(softBodyPrefab, { transform });
 }
 
 bool Context::isCenterCellEmpty() const
 {
-    if (grid_.isEmpty())
-        return true;
-
-    int idx = clampIndex(cellIndexFor(sceneCenter()), grid_.size());
-    return grid_.cells[idx].isEmpty();
+    // the cells are only rebuilt with the contact list, the spheres stored in the cells within reach are
+    // checked at their current position
+    const cell2 cell = grid_.cellOf(sceneCenter());
+    const int around = static_cast<int>(std::ceil(grid_.reach() / grid_.cellSize()));
+    const int owned = ownedCount < 0 ? grid_.bodyCount() : ownedCount;
+    for (int row = cell.y - around; row <= cell.y + around; ++row) {
+        for (int col = cell.x - around; col <= cell.x + around; ++col) {
+            const int index = grid_.findCell(col, row);
+            if (index < 0)
+                continue;
+            for (int i : grid_.cells[index]) {
+                const cell2 at = grid_.cellOf(grid_.bodies[i].position);
+                if (i < owned && at.x == cell.x && at.y == cell.y)
+                    return false;
+            }
+        }
+    }
+    return true;
 }
 
-QPointF Context::sceneCenter() const
+vec2 Context::sceneCenter() const
 {
-    return {static_cast<float>(sceneSize_.width()) * 0.5f,
-            static_cast<float>(sceneSize_.height()) * 0.5f};
+    return sceneSize_ * 0.5f;
 }
 
-void Context::initializeGrid(const QSize &size)
+rgba Context::randomColor()
 {
-    int widthPx  = std::max(1, size.width());
-    int heightPx = std::max(1, size.height());
-
-    gridCols = std::max(1, static_cast<int>(std::ceil(static_cast<float>(widthPx) / targetCellSize)));
-    gridRows = std::max(1, static_cast<int>(std::ceil(static_cast<float>(heightPx) / targetCellSize)));
-
-    cellWidth  = static_cast<float>(widthPx) / static_cast<float>(gridCols);
-    cellHeight = static_cast<float>(heightPx) / static_cast<float>(gridRows);
-
-    grid_.cells.clear();
-    grid_.resize(gridRows, gridCols);
+    std::uniform_int_distribution<int> channel(0, 255);
+    const int r = channel(rng);
+    const int g = channel(rng);
+    const int b = channel(rng);
+    return makeColor(r, g, b);
 }
 
-void Context::rebuildGrid(const QSize &size)
+void Context::emitFromEmitters(float frameDt)
 {
-    QVector<Sphere> bodies;
-    bodies.reserve([&]() {
-        int count = 0;
-        for (const QVector<Sphere> &cell : grid_.cells)
-            count += static_cast<int>(cell.size());
-        return count;
-    }());
-
-    for (const QVector<Sphere> &cell : grid_.cells) {
-        for (const Sphere &sphere : cell) {
-            bodies.append(sphere);
+    trace::Scope scope("emit");
+    for (Emitter &emitter : emitters) {
+        if (!emitter.enabled || emitter.rate <= 0.f)
+            continue;
+
+        emitter.pending += emitter.rate * frameDt;
+        const int count = static_cast<int>(emitter.pending);
+        emitter.pending -= static_cast<float>(count);
+        if (count <= 0) {
+            emitter.time += frameDt;
+            continue;
         }
-    }
 
-    initializeGrid(size);
+        // spawnSpheres drops the spheres beyond the fixed capacity, they are not even built
+        const int room = hasFixedCapacity() ? capacityBudget.spheres - grid_.bodyCount() : count;
+        const int emitted = std::clamp(room, 0, count);
+        emitBuffer.clear();
+        emitBuffer.reserve(emitted);
+        std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+
+        for (int i = 0; i < emitted; ++i) {
+            // each sphere is born at its own time inside the frame, so it already traveled for its age
+            const float age = frameDt * (static_cast<float>(count - i) - 0.5f) / static_cast<float>(count);
+            const float t = emitter.time + frameDt - age;
+
+            Sphere sphere;
+            sphere.radius = emitter.radius;
+            sphere.setMass(emitter.mass);
+            sphere.lifetime = emitter.lifetime;
+            sphere.filter = emitter.filter;
+            sphere.color = randomColor();
+            sphere.velocity = vec2(std::cos(t) * emitter.speed, emitter.speed);
+
+            const float lateral = jitter(rng) * emitter.width;
+            sphere.position = emitter.position + vec2(lateral, 0.f) + sphere.velocity * age;
+            sphere.prevPosition = sphere.position;
+
+            emitBuffer.push_back(sphere);
+        }
 
-    for (const Sphere &sphere : std::as_const(bodies)) {
-        insertSphere(sphere);
+        emitter.time += frameDt;
+        spawnSpheres(emitBuffer);
     }
 }
 
@@ -288,70 +827,129 @@ void Context::rebuildStaticConstraints()
 {
     staticConstraints.clear();
 
-    float w = static_cast<float>(std::max(1, sceneSize_.width()));
-    float h = static_cast<float>(std::max(1, sceneSize_.height()));
+    float w = std::max(1.f, sceneSize_.x);
+    float h = std::max(1.f, sceneSize_.y);
+
+    staticConstraints.push_back(std::make_shared<PlaneConstraint>(vec2(1.f, 0.f), 0.f));
+    staticConstraints.push_back(std::make_shared<PlaneConstraint>(vec2(-1.f, 0.f), -w));
+    staticConstraints.push_back(std::make_shared<PlaneConstraint>(vec2(0.f, 1.f), 0.f));
+    staticConstraints.push_back(std::make_shared<PlaneConstraint>(vec2(0.f, -1.f), -h));
 
-    staticConstraints.append(std::make_shared<PlaneConstraint>(QVector2D(1.f, 0.f), 0.f));
-    staticConstraints.append(std::make_shared<PlaneConstraint>(QVector2D(-1.f, 0.f), -w));
-    staticConstraints.append(std::make_shared<PlaneConstraint>(QVector2D(0.f, 1.f), 0.f));
-    staticConstraints.append(std::make_shared<PlaneConstraint>(QVector2D(0.f, -1.f), -h));
+    //staticConstraints.push_back(std::make_shared<SphereConstraint>(vec2(w * 0.5f, h * 0.8f), std::min(w, h) * 0.1f));
 
-    //staticConstraints.append(std::make_shared<SphereConstraint>(QPointF(w * 0.5f, h * 0.8f), std::min(w, h) * 0.1f));
+    //staticConstraints.push_back(std::make_shared<SphereConstraint>(vec2(w * 0.3f, h * 0.6f), std::min(w, h) * 0.1f));
 
-    //staticConstraints.append(std::make_shared<SphereConstraint>(QPointF(w * 0.3f, h * 0.6f), std::min(w, h) * 0.1f));
+    //staticConstraints.push_back(std::make_shared<SphereConstraint>(vec2(w * 0.7f, h * 0.6f), std::min(w, h) * 0.1f));
 
-    //staticConstraints.append(std::make_shared<SphereConstraint>(QPointF(w * 0.7f, h * 0.6f), std::min(w, h) * 0.1f));
+    staticConstraints.push_back(std::make_shared<BowlConstraint>(vec2(w * 0.5f, h * 0.3f), std::max(w, h) * 0.5f));
 
-    staticConstraints.append(std::make_shared<BowlConstraint>(QPointF(w * 0.5f, h * 0.3f), std::max(w, h) * 0.5f));
+    staticConstraints.insert(staticConstraints.end(), levelObstacles.begin(), levelObstacles.end());
+    obstacles.build(staticConstraints);
 }
 
-void Context::insertSphere(const Sphere &sphere)
+bool Context::loadObstacles(const std::string &path, std::string *error)
 {
-    if (grid_.isEmpty())
-        return;
-
-    int index = clampIndex(cellIndexFor(sphere.position), grid_.size());
-    grid_.cells[index].append(sphere);
+    std::vector<std::shared_ptr<StaticConstraint>> loaded;
+    const bool ok = scenefile::loadObstacles(path, loaded, error);
+    addObstacles(loaded);
+    return ok;
 }
 
-void Context::updateGrid()
+void Context::addObstacles(const std::vector<std::shared_ptr<StaticConstraint>> &added)
 {
-    if (grid_.isEmpty())
+    if (added.empty())
         return;
+    levelObstacles.insert(levelObstacles.end(), added.begin(), added.end());
+    rebuildStaticConstraints();
+}
 
-    QVector<QVector<Sphere>> newGrid(grid_.size());
-
-    for (const auto &cell : grid_.cells) {
-        for (const Sphere &sphere : cell) {
-            int idx = clampIndex(cellIndexFor(sphere.position), newGrid.size());
-            newGrid[idx].append(sphere);
-        }
-    }
+void Context::clearObstacles()
+{
+    levelObstacles.clear();
+    rebuildStaticConstraints();
+}
 
-    grid_.cells.swap(newGrid);
+int Context::insertSphere(const Sphere &sphere)
+{
+    if (hasFixedCapacity() && grid_.bodyCount() >= capacityBudget.spheres)
+        return -1;
+
+    const int bodyIndex = grid_.bodyCount();
+    grid_.bodies.push_back(sphere);
+    grid_.insert(bodyIndex);
+    grid_.acquireHandle(bodyIndex);
+    hasMortalSpheres = hasMortalSpheres || sphere.lifetime >= 0.f;
+    return bodyIndex;
 }
 
-int Context::cellIndexFor(const QPointF &position) const
+void Context::reorderBodies()
 {
-    if (gridCols <= 0 || gridRows <= 0)
-        return 0;
+    if (grid_.bodies.empty())
+        return;
+
+    trace::Scope scope("reorder");
 
-    float widthF  = static_cast<float>(std::max(1, sceneSize_.width()));
-    float heightF = static_cast<float>(std::max(1, sceneSize_.height()));
+    reorder::mortonOrder(grid_, reorderScratch);
+    reorder::applyOrder(grid_, springLinks, reorderScratch);
+    const std::vector<int> &newIndex = reorderScratch.newIndex;
+    remapClusters(newIndex);
 
-    float clampedX = std::clamp(static_cast<float>(position.x()), 0.f, widthF - 1e-3f);
-    float clampedY = std::clamp(static_cast<float>(position.y()), 0.f, heightF - 1e-3f);
+    reorderStats.frame = frameCount;
+    reorderStats.pairSpanBefore = reorder::meanPairSpan(contactList.pairs);
+    reorderStats.pairSpanAfter  = reorder::meanPairSpan(contactList.pairs, &newIndex);
 
-    float cw = (cellWidth > 0.f) ? cellWidth : widthF;
-    float ch = (cellHeight > 0.f) ? cellHeight : heightF;
+    // the candidate list hold the old indices
+    contactList.invalidate();
+}
 
-    int col = std::clamp(static_cast<int>(clampedX / cw), 0, gridCols - 1);
-    int row = std::clamp(static_cast<int>(clampedY / ch), 0, gridRows - 1);
+void Context::remapClusters(const std::vector<int> &newIndex)
+{
+    const int count = static_cast<int>(newIndex.size());
+    auto remap = [&newIndex, count](int index) { return index >= 0 && index < count ? newIndex[index] : -1; };
+
+    // compacted in place, a cluster that kept all its nodes is remapped without any allocation
+    std::size_t kept = 0;
+    for (ShapeCluster &cluster : clusters) {
+        int alive = 0;
+        for (int index : cluster.bodies)
+            alive += remap(index) >= 0 ? 1 : 0;
+
+        if (alive < 2)
+            continue;
+
+        if (alive == cluster.size()) {
+            for (int &index : cluster.bodies)
+                index = remap(index);
+        } else {
+            std::vector<int> bodies;
+            std::vector<vec2> rest;
+            std::vector<float> invMasses;
+            for (int i = 0; i < cluster.size(); ++i) {
+                const int moved = remap(cluster.bodies[i]);
+                if (moved < 0)
+                    continue;
+                bodies.push_back(moved);
+                rest.push_back(cluster.restShape[i]);
+                invMasses.push_back(grid_.bodies[moved].invMass);
+            }
+
+            // the center of mass of the rest shape moved since a node left
+            cluster.setRestShape(rest, invMasses);
+            cluster.bodies.swap(bodies);
+        }
 
-    return row * gridCols + col;
+        if (&clusters[kept] != &cluster)
+            clusters[kept] = std::move(cluster);
+        ++kept;
+    }
+    clusters.erase(clusters.begin() + static_cast<std::ptrdiff_t>(kept), clusters.end());
 }
 
-bool Context::isValidCell(int col, int row) const
+void Context::updateGrid()
 {
-    return col >= 0 && col < gridCols && row >= 0 && row < gridRows;
-}
\ No newline at end of file
+    trace::Scope scope("grid update");
+    grid_.rebuild();
+    // the cells were renumbered
+    if (stepRates)
+        solver::refreshCellStrides(grid_, rates);
+}
@@ -6,21 +6,91 @@
 #define SOLVER_CONTEXT_H
 
 
-#include <QVector>
-#include <QSize>
-#include <QPointF>
+#include <array>
+#include <vector>
 #include <memory>
-#include <QRandomGenerator>
-#include <QVector2D>
+#include <random>
 #include <algorithm>
 #include <cmath>
 #include <utility>
+#include <functional>
 
 #include "grid.h"
 #include "constraints.h"
+#include "obstacles.h"
 #include "physicalbody.h"
 #include "springlink.h"
+#include "shapecluster.h"
 #include "solver.h"
+#include "reorder.h"
+#include "prefab.h"
+#include "emitter.h"
+#include "killzone.h"
+#include "spatialquery.h"
+
+/**
+ * classes of constraint solved one after the other in an iteration, in this order
+ */
+enum class ConstraintClass
+{
+    Static,   // walls and level obstacles
+    Springs,
+    Shapes,   // shape matching clusters
+    Contacts  // sphere against sphere
+};
+
+constexpr int kConstraintClassCount = 4;
+
+/**
+ * how many passes a class of constraint gets in each substep (see Context::setSchedule)
+ */
+struct ConstraintSchedule
+{
+    int iterations = 0;          // passes per substep, 0 = the iteration count of the context
+    bool adaptive  = false;      // add a pass when the class is still above the tolerance after its last one,
+                                 // remove one when it was satisfied earlier
+    int minIterations = 1;       // bounds of the adaptive count
+    int maxIterations = 16;
+    bool refreshContacts = false; // rebuild the contact candidates after a pass if it moved spheres too far for them
+};
+
+/**
+ * Convergence report of the last call to Context::step
+ */
+struct StepStats
+{
+    int iterations         = 0;   // solver iterations summed over every substep
+    int broadphaseRebuilds = 0;   // number of substeps that had to rebuild the contact list
+    float residual         = 0.f; // largest correction of the last iteration of the last substep
+    int removed            = 0;   // spheres removed by their lifetime or a kill zone at the beginning of the step
+    std::array<int, kConstraintClassCount> passes {};           // passes of each class summed over every substep
+    std::array<float, kConstraintClassCount> classResiduals {}; // largest correction of the last pass of each class
+    int contactPairs       = 0;   // candidate pairs of the contact list at the end of the step
+    int sphereSubsteps     = 0;   // spheres stepped summed over every substep, lower with a multirate step
+};
+
+/**
+ * Budgets of the fixed capacity mode, see Context::setFixedCapacity
+ */
+struct FixedCapacity
+{
+    int spheres       = 0;
+    int springs       = 0;
+    int contacts      = 0;  // candidate pairs of the contact list, 0 = 4 per sphere
+    int cellOccupancy = 32; // spheres a cell holds without growing its storage
+};
+
+/**
+ * Report of the last Morton reordering of the storage
+ */
+struct ReorderStats
+{
+    int frame             = -1;   // frame of the last reordering, -1 if it never happened
+    double pairSpanBefore = 0.0;  // mean storage distance between the two spheres of a contact
+    double pairSpanAfter  = 0.0;
+
+    [[nodiscard]] double localityGain() const { return pairSpanAfter > 0.0 ? pairSpanBefore / pairSpanAfter : 1.0; }
+};
 
 /**
  * Own the grid and the element of the simulation.
@@ -30,23 +100,26 @@ public:
     //Context() = default;
 
     explicit Context(float targetCellSize = 200, int subSteps = 4, int solverIterations = 4, float dampingFactor = 0.998) :
-        targetCellSize(targetCellSize), subSteps(subSteps),
-        solverIterations(solverIterations), dampingFactor(dampingFactor) {};
+        grid_(targetCellSize), targetCellSize(targetCellSize), subSteps(subSteps),
+        solverIterations(solverIterations), dampingFactor(dampingFactor) { contactList.skin = 4.f; };
 
     /**
-     * initialize the grid and the static constraint acording to the initial size
-     * @param initialSize
+     * initialize the static constraint acording to the initial size
+     * @param initialSize width and height of the scene
      */
-    void initialize(const QSize &initialSize);
+    void initialize(const vec2 &initialSize);
 
     /**
-     * rebuild the grid to its new size and rebuild the constraint
+     * rebuild the constraint to the new size, the grid is unbounded so it is kept as it is
      * @param newSize
      */
-    void resizeScene(const QSize &newSize);
+    void resizeScene(const vec2 &newSize);
 
     /**
-     * Solve the constraint with 4 iteration of (static -> spring -> sphere) and then update velocities
+     * Solve the constraint with up to solverIterations iteration of (static -> spring -> shape -> sphere) and then update velocities.
+     * Iterations stop early once the largest correction of an iteration is below the convergence tolerance,
+     * if one was set (see setConvergenceCriteria).
+     * With a schedule (see setSchedule) each class gets its own number of passes instead.
      * IM THINKING MOVING THIS INTO SOLVER. I DONT KNOW IF IT SHOULD BE THE RESPONSABILITY OF THE CONTEXT. PLEASE REVIEW?
      * @param frameDt
      */
@@ -55,86 +128,473 @@ public:
     /**
      * add a sphere in the grid where it is clicked
      * @param position
+     * @return handle of the sphere
      */
-    void addUserSphere(const QPointF &position);
+    int addUserSphere(const vec2 &position);
 
     /**
      * emit small sphere from the center when "e" is pressed
      * @param timeSeconds
+     * @param lifetime seconds before the sphere is removed, negative = never
      */
-    void emitCenterSphere(float timeSeconds);
+    void emitCenterSphere(float timeSeconds, float lifetime = -1.f);
 
     /**
-     * create a square cluster when "c" is pressed
+     * create a square cluster when "c" is pressed, held by springs or by shape matching (see setClusterModel)
      * @param center
      */
-    void createSpringCluster(const QPointF &center);
+    void createSpringCluster(const vec2 &center);
 
-    void createSoftBody(const QPointF &center,
+    void createSoftBody(const vec2 &center,
                                  int pairCount  = 15 ,
                                  float radius  = 5.f ,
                                  float spacing  = 25.f ,
                                  float mass  = 1.5f ,
                                  float stiffness  = 0.3f);
 
+    /**
+     * insert many spheres at once: the storage is grown once and only the new spheres are put in the cells.
+     * handles of removed spheres are reused first, so the handles are only consecutive when none was free.
+     * The spheres beyond the fixed capacity are dropped (see setFixedCapacity)
+     * @param spheres
+     * @param handles if not nullptr, receive the handle of each sphere
+     * @return handle of the first sphere. -1 if nothing was inserted
+     */
+    int spawnSpheres(const std::vector<Sphere> &spheres, std::vector<int> *handles = nullptr);
+
+    /**
+     * insert one copy of the prefab per transform, each copy is its own group
+     * @param prefab precomputed nodes and springs
+     * @param transforms position, rotation and velocity of each copy
+     * @return group id of the first copy, the others follow consecutively. -1 if nothing was inserted
+     */
+    int instantiatePrefab(const Prefab &prefab, const std::vector<PrefabTransform> &transforms);
+
+    /**
+     * add an emitter, it spawns its spheres at the beginning of each step
+     * @param emitter
+     * @return id of the emitter
+     */
+    int addEmitter(const Emitter &emitter);
+
+    /**
+     * emitter with this id, to move it or change its rate. nullptr if the id is unknown
+     */
+    Emitter *emitter(int id);
+
+    /**
+     * seed the generator used for colors and emitter jitter, so that a scene can be replayed
+     * @param value
+     */
+    void seed(std::uint32_t value);
+
+    /**
+     * Stop the solver iterations of a substep once the largest positional correction
+     * (static, spring or contact) of an iteration is below tolerance.
+     * @param tolerance in pixel, 0 disable the early termination (the default)
+     * @param minIterations iterations always done before testing the tolerance
+     * @param maxIterations upper bound of iterations per substep
+     */
+    void setConvergenceCriteria(float tolerance, int minIterations, int maxIterations);
+
+    /**
+     * give a class of constraint its own number of passes per substep instead of the iteration count of the
+     * context. With a schedule, a class whose last pass corrected less than the convergence tolerance gets
+     * no more pass in the substep, and the iteration stops once every class is done
+     * @param constraintClass
+     * @param schedule
+     */
+    void setSchedule(ConstraintClass constraintClass, const ConstraintSchedule &schedule);
+    [[nodiscard]] const ConstraintSchedule &schedule(ConstraintClass constraintClass) const
+    {
+        return schedules[static_cast<int>(constraintClass)];
+    }
+
+    /**
+     * current number of passes of a class, moves with the residual when its schedule is adaptive
+     */
+    [[nodiscard]] int scheduledPasses(ConstraintClass constraintClass) const;
+
+    /**
+     * back to the same iteration count for every class
+     */
+    void clearSchedules();
+
+    /**
+     * step the calm regions of the scene less often than the busy ones (see multirate.h). The strides are
+     * chosen at the beginning of each frame from the speed and the candidate pairs of each cell.
+     * Ignored while substep hooks are set, the hooks expect every sphere to move at every substep
+     * @param settings
+     */
+    void setMultirate(const MultirateSettings &settings);
+    [[nodiscard]] const MultirateSettings &multirate() const { return multirateSettings; }
+
+    /**
+     * strides chosen for the last frame, empty when it was not a multirate step
+     */
+    [[nodiscard]] const SubstepRates &substepRates() const { return rates; }
+
+    /**
+     * preallocate every buffer used by step for a budget of spheres, springs and contact pairs: within the budget
+     * step does not allocate at all, so its duration does not depend on the heap. The spheres beyond the budget
+     * are not spawned (emitters, spawnSpheres, prefabs...). Any allocation during a step is reported by
+     * alloctrack, an assertion in debug builds: a scene that outgrew its contact budget, a cell holding more
+     * than cellOccupancy spheres, or substep hooks that allocate
+     * @param capacity spheres > 0
+     */
+    void setFixedCapacity(const FixedCapacity &capacity);
+    [[nodiscard]] bool hasFixedCapacity() const { return capacityBudget.spheres > 0; }
+    [[nodiscard]] const FixedCapacity &fixedCapacity() const { return capacityBudget; }
+
+    /**
+     * back to buffers that grow with the scene, the memory already reserved is kept
+     */
+    void clearFixedCapacity() { capacityBudget = FixedCapacity(); }
+
+    /**
+     * margin added to the contact distance when the candidate list is built. The list is reused
+     * until a sphere moved more than half of it, a larger skin mean less rebuild but more candidates
+     * @param skin in pixel
+     */
+    void setContactSkin(float skin);
+
+    /**
+     * stop two spheres where their paths meet during a substep instead of resolving the overlap found at its end.
+     * Fast spheres do not cross each other nor explode on contact, so fewer substeps are needed (see setSubsteps).
+     * Enabled by default
+     * @param enabled
+     */
+    void setSpeculativeContacts(bool enabled);
+
+    /**
+     * a cell holding more spheres than threshold finds its contact candidates by sorting its spheres along x and
+     * sweeping them, instead of testing every pair. It only happens when the cells are too large for the spheres
+     * (see setCellSize) or in a very tight pile. 32 by default
+     * @param threshold 0 to always test every pair
+     */
+    void setSweepThreshold(int threshold);
+    [[nodiscard]] int sweepThreshold() const { return contactList.sweepThreshold; }
+
+    /**
+     * solve the contacts in an order that only depend on the scene, so a run seeded with seed() is
+     * bit identical whatever the number of threads and their timing. Disabled by default
+     * @param enabled
+     */
+    void setDeterministic(bool enabled);
+    [[nodiscard]] bool isDeterministic() const { return contactList.deterministic; }
+
+    /**
+     * number of substeps of a frame, every constraint is solved once per substep
+     * @param count at least 1
+     */
+    void setSubsteps(int count) { subSteps = std::max(1, count); }
+    [[nodiscard]] int substeps() const { return subSteps; }
+
+    /**
+     * change the size of the cells of the grid, the grid and the contact candidates are rebuilt
+     * @param size in pixel, larger than the biggest diameter plus the contact skin
+     */
+    void setCellSize(float size);
+    [[nodiscard]] float cellSize() const { return grid_.cellSize(); }
+
+    /**
+     * copy the solver settings, the obstacles, the kill zones and the spheres with their springs and clusters
+     * into another context, to time or try the scene without stepping it. The grid of the other context keeps
+     * its cell size, the emitters, hooks, ghosts and the fixed capacity are not copied
+     * @param target a context without spheres
+     */
+    void copySceneTo(Context &target) const;
+
+    /**
+     * sort the storage of the spheres along a Morton curve every interval frames.
+     * handles and springs are remapped, so only raw indices kept outside of the context are invalidated
+     * @param frames 0 disable the reordering
+     */
+    void setReorderInterval(int frames) { reorderInterval = std::max(0, frames); }
+
+    /**
+     * add level obstacles read from a scene file (see scenefile.h). They are kept when the scene is resized
+     * @param path
+     * @param error message of the first bad line, can be nullptr
+     * @return false if the file could not be read, the obstacles parsed before the error are added
+     */
+    bool loadObstacles(const std::string &path, std::string *error = nullptr);
+
+    /**
+     * add level obstacles on top of the walls of the scene
+     * @param obstacles
+     */
+    void addObstacles(const std::vector<std::shared_ptr<StaticConstraint>> &obstacles);
+
+    /**
+     * remove the obstacles added by loadObstacles and addObstacles, the walls stay
+     */
+    void clearObstacles();
+
+    /**
+     * choose how the clusters created by createSpringCluster and createSoftBody are held together.
+     * ShapeMatching solve one constraint per cluster instead of one per spring, bodies already created keep their model
+     * @param model
+     */
+    void setClusterModel(ClusterModel model) { clusterModel_ = model; }
+    [[nodiscard]] ClusterModel clusterModel() const { return clusterModel_; }
+
+    /**
+     * sphere designated by a handle returned at insertion, nullptr if the handle is unknown
+     * @param handle
+     */
+    [[nodiscard]] const Sphere *sphere(int handle) const;
+
+    /**
+     * spatial queries answered through the grid (see spatialquery.h), the results are handles.
+     * Read only, any number of threads can query between two steps
+     */
+    void queryRadius(const vec2 &center, float radius, std::vector<int> &handles) const { query::radius(grid_, center, radius, handles); }
+    void queryBox(const box2 &area, std::vector<int> &handles) const { query::box(grid_, area, handles); }
+    void queryNearest(const vec2 &point, int k, std::vector<int> &handles) const { query::nearest(grid_, point, k, handles); }
+    bool rayCast(const query::Ray &ray, query::RayHit &hit) const { return query::rayCast(grid_, ray, hit); }
+
+    /**
+     * many queries at once over the thread pool, not to be called from a substep hook
+     */
+    void queryRadiusBatch(const std::vector<vec2> &centers, float radius, query::Results &results) const
+    {
+        query::radiusBatch(grid_, centers, radius, results);
+    }
+    void queryNearestBatch(const std::vector<vec2> &points, int k, query::Results &results) const
+    {
+        query::nearestBatch(grid_, points, k, results);
+    }
+    void rayCastBatch(const std::vector<query::Ray> &rays, std::vector<query::RayHit> &hits) const
+    {
+        query::rayCastBatch(grid_, rays, hits);
+    }
+
+    /**
+     * change which spheres a sphere collides with (see CollisionFilter), the contact candidates are rebuilt
+     * @param handle
+     * @return false if the handle is unknown
+     */
+    bool setCollisionFilter(int handle, const CollisionFilter &filter);
+
+    /**
+     * same for every sphere of a cluster
+     * @return number of spheres changed
+     */
+    int setGroupCollisionFilter(int groupId, const CollisionFilter &filter);
+
+    /**
+     * remove a sphere, the springs attached to it are dropped and it leaves its shape cluster
+     * @param handle
+     * @return false if the handle is unknown
+     */
+    bool removeSphere(int handle);
+
+    /**
+     * remove several spheres at once, the storage is compacted a single time
+     * @param handles the unknown ones are skipped
+     * @return number of removed spheres
+     */
+    int removeSpheres(const std::vector<int> &handles);
+
+    /**
+     * remove every sphere of a cluster with its springs and its shape cluster
+     * @param groupId returned by instantiatePrefab or given to the nodes
+     * @return number of removed spheres
+     */
+    int removeGroup(int groupId);
+
+    /**
+     * spheres entering the zone are removed at the beginning of the next step, with their whole cluster
+     * @param zone
+     */
+    void addKillZone(const KillZone &zone) { killZones_.push_back(zone); }
+    void clearKillZones() { killZones_.clear(); }
+    [[nodiscard]] const std::vector<KillZone> &killZones() const { return killZones_; }
+
+    /**
+     * remove every sphere matching the predicate. The storage is compacted, handles of removed spheres
+     * become unknown until they are reused by a later insertion, and springs attached to them are dropped
+     * @param predicate
+     * @return the removed spheres
+     */
+    std::vector<Sphere> takeSpheresIf(const std::function<bool (const Sphere &)> &predicate);
+
+    /**
+     * procedures called at each substep, begin right after the integration and end right before the
+     * velocities are updated. Used to exchange boundary spheres with other contexts (see domain)
+     * @param begin
+     * @param end
+     */
+    void setSubstepHooks(std::function<void (Context &)> begin, std::function<void (Context &)> end);
+
+    /**
+     * add temporary spheres that only exist until clearGhosts: they collide with the spheres of the
+     * context during the substep but they have no handle and are never integrated
+     * @param ghosts
+     */
+    void addGhosts(const std::vector<Sphere> &ghosts);
+
+    /**
+     * remove the ghosts added by addGhosts
+     */
+    void clearGhosts();
+
+    [[nodiscard]] const StepStats &lastStepStats() const { return stepStats; }
+    [[nodiscard]] const ReorderStats &lastReorderStats() const { return reorderStats; }
+
     [[maybe_unused]] [[nodiscard]] bool isCenterCellEmpty() const;
-    [[nodiscard]] QPointF sceneCenter() const;
-    [[nodiscard]] QSize sceneSize() const { return sceneSize_; }
+    [[nodiscard]] vec2 sceneCenter() const;
+    [[nodiscard]] vec2 sceneSize() const { return sceneSize_; }
 
     [[nodiscard]] const Grid &grid() const { return grid_; }
     Grid &grid() { return grid_; }
 
-    [[nodiscard]] const QVector<std::shared_ptr<StaticConstraint>> &constraints() const { return staticConstraints; }
+    /**
+     * the spheres as they are stored, a client can read them without copy. Invalidated by the next step
+     */
+    [[nodiscard]] BufferView<const Sphere> bodies() const { return {grid_.bodies.data(), grid_.bodies.size()}; }
+
+    [[nodiscard]] BufferView<const SpringLink> springs() const { return {springLinks.data(), springLinks.size()}; }
+
+    [[nodiscard]] BufferView<const ShapeCluster> shapeClusters() const { return {clusters.data(), clusters.size()}; }
+
+    [[nodiscard]] const std::vector<std::shared_ptr<StaticConstraint>> &constraints() const { return staticConstraints; }
 
 private:
     /**
-     * initialize the grid
-     * @param size
+     * rebuild the constraint according to the new size of the scene, then the hierarchy of obstacles
+     */
+    void rebuildStaticConstraints();
+
+    /**
+     * insert a sphere in the grid
+     * @param sphere
+     * @return index of the sphere in the storage, -1 when the fixed capacity is full
      */
-    void initializeGrid(const QSize &size);
+    int insertSphere(const Sphere &sphere);
 
     /**
-     * rebuild the grid in case of a rize event, replacing the sphere
-     * @param size
+     * sort the storage along a Morton curve and remap what point into it
      */
-    void rebuildGrid(const QSize &size);
+    void reorderBodies();
 
     /**
-     * rebuild the constraint according to the new size of the scene
+     * replace the body indices of the shape clusters after the storage moved. removed nodes leave their
+     * cluster, which is dropped when less than two nodes remain
+     * @param newIndex new index of each old index, -1 if the sphere was removed
      */
-    void rebuildStaticConstraints();
+    void remapClusters(const std::vector<int> &newIndex);
 
     /**
-     * insert a sphere in the grid
-     * @param sphere
+     * compact the storage without the marked spheres, release their handles and remap what point into the storage
+     * @param marked one flag per sphere of the storage
+     * @param taken if not nullptr, receive the removed spheres
+     * @return number of removed spheres
      */
-    void insertSphere(const Sphere &sphere);
+    int removeMarked(const std::vector<char> &marked, std::vector<Sphere> *taken = nullptr);
 
     /**
-     * update the grid according to the new position of the sphere
+     * age the spheres and remove the ones whose lifetime is over or which are in a kill zone, with their cluster
+     * @param frameDt
+     * @return number of removed spheres
      */
-    void updateGrid();
+    int removeExpired(float frameDt);
+
+    /**
+     * one pass of the constraints of a class
+     * @return largest correction of the pass
+     */
+    float solvePass(ConstraintClass constraintClass);
+
+    /**
+     * the iterations of a substep when a schedule is set: each class gets its own number of passes
+     * and stops while it is satisfied, until a pass of another class moves the spheres again. Then the
+     * adaptive counts are updated
+     */
+    void solveScheduled();
 
-    [[nodiscard]] int cellIndexFor(const QPointF &position) const;
-    [[nodiscard]] bool isValidCell(int col, int row) const;
+    /**
+     * spawn the spheres accumulated by each emitter during the frame, one batch per emitter
+     * @param frameDt
+     */
+    void emitFromEmitters(float frameDt);
+
+    [[nodiscard]] rgba randomColor();
+
+    /**
+     * update the cells of the grid according to the new position of the sphere
+     */
+    void updateGrid();
 
 
     Grid grid_;
-    QVector<std::shared_ptr<StaticConstraint>> staticConstraints;
-    QVector<SpringLink> springLinks;
+    std::vector<std::shared_ptr<StaticConstraint>> staticConstraints; // walls then level obstacles
+    std::vector<std::shared_ptr<StaticConstraint>> levelObstacles;
+    ObstacleSet obstacles;
+    std::vector<SpringLink> springLinks;
+    std::vector<ShapeCluster> clusters;
+    ContactList contactList;
+    ClusterModel clusterModel_ = ClusterModel::Springs;
 
     int nextGroupId   = 0;
-    int gridCols      = 1;
-    int gridRows      = 1;
-    float cellWidth   = 1.f;
-    float cellHeight  = 1.f;
 
     float targetCellSize = 200.f;
     int subSteps          = 4;
     int solverIterations  = 4;
     float dampingFactor   = 0.998f;
 
-    QSize sceneSize_ {800, 600};
+    int minSolverIterations    = 1;
+    float convergenceTolerance = 0.f; // early termination is opt-in, see setConvergenceCriteria
+    StepStats stepStats;
+
+    bool hasSchedule = false;
+    std::array<ConstraintSchedule, kConstraintClassCount> schedules {};
+    std::array<int, kConstraintClassCount> adaptivePasses {}; // current count of the adaptive classes
+
+    MultirateSettings multirateSettings;
+    SubstepRates rates;
+    const SubstepRates *stepRates = nullptr; // &rates during a multirate step
+    std::vector<float> frozenInvMass;        // inverse mass of the spheres sleeping during the substep
+
+    FixedCapacity capacityBudget; // spheres = 0 while the buffers grow freely
+
+    // scratch of the removal of spheres, kept to reuse the memory
+    std::vector<char> removedFlags;
+    std::vector<int> removedGroups;
+    std::vector<int> remappedIndices;
+    reorder::Scratch reorderScratch;
+
+    struct SoftBodyParams
+    {
+        int pairCount = 0;
+        float radius = 0.f, spacing = 0.f, mass = 0.f, stiffness = 0.f;
+        ClusterModel model = ClusterModel::Springs;
+        bool operator==(const SoftBodyParams &o) const
+        {
+            return pairCount == o.pairCount && radius == o.radius && spacing == o.spacing
+                   && mass == o.mass && stiffness == o.stiffness && model == o.model;
+        }
+    };
+
+    Prefab softBodyPrefab;
+    SoftBodyParams softBodyParams;
+
+    std::vector<Emitter> emitters;
+    std::vector<Sphere> emitBuffer;
+    std::vector<KillZone> killZones_;
+    bool hasMortalSpheres = false; // a sphere with a lifetime has been inserted, cleared when none is left
+    std::mt19937 rng {std::random_device{}()};
+
+    std::function<void (Context &)> substepBegin;
+    std::function<void (Context &)> substepEnd;
+    int ownedCount = -1; // number of spheres that are not ghosts, -1 when there is no ghost
+
+    int reorderInterval = 0;
+    int frameCount      = 0;
+    ReorderStats reorderStats;
+
+    vec2 sceneSize_ {800.f, 600.f};
 };
 
 
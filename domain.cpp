@@ -0,0 +1,415 @@
+#include "domain.h"
+#include "context.h"
+
+#include <atomic>
+#include <cstdio>
+#include <limits>
+#include <new>
+#include <random>
+#include <thread>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+namespace
+{
+    constexpr int kRingDepth = 2; // a slot is written at step n and read before anybody reach step n + 2
+    constexpr size_t kAlignment = 64;
+
+    enum Side { Left = 0, Right = 1 };
+
+    /**
+     * plain copy of a sphere that can live in shared memory
+     */
+    struct SharedSphere
+    {
+        float x, y, prevX, prevY, vx, vy, radius, invMass, lifetime;
+        std::uint32_t color;
+        std::int32_t groupId, nodeIndex;
+        std::uint16_t layers, mask;
+        std::int32_t ignoreGroup;
+    };
+
+    struct SlotHeader
+    {
+        int count;
+    };
+
+    struct SharedHeader
+    {
+        pthread_barrier_t substepBarrier; // between workers, once per substep
+        pthread_barrier_t frameBarrier;   // workers and coordinator, at the start and at the end of a frame
+        std::atomic<int> quit;
+        std::atomic<int> dropped;
+    };
+
+    size_t align(size_t bytes)
+    {
+        return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    /**
+     * layout of the shared memory: the header then, for each worker, its ghost ring (2 sides),
+     * its migration ring (2 sides) and its state ring read by the coordinator
+     */
+    class Layout
+    {
+    public:
+        Layout(void *memory, int capacity)
+                : base(static_cast<char *>(memory)), capacity(capacity),
+                  borderCapacity(std::max(1024, capacity / 8)) {}
+
+        static size_t bytes(int workers, int capacity)
+        {
+            Layout layout(nullptr, capacity);
+            return layout.offset(workers, 0);
+        }
+
+        [[nodiscard]] SharedHeader *header() const { return reinterpret_cast<SharedHeader *>(base); }
+
+        [[nodiscard]] SlotHeader *ghosts(int worker, Side side, int parity) const
+        {
+            return slot(worker, (side * kRingDepth + parity) * borderSlotBytes());
+        }
+
+        [[nodiscard]] SlotHeader *migrations(int worker, Side side, int parity) const
+        {
+            return slot(worker, (2 * kRingDepth + side * kRingDepth + parity) * borderSlotBytes());
+        }
+
+        [[nodiscard]] SlotHeader *state(int worker, int parity) const
+        {
+            return slot(worker, 4 * kRingDepth * borderSlotBytes() + parity * stateSlotBytes());
+        }
+
+        [[nodiscard]] int capacityOf(const SlotHeader *slot, int worker) const
+        {
+            return reinterpret_cast<const char *>(slot) >= reinterpret_cast<const char *>(state(worker, 0))
+                   ? capacity : borderCapacity;
+        }
+
+    private:
+        [[nodiscard]] size_t borderSlotBytes() const { return align(sizeof(SlotHeader) + sizeof(SharedSphere) * borderCapacity); }
+        [[nodiscard]] size_t stateSlotBytes() const { return align(sizeof(SlotHeader) + sizeof(SharedSphere) * capacity); }
+        [[nodiscard]] size_t workerBytes() const { return 4 * kRingDepth * borderSlotBytes() + kRingDepth * stateSlotBytes(); }
+
+        [[nodiscard]] size_t offset(int worker, size_t local) const
+        {
+            return align(sizeof(SharedHeader)) + static_cast<size_t>(worker) * workerBytes() + local;
+        }
+
+        [[nodiscard]] SlotHeader *slot(int worker, size_t local) const
+        {
+            return reinterpret_cast<SlotHeader *>(base + offset(worker, local));
+        }
+
+        char *base;
+        int capacity;
+        int borderCapacity;
+    };
+
+    SharedSphere *dataOf(SlotHeader *slot)
+    {
+        return reinterpret_cast<SharedSphere *>(reinterpret_cast<char *>(slot) + sizeof(SlotHeader));
+    }
+
+    /**
+     * copy the spheres that fit in a slot
+     * @param countDropped add the spheres that do not fit to the dropped ones, false when the caller keeps them
+     * @return number of spheres written
+     */
+    int writeSlot(const Layout &layout, int worker, SlotHeader *slot, const std::vector<Sphere> &spheres,
+                  bool countDropped = true)
+    {
+        const int capacity = layout.capacityOf(slot, worker);
+        const int count = std::min(capacity, static_cast<int>(spheres.size()));
+        SharedSphere *data = dataOf(slot);
+
+        for (int i = 0; i < count; ++i) {
+            const Sphere &s = spheres[i];
+            data[i] = { s.position.x, s.position.y, s.prevPosition.x, s.prevPosition.y,
+                        s.velocity.x, s.velocity.y, s.radius, s.invMass, s.lifetime,
+                        s.color, s.groupId, s.nodeIndex,
+                        s.filter.layers, s.filter.mask, s.filter.ignoreGroup ? 1 : 0 };
+        }
+        slot->count = count;
+
+        if (countDropped && count < static_cast<int>(spheres.size()))
+            layout.header()->dropped.fetch_add(static_cast<int>(spheres.size()) - count);
+        return count;
+    }
+
+    void readSlot(SlotHeader *slot, std::vector<Sphere> &spheres)
+    {
+        const SharedSphere *data = dataOf(slot);
+        for (int i = 0; i < slot->count; ++i) {
+            const SharedSphere &d = data[i];
+            Sphere s;
+            s.position = vec2(d.x, d.y);
+            s.prevPosition = vec2(d.prevX, d.prevY);
+            s.velocity = vec2(d.vx, d.vy);
+            s.radius = d.radius;
+            s.invMass = d.invMass;
+            s.lifetime = d.lifetime;
+            s.color = d.color;
+            s.groupId = d.groupId;
+            s.nodeIndex = d.nodeIndex;
+            s.filter.layers = d.layers;
+            s.filter.mask = d.mask;
+            s.filter.ignoreGroup = d.ignoreGroup != 0;
+            spheres.push_back(s);
+        }
+    }
+
+    /**
+     * main loop of a worker process, never return
+     */
+    [[noreturn]] void runWorker(const Layout &layout, const domain::Config &config, int index)
+    {
+        SharedHeader *header = layout.header();
+        const int last = config.workers - 1;
+
+        const double stripWidth = static_cast<double>(config.sceneSize.x) / config.workers;
+        const double left  = stripWidth * index;
+        const double right = left + stripWidth;
+
+        // the outer strips own everything up to infinity so that no sphere is lost
+        const double ownLeft  = index == 0    ? -std::numeric_limits<double>::infinity() : left;
+        const double ownRight = index == last ?  std::numeric_limits<double>::infinity() : right;
+
+        const int threads = config.threadsPerWorker > 0
+                            ? config.threadsPerWorker
+                            : std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / config.workers);
+        multithreading::setMaxThreadCount(threads);
+
+        Context context;
+        context.initialize(config.sceneSize);
+        context.seed(config.seed + static_cast<std::uint32_t>(index));
+
+        std::mt19937 random(config.seed * 7919u + static_cast<std::uint32_t>(index));
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        std::uniform_int_distribution<int> channel(0, 255);
+        std::vector<Sphere> initial;
+        initial.reserve(config.initialSpheres);
+        for (int i = 0; i < config.initialSpheres; ++i) {
+            Sphere sphere(5.f);
+            sphere.setMass(1.f);
+            const float x = static_cast<float>(left + 5.0 + unit(random) * (stripWidth - 10.0));
+            const float y = 5.f + unit(random) * config.sceneSize.y * 0.5f;
+            sphere.position = vec2(x, y);
+            sphere.prevPosition = sphere.position;
+            const int r = channel(random);
+            const int g = channel(random);
+            const int b = channel(random);
+            sphere.color = makeColor(r, g, b);
+            initial.push_back(sphere);
+        }
+        context.spawnSpheres(initial);
+
+        int substep = 0;
+        std::vector<Sphere> toLeft;
+        std::vector<Sphere> toRight;
+        std::vector<Sphere> incoming;
+        std::vector<Sphere> staying;
+
+        context.setSubstepHooks(
+                [&](Context &ctx) {
+                    const int parity = substep % kRingDepth;
+
+                    toLeft.clear();
+                    toRight.clear();
+                    for (const Sphere &sphere : ctx.bodies()) {
+                        if (index > 0 && sphere.position.x < left + config.ghostWidth)
+                            toLeft.push_back(sphere);
+                        if (index < last && sphere.position.x > right - config.ghostWidth)
+                            toRight.push_back(sphere);
+                    }
+                    writeSlot(layout, index, layout.ghosts(index, Left, parity), toLeft);
+                    writeSlot(layout, index, layout.ghosts(index, Right, parity), toRight);
+
+                    pthread_barrier_wait(&header->substepBarrier);
+
+                    incoming.clear();
+                    if (index > 0)
+                        readSlot(layout.ghosts(index - 1, Right, parity), incoming);
+                    if (index < last)
+                        readSlot(layout.ghosts(index + 1, Left, parity), incoming);
+                    ctx.addGhosts(incoming);
+                },
+                [&](Context &ctx) {
+                    ctx.clearGhosts();
+                    ++substep;
+                });
+
+        for (int frame = 0;; ++frame) {
+            pthread_barrier_wait(&header->frameBarrier);
+            if (header->quit.load())
+                break;
+
+            context.step(config.frameDt);
+
+            const int parity = frame % kRingDepth;
+
+            // only free spheres migrate, a cluster stay in the strip that created it and is seen as ghosts by the others
+            const std::vector<Sphere> leaving = context.takeSpheresIf([&](const Sphere &sphere) {
+                return sphere.groupId < 0 && (sphere.position.x < ownLeft || sphere.position.x >= ownRight);
+            });
+            toLeft.clear();
+            toRight.clear();
+            for (const Sphere &sphere : leaving)
+                (sphere.position.x < ownLeft ? toLeft : toRight).push_back(sphere);
+
+            // the spheres that do not fit in a migration slot stay in this strip and leave at the next frame
+            const int leftCount = writeSlot(layout, index, layout.migrations(index, Left, parity), toLeft, false);
+            const int rightCount = writeSlot(layout, index, layout.migrations(index, Right, parity), toRight, false);
+            staying.assign(toLeft.begin() + leftCount, toLeft.end());
+            staying.insert(staying.end(), toRight.begin() + rightCount, toRight.end());
+            if (!staying.empty())
+                context.spawnSpheres(staying);
+
+            writeSlot(layout, index, layout.state(index, parity), context.grid().bodies);
+
+            pthread_barrier_wait(&header->frameBarrier);
+
+            incoming.clear();
+            if (index > 0)
+                readSlot(layout.migrations(index - 1, Right, parity), incoming);
+            if (index < last)
+                readSlot(layout.migrations(index + 1, Left, parity), incoming);
+            context.spawnSpheres(incoming);
+        }
+
+        _exit(0);
+    }
+}
+
+domain::Coordinator::~Coordinator()
+{
+    stop();
+}
+
+bool domain::Coordinator::start()
+{
+    if (memory || config.workers < 1)
+        return false;
+
+    std::snprintf(name, sizeof(name), "/solver_pbd_%d", static_cast<int>(getpid()));
+    memorySize = Layout::bytes(config.workers, config.capacity);
+
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    if (ftruncate(fd, static_cast<off_t>(memorySize)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        memory = nullptr;
+        shm_unlink(name);
+        return false;
+    }
+
+    const Layout layout(memory, config.capacity);
+    SharedHeader *header = layout.header();
+    new (&header->quit) std::atomic<int>(0);
+    new (&header->dropped) std::atomic<int>(0);
+
+    pthread_barrierattr_t attributes;
+    pthread_barrierattr_init(&attributes);
+    pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&header->substepBarrier, &attributes, static_cast<unsigned>(config.workers));
+    pthread_barrier_init(&header->frameBarrier, &attributes, static_cast<unsigned>(config.workers + 1));
+    pthread_barrierattr_destroy(&attributes);
+
+    for (int index = 0; index < config.workers; ++index) {
+        const pid_t pid = fork();
+        if (pid == 0)
+            runWorker(layout, config, index);
+
+        if (pid < 0) {
+            // the barriers expect every worker, the ones already started can not finish cleanly
+            for (pid_t started : workerPids)
+                kill(started, SIGKILL);
+            for (pid_t started : workerPids)
+                waitpid(started, nullptr, 0);
+            workerPids.clear();
+            stop();
+            return false;
+        }
+        workerPids.push_back(pid);
+    }
+
+    frame = 0;
+    return true;
+}
+
+int domain::Coordinator::stepFrame(std::vector<Sphere> *gathered)
+{
+    if (!memory || workerPids.empty())
+        return 0;
+
+    const Layout layout(memory, config.capacity);
+    SharedHeader *header = layout.header();
+
+    pthread_barrier_wait(&header->frameBarrier); // start of the frame
+    pthread_barrier_wait(&header->frameBarrier); // every worker published its state
+
+    const int parity = frame % kRingDepth;
+    ++frame;
+
+    int total = 0;
+    if (gathered)
+        gathered->clear();
+
+    // spheres crossing a border this frame are neither in the state of their old strip nor of the new one yet
+    for (int index = 0; index < config.workers; ++index) {
+        for (SlotHeader *slot : { layout.state(index, parity),
+                                  layout.migrations(index, Left, parity),
+                                  layout.migrations(index, Right, parity) }) {
+            total += slot->count;
+            if (gathered)
+                readSlot(slot, *gathered);
+        }
+    }
+    return total;
+}
+
+void domain::Coordinator::stop()
+{
+    if (!memory)
+        return;
+
+    const Layout layout(memory, config.capacity);
+    SharedHeader *header = layout.header();
+
+    if (!workerPids.empty()) {
+        header->quit.store(1);
+        pthread_barrier_wait(&header->frameBarrier);
+        for (pid_t pid : workerPids)
+            waitpid(pid, nullptr, 0);
+        workerPids.clear();
+    }
+
+    pthread_barrier_destroy(&header->substepBarrier);
+    pthread_barrier_destroy(&header->frameBarrier);
+    munmap(memory, memorySize);
+    shm_unlink(name);
+    memory = nullptr;
+}
+
+int domain::Coordinator::droppedSpheres() const
+{
+    if (!memory)
+        return 0;
+    return Layout(memory, config.capacity).header()->dropped.load();
+}
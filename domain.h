@@ -0,0 +1,78 @@
+#ifndef SOLVER_DOMAIN_H
+#define SOLVER_DOMAIN_H
+
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+#include "physicalbody.h"
+
+
+/**
+ * Domain decomposition over several processes of a single Linux host.
+ * The scene is cut in vertical strips, each strip is simulated by its own worker process owning a Context.
+ * Workers exchange the spheres close to their borders (ghosts) at every substep and hand over the free
+ * spheres that crossed a border at the end of each frame, through POSIX shared memory.
+ * The coordinator (the process that started the workers) gather the spheres of every strip to render them.
+ */
+namespace domain
+{
+    struct Config
+    {
+        int workers          = 2;
+        vec2 sceneSize       = vec2(1600.f, 900.f);
+        float frameDt        = 1.f / 60.f;
+        float ghostWidth     = 80.f;   // larger than the biggest diameter plus the contact skin
+        int capacity         = 65536;  // max spheres owned by one worker, same bound for the ghosts
+        int initialSpheres   = 2000;   // spheres spawned by each worker in its strip
+        std::uint32_t seed   = 1;
+        int threadsPerWorker = 0;      // 0 = share the cores of the host between the workers
+    };
+
+    /**
+     * Start the workers and drive them frame by frame. Only one coordinator per process.
+     */
+    class Coordinator
+    {
+    public:
+        explicit Coordinator(const Config &config) : config(config) {}
+        ~Coordinator();
+
+        Coordinator(const Coordinator &) = delete;
+        Coordinator &operator=(const Coordinator &) = delete;
+
+        /**
+         * create the shared memory and fork the workers. Has to be called before any thread is started
+         * @return false if the shared memory or a worker could not be created
+         */
+        bool start();
+
+        /**
+         * let every worker simulate one frame and gather the result
+         * @param gathered filled with the spheres of every strip, can be nullptr
+         * @return number of spheres in the scene
+         */
+        int stepFrame(std::vector<Sphere> *gathered);
+
+        /**
+         * ask the workers to quit, wait for them and release the shared memory
+         */
+        void stop();
+
+        /**
+         * ghosts and published spheres that did not fit in a shared buffer since the start, should stay 0 when
+         * capacity is large enough. The migrations that do not fit are not lost, they wait for the next frame
+         */
+        [[nodiscard]] int droppedSpheres() const;
+
+    private:
+        Config config;
+        std::vector<pid_t> workerPids;
+        void *memory = nullptr;
+        size_t memorySize = 0;
+        char name[64] = {};
+        int frame = 0;
+    };
+}
+
+#endif //SOLVER_DOMAIN_H
@@ -0,0 +1,66 @@
+#include "domain.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace
+{
+    /**
+     * whole text as an integer of at least minimum
+     */
+    bool parseCount(const char *text, int minimum, int &value)
+    {
+        char *end = nullptr;
+        const long parsed = std::strtol(text, &end, 10);
+        if (end == text || *end != '\0' || parsed < minimum || parsed > INT_MAX)
+            return false;
+        value = static_cast<int>(parsed);
+        return true;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr, "usage: SOLVER_domains [workers >= 1] [frames >= 1] [spheres per worker]\n");
+    }
+}
+
+/**
+ * headless run of the domain decomposition
+ * usage: SOLVER_domains [workers] [frames] [spheres per worker]
+ */
+int main(int argc, char *argv[])
+{
+    domain::Config config;
+    int frames = 600;
+    if (argc > 4 || (argc > 1 && !parseCount(argv[1], 1, config.workers))
+        || (argc > 2 && !parseCount(argv[2], 1, frames))
+        || (argc > 3 && !parseCount(argv[3], 0, config.initialSpheres))) {
+        usage();
+        return 2;
+    }
+
+    domain::Coordinator coordinator(config);
+    if (!coordinator.start()) {
+        std::fprintf(stderr, "could not start the workers\n");
+        return 1;
+    }
+
+    std::vector<Sphere> gathered;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int frame = 1; frame <= frames; ++frame) {
+        const int count = coordinator.stepFrame(&gathered);
+        if (frame % 60 == 0 || frame == frames) {
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            const double ms = elapsed.count() / frame;
+            std::printf("frame %d  spheres %d  %.2f ms/frame\n", frame, count, ms);
+        }
+    }
+
+    std::printf("dropped %d\n", coordinator.droppedSpheres());
+    coordinator.stop();
+    return 0;
+}
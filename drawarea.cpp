@@ -1,10 +1,19 @@
 #include "drawarea.h"
+#include "autotune.h"
+#include "trace.h"
 
 #include <QMouseEvent>
 #include <QPainter>
-#include <QThreadPool>
+#include <QCoreApplication>
+#include <QStringList>
 #include <iostream>
 
+namespace
+{
+    // spheres emitted with E disappear after a while, so holding the key does not grow the scene forever
+    constexpr float kCenterSphereLifetime = 60.f;
+}
+
 DrawArea::DrawArea(QWidget *parent, unsigned int hearts)
         : QWidget(parent)
 {
@@ -12,7 +21,7 @@ DrawArea::DrawArea(QWidget *parent, unsigned int hearts)
     setStyleSheet("background: white;");
 
     if (hearts != 0) {
-        QThreadPool::globalInstance()->setMaxThreadCount(static_cast<int>(hearts));
+        multithreading::setMaxThreadCount(static_cast<int>(hearts));
     }
 
     QSize initialSize = size();
@@ -21,7 +30,34 @@ DrawArea::DrawArea(QWidget *parent, unsigned int hearts)
         resize(initialSize);
     }
 
-    context.initialize(initialSize);
+    context.initialize(vec2(static_cast<float>(initialSize.width()), static_cast<float>(initialSize.height())));
+    context.setReorderInterval(120);
+    // speculative contacts keep the fast emitted spheres stable with half the substeps
+    context.setSubsteps(2);
+
+    // SOLVER [--autotune] level.txt load the obstacles of a scene file
+    bool autotuned = false;
+    const QStringList arguments = QCoreApplication::arguments();
+    for (int i = 1; i < arguments.size(); ++i) {
+        if (arguments.at(i) == "--autotune") {
+            autotuned = true;
+            continue;
+        }
+        std::string error;
+        if (!context.loadObstacles(arguments.at(i).toStdString(), &error))
+            std::cerr << error << std::endl;
+    }
+
+    // --autotune use the settings tuned for this machine on the scene, measured if none were saved
+    if (autotuned) {
+        const autotune::Settings settings = autotune::loadOrCalibrate(context);
+        if (hearts != 0) {
+            multithreading::setChunksPerThread(settings.chunksPerThread);
+            context.setCellSize(settings.cellSize);
+        } else {
+            autotune::apply(settings, context);
+        }
+    }
 
     connect(&timer, &QTimer::timeout, this, &DrawArea::animate);
     timer.start(16);
@@ -35,7 +71,16 @@ DrawArea::DrawArea(QWidget *parent, unsigned int hearts)
 
 void DrawArea::mousePressEvent(QMouseEvent *event)
 {
-    context.addUserSphere(event->pos());
+    const vec2 position = renderer::toVec2(event->pos());
+
+    // right click remove the spheres under the cursor
+    if (event->button() == Qt::RightButton) {
+        std::vector<int> picked;
+        context.queryRadius(position, 0.f, picked);
+        context.removeSpheres(picked);
+    } else {
+        context.addUserSphere(position);
+    }
     update();
 }
 
@@ -47,7 +92,7 @@ void DrawArea::paintEvent(QPaintEvent *)
 
 void DrawArea::resizeEvent(QResizeEvent *event)
 {
-    context.resizeScene(event->size());
+    context.resizeScene(vec2(static_cast<float>(event->size().width()), static_cast<float>(event->size().height())));
     QWidget::resizeEvent(event);
 }
 
@@ -82,6 +127,50 @@ void DrawArea::keyPressEvent(QKeyEvent *event)
         return;
     }
 
+    if (event->key() == Qt::Key_M){
+        const bool springs = context.clusterModel() == ClusterModel::Springs;
+        context.setClusterModel(springs ? ClusterModel::ShapeMatching : ClusterModel::Springs);
+        std::cout << (springs ? "shape matching clusters" : "spring clusters") << std::endl;
+        event->accept();
+        return;
+    }
+
+    if (event->key() == Qt::Key_R){
+        MultirateSettings settings = context.multirate();
+        settings.enabled = !settings.enabled;
+        context.setMultirate(settings);
+        std::cout << (settings.enabled ? "multirate substeps" : "same substeps everywhere") << std::endl;
+        event->accept();
+        return;
+    }
+
+    if (event->key() == Qt::Key_T){
+        // first press start recording, the second one write the timeline
+        if (!trace::isEnabled()) {
+            trace::start();
+            std::cout << "tracing" << std::endl;
+        } else {
+            trace::stop();
+            std::string error;
+            if (trace::writeChromeTrace("solver_trace.json", &error))
+                std::cout << "timeline written to solver_trace.json" << std::endl;
+            else
+                std::cerr << error << std::endl;
+        }
+        event->accept();
+        return;
+    }
+
+    if (event->key() == Qt::Key_A){
+        // tune again on the current scene and keep the result for the next launches
+        const autotune::Settings settings = autotune::loadOrCalibrate(context, true);
+        autotune::apply(settings, context);
+        std::cout << "threads " << settings.threads << ", chunks per thread " << settings.chunksPerThread
+                  << ", cell size " << settings.cellSize << " (" << settings.msPerStep << " ms/step)" << std::endl;
+        event->accept();
+        return;
+    }
+
     if (event->key() == Qt::Key_N){
         std::cout << nb_particle << std::endl;
         event->accept();
@@ -124,6 +213,6 @@ void DrawArea::emitCenterSphere()
 {
     nb_particle++;
     const float t = static_cast<float>(clock.nsecsElapsed()) * 1e-9f;
-    context.emitCenterSphere(t);
+    context.emitCenterSphere(t, kCenterSphereLifetime);
     update();
 }
\ No newline at end of file
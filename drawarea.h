@@ -42,6 +42,8 @@ protected:
      * handle key press event :
      * c = square in the center
      * e = emit small sphere in the center
+     * m = switch the next clusters between springs and shape matching
+     * a = tune the thread count, chunk size and cell size again on the current scene
      * @param event
      */
     void keyPressEvent(QKeyEvent *event) override;
@@ -0,0 +1,27 @@
+#ifndef SOLVER_EMITTER_H
+#define SOLVER_EMITTER_H
+
+#include "physicalbody.h"
+
+
+/**
+ * Continuous source of small spheres. The context accumulate rate * dt each frame and spawn
+ * the whole frame worth of spheres in one batch, so thousands of particles per second cost one grid update per frame.
+ */
+struct Emitter
+{
+    vec2 position  = vec2(0.f, 0.f);
+    float rate    = 1000.f; // sphere per second
+    float speed   = 220.f;  // initial velocity is (cos(t) * speed, speed) like the center emitter
+    float width   = 60.f;   // the spheres are spread along a horizontal nozzle of this width
+    float radius  = 5.f;
+    float mass    = 1.f;
+    float lifetime = -1.f;  // seconds an emitted sphere lives, negative = forever
+    CollisionFilter filter; // given to every emitted sphere
+    bool enabled  = true;
+
+    float pending = 0.f;    // fraction of sphere not emitted yet
+    float time    = 0.f;    // time since the emitter started, drive the direction of the jet
+};
+
+#endif //SOLVER_EMITTER_H
@@ -0,0 +1,52 @@
+#include "framestate.h"
+
+#include <unordered_map>
+
+#include "constraints.h"
+#include "sdfconstraint.h"
+
+
+void framestate::captureShapes(const Context &context, std::vector<Shape> &shapes)
+{
+    shapes.clear();
+    for (const auto &constraint : context.constraints()) {
+        if (!constraint)
+            continue;
+
+        if (auto segment = std::dynamic_pointer_cast<SegmentConstraint>(constraint)) {
+            shapes.push_back({Shape::Segment, segment->thickness(), segment->a(), segment->b()});
+        } else if (auto sdf = std::dynamic_pointer_cast<SdfConstraint>(constraint)) {
+            // the field itself is not drawn, only the polylines it was baked from
+            for (const auto &polyline : sdf->outline()) {
+                for (std::size_t i = 0; i + 1 < polyline.size(); ++i)
+                    shapes.push_back({Shape::Line, 0.f, polyline[i], polyline[i + 1]});
+            }
+        } else if (auto sphere = std::dynamic_pointer_cast<SphereConstraint>(constraint)) {
+            shapes.push_back({Shape::Circle, sphere->radius(), sphere->center(), sphere->center()});
+        } else if (auto bowl = std::dynamic_pointer_cast<BowlConstraint>(constraint)) {
+            shapes.push_back({Shape::Circle, bowl->radius(), bowl->center(), bowl->center()});
+        }
+    }
+}
+
+void framestate::capture(const Context &context, Frame &frame)
+{
+    frame.sceneSize = context.sceneSize();
+    frame.truncated = false;
+    frame.palette.clear();
+    frame.discs.clear();
+
+    const BufferView<const Sphere> bodies = context.bodies();
+    frame.discs.reserve(bodies.size);
+
+    // most scenes use a handful of colors, the spheres of a cluster all share one
+    std::unordered_map<rgba, std::uint32_t> indices;
+    for (const Sphere &sphere : bodies) {
+        const auto inserted = indices.emplace(sphere.color, static_cast<std::uint32_t>(frame.palette.size()));
+        if (inserted.second)
+            frame.palette.push_back(sphere.color);
+        frame.discs.push_back({sphere.position, sphere.radius, inserted.first->second});
+    }
+
+    captureShapes(context, frame.shapes);
+}
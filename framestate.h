@@ -0,0 +1,61 @@
+#ifndef SOLVER_FRAMESTATE_H
+#define SOLVER_FRAMESTATE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "context.h"
+
+
+/**
+ * What is needed to draw one frame of a Context, without the simulation state: a disc per sphere with an
+ * index in the palette of the frame, and the static constraints reduced to circles, segments and lines.
+ * It is plain data, so it can be copied to another process (see framestream.h) and drawn there.
+ */
+namespace framestate
+{
+    struct Disc
+    {
+        vec2 position;
+        float radius = 0.f;
+        std::uint32_t color = 0; // index in Frame::palette
+    };
+
+    struct Shape
+    {
+        enum Kind : std::uint32_t
+        {
+            Circle,  // a = center, width = radius (sphere and bowl constraints)
+            Segment, // a to b, width = thickness of the wall
+            Line     // a to b, one edge of the outline of a distance field
+        };
+
+        Kind kind = Circle;
+        float width = 0.f;
+        vec2 a;
+        vec2 b;
+    };
+
+    struct Frame
+    {
+        std::uint64_t number = 0; // frames published before this one
+        vec2 sceneSize;
+        std::vector<rgba> palette; // every distinct color of the frame, once
+        std::vector<Disc> discs;
+        std::vector<Shape> shapes;
+        bool truncated = false;    // the frame had more spheres or shapes than the stream could hold
+    };
+
+    /**
+     * the shapes drawn for the static constraints of the context, planes are not drawn
+     * @param shapes cleared then filled
+     */
+    void captureShapes(const Context &context, std::vector<Shape> &shapes);
+
+    /**
+     * fill frame with the spheres and the constraints of the context, the capacity of its vectors is kept
+     */
+    void capture(const Context &context, Frame &frame);
+}
+
+#endif //SOLVER_FRAMESTATE_H
@@ -0,0 +1,339 @@
+#include "framestream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+    constexpr std::uint32_t kMagic = 0x53465053; // "SPFS"
+    constexpr std::uint32_t kVersion = 1;
+    constexpr std::size_t kAlignment = 64;
+    constexpr int kReadAttempts = 8; // a reader lapped that many times in a row gives up until the next call
+
+    static_assert(std::is_trivially_copyable<framestate::Disc>::value, "discs are copied with memcpy");
+    static_assert(std::is_trivially_copyable<framestate::Shape>::value, "shapes are copied with memcpy");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the sequences are shared between processes");
+
+    struct SharedHeader
+    {
+        std::atomic<std::uint32_t> magic; // written last, a reader never sees a header half initialized
+        std::uint32_t version;
+        std::int32_t slots;
+        std::int32_t sphereCapacity;
+        std::int32_t shapeCapacity;
+        std::atomic<std::uint64_t> published; // frames written so far, the latest one is published - 1
+        std::atomic<std::int32_t> closed;
+    };
+
+    /**
+     * followed by the palette and the discs (sphereCapacity of each) then the shapes
+     */
+    struct SlotHeader
+    {
+        std::atomic<std::uint64_t> sequence; // odd while the publisher writes the slot
+        std::uint64_t number;
+        float sceneWidth, sceneHeight;
+        std::int32_t paletteCount, discCount, shapeCount;
+        std::int32_t truncated;
+    };
+
+    std::size_t align(std::size_t bytes)
+    {
+        return (bytes + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    /**
+     * layout of the shared memory: the header then the slots of the ring
+     */
+    class Layout
+    {
+    public:
+        Layout(const void *memory, int slots, int sphereCapacity, int shapeCapacity)
+                : slots(slots), sphereCapacity(sphereCapacity), shapeCapacity(shapeCapacity),
+                  base(static_cast<char *>(const_cast<void *>(memory))) {}
+
+        static std::size_t bytes(int slots, int sphereCapacity, int shapeCapacity)
+        {
+            const Layout layout(nullptr, slots, sphereCapacity, shapeCapacity);
+            return align(sizeof(SharedHeader)) + static_cast<std::size_t>(slots) * layout.slotBytes();
+        }
+
+        [[nodiscard]] SharedHeader *header() const { return reinterpret_cast<SharedHeader *>(base); }
+
+        [[nodiscard]] SlotHeader *slot(std::uint64_t number) const
+        {
+            const std::size_t index = static_cast<std::size_t>(number % static_cast<std::uint64_t>(slots));
+            return reinterpret_cast<SlotHeader *>(base + align(sizeof(SharedHeader)) + index * slotBytes());
+        }
+
+        [[nodiscard]] rgba *palette(SlotHeader *slot) const
+        {
+            return reinterpret_cast<rgba *>(reinterpret_cast<char *>(slot) + paletteOffset());
+        }
+
+        [[nodiscard]] framestate::Disc *discs(SlotHeader *slot) const
+        {
+            return reinterpret_cast<framestate::Disc *>(reinterpret_cast<char *>(slot) + discOffset());
+        }
+
+        [[nodiscard]] framestate::Shape *shapes(SlotHeader *slot) const
+        {
+            return reinterpret_cast<framestate::Shape *>(reinterpret_cast<char *>(slot) + shapeOffset());
+        }
+
+        const int slots;
+        const int sphereCapacity;
+        const int shapeCapacity;
+
+    private:
+        [[nodiscard]] std::size_t paletteOffset() const { return align(sizeof(SlotHeader)); }
+        [[nodiscard]] std::size_t discOffset() const { return paletteOffset() + align(sizeof(rgba) * sphereCapacity); }
+        [[nodiscard]] std::size_t shapeOffset() const { return discOffset() + align(sizeof(framestate::Disc) * sphereCapacity); }
+        [[nodiscard]] std::size_t slotBytes() const { return shapeOffset() + align(sizeof(framestate::Shape) * shapeCapacity); }
+
+        char *base;
+    };
+
+    Layout layoutOf(const void *memory)
+    {
+        const auto *header = static_cast<const SharedHeader *>(memory);
+        return {memory, header->slots, header->sphereCapacity, header->shapeCapacity};
+    }
+
+    void setError(std::string *error, const std::string &message)
+    {
+        if (error)
+            *error = message + ": " + std::strerror(errno);
+    }
+}
+
+framestream::Publisher::~Publisher()
+{
+    close();
+}
+
+bool framestream::Publisher::open(const std::string &streamName, const Config &config, std::string *error)
+{
+    close();
+    if (config.slots < 2 || config.sphereCapacity < 1 || config.shapeCapacity < 1) {
+        if (error)
+            *error = "a frame stream needs at least 2 slots and room for a sphere and a shape";
+        return false;
+    }
+
+    // a publisher that crashed left its stream behind, the subscribers still mapping it keep their copy
+    shm_unlink(streamName.c_str());
+    const int fd = shm_open(streamName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        setError(error, "cannot create " + streamName);
+        return false;
+    }
+
+    const std::size_t bytes = Layout::bytes(config.slots, config.sphereCapacity, config.shapeCapacity);
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+        setError(error, "cannot size " + streamName);
+        ::close(fd);
+        shm_unlink(streamName.c_str());
+        return false;
+    }
+
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        setError(error, "cannot map " + streamName);
+        shm_unlink(streamName.c_str());
+        return false;
+    }
+
+    // the memory comes zeroed, so every slot sequence starts even
+    const Layout layout(mapped, config.slots, config.sphereCapacity, config.shapeCapacity);
+    SharedHeader *header = layout.header();
+    header->version = kVersion;
+    header->slots = config.slots;
+    header->sphereCapacity = config.sphereCapacity;
+    header->shapeCapacity = config.shapeCapacity;
+    header->published.store(0, std::memory_order_relaxed);
+    header->closed.store(0, std::memory_order_relaxed);
+    header->magic.store(kMagic, std::memory_order_release);
+
+    memory = mapped;
+    memorySize = bytes;
+    name = streamName;
+    frameCount = 0;
+    return true;
+}
+
+void framestream::Publisher::publish(const Context &context)
+{
+    if (!memory)
+        return;
+    framestate::capture(context, captured);
+    publish(captured);
+}
+
+void framestream::Publisher::publish(const framestate::Frame &frame)
+{
+    if (!memory)
+        return;
+
+    const Layout layout = layoutOf(memory);
+    const std::uint64_t number = frameCount;
+    SlotHeader *slot = layout.slot(number);
+
+    // the slot still holds the frame published slots frames ago, readers of that one see the odd sequence
+    // and move to a newer frame
+    const std::uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const int discCount = std::min(static_cast<int>(frame.discs.size()), layout.sphereCapacity);
+    const int shapeCount = std::min(static_cast<int>(frame.shapes.size()), layout.shapeCapacity);
+    // colors are numbered in the order they first appear, so the discs kept only use the first colors
+    const int paletteCount = std::min(static_cast<int>(frame.palette.size()), layout.sphereCapacity);
+
+    slot->number = number;
+    slot->sceneWidth = frame.sceneSize.x;
+    slot->sceneHeight = frame.sceneSize.y;
+    slot->paletteCount = paletteCount;
+    slot->discCount = discCount;
+    slot->shapeCount = shapeCount;
+    slot->truncated = frame.truncated || discCount < static_cast<int>(frame.discs.size())
+                      || shapeCount < static_cast<int>(frame.shapes.size());
+    std::memcpy(layout.palette(slot), frame.palette.data(), sizeof(rgba) * paletteCount);
+    std::memcpy(layout.discs(slot), frame.discs.data(), sizeof(framestate::Disc) * discCount);
+    std::memcpy(layout.shapes(slot), frame.shapes.data(), sizeof(framestate::Shape) * shapeCount);
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    layout.header()->published.store(number + 1, std::memory_order_release);
+    ++frameCount;
+}
+
+void framestream::Publisher::close()
+{
+    if (!memory)
+        return;
+    static_cast<SharedHeader *>(memory)->closed.store(1, std::memory_order_release);
+    munmap(memory, memorySize);
+    shm_unlink(name.c_str());
+    memory = nullptr;
+    memorySize = 0;
+}
+
+framestream::Subscriber::~Subscriber()
+{
+    detach();
+}
+
+bool framestream::Subscriber::attach(const std::string &streamName, std::string *error)
+{
+    detach();
+
+    const int fd = shm_open(streamName.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        setError(error, "no frame stream " + streamName);
+        return false;
+    }
+
+    struct stat status {};
+    if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(SharedHeader)) {
+        if (error)
+            *error = streamName + " is not a frame stream";
+        ::close(fd);
+        return false;
+    }
+
+    const auto bytes = static_cast<std::size_t>(status.st_size);
+    void *mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        setError(error, "cannot map " + streamName);
+        return false;
+    }
+
+    const auto *header = static_cast<const SharedHeader *>(mapped);
+    if (header->magic.load(std::memory_order_acquire) != kMagic || header->version != kVersion
+        || header->slots < 2 || header->sphereCapacity < 1 || header->shapeCapacity < 1
+        || Layout::bytes(header->slots, header->sphereCapacity, header->shapeCapacity) > bytes) {
+        if (error)
+            *error = streamName + " is not a frame stream, or it is not ready yet";
+        munmap(mapped, bytes);
+        return false;
+    }
+
+    memory = mapped;
+    memorySize = bytes;
+    hasRead = false;
+    return true;
+}
+
+void framestream::Subscriber::detach()
+{
+    if (!memory)
+        return;
+    munmap(const_cast<void *>(memory), memorySize);
+    memory = nullptr;
+    memorySize = 0;
+}
+
+bool framestream::Subscriber::latest(framestate::Frame &frame)
+{
+    if (!memory)
+        return false;
+
+    const Layout layout = layoutOf(memory);
+    const SharedHeader *header = layout.header();
+
+    for (int attempt = 0; attempt < kReadAttempts; ++attempt) {
+        const std::uint64_t published = header->published.load(std::memory_order_acquire);
+        if (published == 0)
+            return false;
+        const std::uint64_t number = published - 1;
+        if (hasRead && number == lastNumber)
+            return false;
+
+        SlotHeader *slot = layout.slot(number);
+        const std::uint64_t before = slot->sequence.load(std::memory_order_acquire);
+        if (before & 1u)
+            continue; // the publisher lapped the ring and is writing over this frame
+
+        // copied into scratch, so a torn read never reaches the caller
+        const int paletteCount = std::clamp(slot->paletteCount, 0, layout.sphereCapacity);
+        const int discCount = std::clamp(slot->discCount, 0, layout.sphereCapacity);
+        const int shapeCount = std::clamp(slot->shapeCount, 0, layout.shapeCapacity);
+        scratch.number = slot->number;
+        scratch.sceneSize = vec2(slot->sceneWidth, slot->sceneHeight);
+        scratch.truncated = slot->truncated != 0;
+        scratch.palette.resize(paletteCount);
+        scratch.discs.resize(discCount);
+        scratch.shapes.resize(shapeCount);
+        std::memcpy(scratch.palette.data(), layout.palette(slot), sizeof(rgba) * paletteCount);
+        std::memcpy(scratch.discs.data(), layout.discs(slot), sizeof(framestate::Disc) * discCount);
+        std::memcpy(scratch.shapes.data(), layout.shapes(slot), sizeof(framestate::Shape) * shapeCount);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != before || scratch.number != number)
+            continue;
+
+        if (hasRead && number > lastNumber)
+            skippedFrames += number - lastNumber - 1;
+        lastNumber = number;
+        hasRead = true;
+        std::swap(frame, scratch);
+        return true;
+    }
+    return false;
+}
+
+bool framestream::Subscriber::isClosed() const
+{
+    return memory && static_cast<const SharedHeader *>(memory)->closed.load(std::memory_order_acquire) != 0;
+}
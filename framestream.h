@@ -0,0 +1,123 @@
+#ifndef SOLVER_FRAMESTREAM_H
+#define SOLVER_FRAMESTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "framestate.h"
+
+
+/**
+ * Stream the frames of a simulation to viewer processes of the same Linux host, through a ring of frames in
+ * POSIX shared memory. One publisher writes, any number of subscribers read, and nobody waits for anybody:
+ * the publisher overwrites the oldest slot whatever the readers are doing, a reader always takes the latest
+ * frame and skips the ones it was too slow to see. Each slot is guarded by a sequence number (odd while it
+ * is written), a reader that raced the publisher notices it and tries again on a newer frame.
+ */
+namespace framestream
+{
+    constexpr const char *kDefaultName = "/solver_pbd_frames";
+
+    struct Config
+    {
+        int slots          = 4;
+        int sphereCapacity = 200000; // spheres beyond are not published and the frame is marked truncated
+        int shapeCapacity  = 16384;
+    };
+
+    /**
+     * the writing side, owned by the process that steps the Context
+     */
+    class Publisher
+    {
+    public:
+        Publisher() = default;
+        ~Publisher();
+
+        Publisher(const Publisher &) = delete;
+        Publisher &operator=(const Publisher &) = delete;
+
+        /**
+         * create the shared memory, a stale stream of the same name (a publisher that crashed) is replaced
+         * @param name starts with a slash, see shm_open
+         * @return false if the shared memory could not be created
+         */
+        bool open(const std::string &name, const Config &config = Config(), std::string *error = nullptr);
+
+        /**
+         * copy the current frame of the context in the next slot. Never blocks
+         */
+        void publish(const Context &context);
+
+        /**
+         * copy an already captured frame in the next slot. Never blocks
+         */
+        void publish(const framestate::Frame &frame);
+
+        /**
+         * tell the subscribers the stream ended and remove the shared memory, they keep their mapping
+         */
+        void close();
+
+        [[nodiscard]] bool isOpen() const { return memory != nullptr; }
+        [[nodiscard]] std::uint64_t published() const { return frameCount; }
+
+    private:
+        framestate::Frame captured; // reused, so publishing does not allocate once the scene stopped growing
+        void *memory = nullptr;
+        std::size_t memorySize = 0;
+        std::string name;
+        std::uint64_t frameCount = 0;
+    };
+
+    /**
+     * the reading side, a viewer
+     */
+    class Subscriber
+    {
+    public:
+        Subscriber() = default;
+        ~Subscriber();
+
+        Subscriber(const Subscriber &) = delete;
+        Subscriber &operator=(const Subscriber &) = delete;
+
+        /**
+         * map the stream read only, a previous mapping is released. Can be called again to follow a
+         * publisher that restarted
+         * @return false if there is no stream of that name or it is not a frame stream
+         */
+        bool attach(const std::string &name, std::string *error = nullptr);
+
+        void detach();
+
+        /**
+         * copy the latest published frame if it is newer than the last one read
+         * @return false if there is no new frame, frame is left untouched
+         */
+        bool latest(framestate::Frame &frame);
+
+        /**
+         * the publisher closed the stream
+         */
+        [[nodiscard]] bool isClosed() const;
+
+        [[nodiscard]] bool isAttached() const { return memory != nullptr; }
+
+        /**
+         * frames published between two frames read, they were never seen by this subscriber
+         */
+        [[nodiscard]] std::uint64_t skipped() const { return skippedFrames; }
+
+    private:
+        framestate::Frame scratch; // a read that raced the publisher is dropped before reaching the caller
+        const void *memory = nullptr;
+        std::size_t memorySize = 0;
+        std::uint64_t lastNumber = 0;
+        bool hasRead = false;
+        std::uint64_t skippedFrames = 0;
+    };
+}
+
+#endif //SOLVER_FRAMESTREAM_H
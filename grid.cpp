@@ -0,0 +1,285 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+
+namespace
+{
+    constexpr int kMinTableSize = 64;
+
+    int nextPowerOfTwo(int value)
+    {
+        int result = kMinTableSize;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+}
+
+void Grid::setCellSize(float size)
+{
+    cellSize_ = size > 0.f ? size : 1.f;
+    rebuild();
+}
+
+cell2 Grid::cellOf(const vec2 &position) const
+{
+    // clamp so that a sphere that exploded to infinity still get a valid cell
+    const float limit = 1e9f;
+    const float col = std::floor(std::clamp(position.x / cellSize_, -limit, limit));
+    const float row = std::floor(std::clamp(position.y / cellSize_, -limit, limit));
+    return {static_cast<int>(col), static_cast<int>(row)};
+}
+
+int Grid::findCell(int col, int row) const
+{
+    if (table.empty())
+        return -1;
+    return table[slotFor(keyOf(col, row))];
+}
+
+void Grid::insert(int bodyIndex)
+{
+    const cell2 cell = cellOf(bodies[bodyIndex].position);
+    const int index = findOrCreateCell(cell.x, cell.y);
+    if (cells[index].empty() && !std::binary_search(activeCells.begin(), activeCells.end(), index)) {
+        // a cell emptied without a rebuild is occupied again
+        activeCells.insert(std::lower_bound(activeCells.begin(), activeCells.end(), index), index);
+        neighborStarts.clear();
+    }
+    cells[index].push_back(bodyIndex);
+    reach_ = std::max(reach_, bodies[bodyIndex].radius);
+}
+
+int Grid::acquireHandle(int bodyIndex)
+{
+    int handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        handleIndex[handle] = bodyIndex;
+    } else {
+        handle = static_cast<int>(handleIndex.size());
+        handleIndex.push_back(bodyIndex);
+    }
+    bodyHandle.push_back(handle);
+    return handle;
+}
+
+void Grid::releaseHandle(int handle)
+{
+    if (handle < 0 || handle >= static_cast<int>(handleIndex.size()))
+        return;
+    handleIndex[handle] = -1;
+    freeHandles.push_back(handle);
+}
+
+void Grid::rebuild()
+{
+    // the vectors of the previous cells are reused to keep their capacity
+    for (std::vector<int> &cell : cells)
+        spareCells.push_back(std::move(cell));
+    cells.clear();
+    cellCoords.clear();
+    activeCells.clear();
+    std::fill(table.begin(), table.end(), -1);
+    reach_ = 0.f;
+    lowCell = {1, 1};
+    highCell = {0, 0};
+
+    for (int i = 0; i < bodyCount(); ++i) {
+        reach_ = std::max(reach_, bodies[i].radius);
+        const cell2 cell = cellOf(bodies[i].position);
+        cells[findOrCreateCell(cell.x, cell.y)].push_back(i);
+    }
+
+    // row major order, a thread working on a range of cells work on a horizontal band of the scene
+    sortOrder.resize(size());
+    std::iota(sortOrder.begin(), sortOrder.end(), 0);
+    std::sort(sortOrder.begin(), sortOrder.end(), [this](int a, int b) {
+        const cell2 &pa = cellCoords[a];
+        const cell2 &pb = cellCoords[b];
+        return pa.y != pb.y ? pa.y < pb.y : pa.x < pb.x;
+    });
+
+    sortedCells.resize(size());
+    sortedCoords.resize(size());
+    for (int i = 0; i < size(); ++i) {
+        sortedCells[i].swap(cells[sortOrder[i]]);
+        sortedCoords[i] = cellCoords[sortOrder[i]];
+    }
+    cells.swap(sortedCells);
+    cellCoords.swap(sortedCoords);
+    sortedCells.clear();
+
+    rehash(static_cast<int>(table.size()));
+    ensureLocks();
+
+    // every cell is occupied right after a rebuild, the neighbors are only searched when they are needed
+    activeCells.resize(cells.size());
+    std::iota(activeCells.begin(), activeCells.end(), 0);
+    neighborStarts.clear();
+}
+
+void Grid::reserve(int sphereCount, int cellCount, int cellOccupancy)
+{
+    bodies.reserve(sphereCount);
+    handleIndex.reserve(sphereCount);
+    bodyHandle.reserve(sphereCount);
+    freeHandles.reserve(sphereCount);
+
+    cells.reserve(cellCount);
+    cellCoords.reserve(cellCount);
+    activeCells.reserve(cellCount);
+    neighborStarts.reserve(cellCount + 1);
+    neighborCells.reserve(cellCount * 4);
+    sortOrder.reserve(cellCount);
+    sortedCells.reserve(cellCount);
+    sortedCoords.reserve(cellCount);
+    spareCells.reserve(cellCount);
+    table.reserve(nextPowerOfTwo(cellCount * 2));
+
+    // every cell that can exist gets its storage and its lock now
+    for (std::vector<int> &cell : cells)
+        cell.reserve(cellOccupancy);
+    for (std::vector<int> &cell : spareCells)
+        cell.reserve(cellOccupancy);
+    for (int i = size() + static_cast<int>(spareCells.size()); i < cellCount; ++i) {
+        spareCells.emplace_back();
+        spareCells.back().reserve(cellOccupancy);
+    }
+    locks.reserve(cellCount);
+    for (int i = static_cast<int>(locks.size()); i < cellCount; ++i)
+        locks.push_back(std::make_unique<std::mutex>());
+}
+
+void Grid::refreshActiveCells()
+{
+    activeCells.clear();
+    for (int index = 0; index < size(); ++index) {
+        if (!cells[index].empty())
+            activeCells.push_back(index);
+    }
+    neighborStarts.clear();
+}
+
+void Grid::refreshNeighbors()
+{
+    // half of the neighborhood, the other half see this cell as its neighbor
+    static const cell2 offsets[] = {{1, 0}, {0, 1}, {1, 1}, {-1, 1}};
+
+    neighborStarts.assign(cells.size() + 1, 0);
+    neighborCells.clear();
+    neighborCells.reserve(activeCells.size() * 4);
+
+    std::size_t next = 0;
+    for (int index = 0; index < size(); ++index) {
+        neighborStarts[index] = static_cast<int>(neighborCells.size());
+        if (next >= activeCells.size() || activeCells[next] != index)
+            continue;
+        ++next;
+
+        const cell2 &coords = cellCoords[index];
+        for (const cell2 &offset : offsets) {
+            const int neighbor = findCell(coords.x + offset.x, coords.y + offset.y);
+            if (neighbor >= 0 && !cells[neighbor].empty())
+                neighborCells.push_back(neighbor);
+        }
+    }
+    neighborStarts[cells.size()] = static_cast<int>(neighborCells.size());
+}
+
+void Grid::refreshReach()
+{
+    float reach = 0.f;
+    for (int index = 0; index < size(); ++index) {
+        const vec2 low(static_cast<float>(cellCoords[index].x) * cellSize_, static_cast<float>(cellCoords[index].y) * cellSize_);
+        const vec2 high = low + vec2(cellSize_, cellSize_);
+        for (int body : cells[index]) {
+            const Sphere &sphere = bodies[body];
+            const vec2 outside(std::max({low.x - sphere.position.x, sphere.position.x - high.x, 0.f}),
+                               std::max({low.y - sphere.position.y, sphere.position.y - high.y, 0.f}));
+            reach = std::max(reach, outside.length() + sphere.radius);
+        }
+    }
+    reach_ = reach;
+}
+
+box2 Grid::bounds() const
+{
+    if (lowCell.x > highCell.x)
+        return {};
+    return {vec2(static_cast<float>(lowCell.x) * cellSize_, static_cast<float>(lowCell.y) * cellSize_),
+            vec2(static_cast<float>(highCell.x + 1) * cellSize_, static_cast<float>(highCell.y + 1) * cellSize_)};
+}
+
+std::uint64_t Grid::keyOf(int col, int row)
+{
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(col)) << 32) | static_cast<std::uint32_t>(row);
+}
+
+int Grid::slotFor(std::uint64_t key) const
+{
+    // fibonacci hashing then linear probing, the table is never more than half full
+    const auto mask = static_cast<std::uint64_t>(table.size() - 1);
+    std::uint64_t slot = (key * 0x9E3779B97F4A7C15ull) >> 32;
+    while (true) {
+        slot &= mask;
+        const int index = table[static_cast<std::size_t>(slot)];
+        if (index < 0)
+            return static_cast<int>(slot);
+        const cell2 &coords = cellCoords[index];
+        if (keyOf(coords.x, coords.y) == key)
+            return static_cast<int>(slot);
+        ++slot;
+    }
+}
+
+int Grid::findOrCreateCell(int col, int row)
+{
+    if ((size() + 1) * 2 > static_cast<int>(table.size()))
+        rehash((size() + 1) * 2);
+
+    const int slot = slotFor(keyOf(col, row));
+    if (table[slot] >= 0)
+        return table[slot];
+
+    if (lowCell.x > highCell.x) {
+        lowCell = highCell = {col, row};
+    } else {
+        lowCell = {std::min(lowCell.x, col), std::min(lowCell.y, row)};
+        highCell = {std::max(highCell.x, col), std::max(highCell.y, row)};
+    }
+
+    const int index = size();
+    table[slot] = index;
+    cells.emplace_back();
+    if (!spareCells.empty()) {
+        cells.back().swap(spareCells.back());
+        spareCells.pop_back();
+        cells.back().clear();
+    }
+    cellCoords.push_back({col, row});
+    activeCells.push_back(index);
+    ensureLocks();
+    return index;
+}
+
+void Grid::rehash(int minCapacity)
+{
+    table.assign(static_cast<std::size_t>(nextPowerOfTwo(std::max(minCapacity, size() * 2))), -1);
+
+    for (int index = 0; index < size(); ++index) {
+        const cell2 &coords = cellCoords[index];
+        table[slotFor(keyOf(coords.x, coords.y))] = index;
+    }
+}
+
+void Grid::ensureLocks()
+{
+    const auto count = static_cast<size_t>(size());
+    for (size_t i = locks.size(); i < count; ++i)
+        locks.push_back(std::make_unique<std::mutex>());
+}
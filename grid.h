@@ -5,53 +5,146 @@
 #ifndef SOLVER_GRID_H
 #define SOLVER_GRID_H
 
-#include <QMutex>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include "physicalbody.h"
 
 
 /**
  * Grid structure
+ * Sparse spatial hash over an unbounded plane: a cell only exist while a sphere is inside it,
+ * so the grid does not depend on the size of the window and spheres far away do not pile in border cells.
  * maybe we should look at gmsh or something similar to be able to refine the mesh where it is needed
  * because some area has less ball than others. Or kdtree but it scars me :)
  */
 class Grid {
 
 public:
-    Grid() : gridRows(0), gridCols(0) {}
+    Grid() = default;
 
-    Grid(unsigned int rows, unsigned int cols)
-            : cells(static_cast<int>(rows * cols)),
-              gridRows(rows),
-              gridCols(cols) {}
+    explicit Grid(float cellSize) { setCellSize(cellSize); }
 
     ~Grid() = default;
 
-
-    void resize(unsigned int rows, unsigned int cols) {
-        gridRows = rows;
-        gridCols = cols;
-        const int total = static_cast<int>(rows * cols);
-
-        cells.resize(total);
-        locks.resize(total);
-        for (int i = 0; i < total; ++i) {
-            if (!locks[i])
-                locks[i] = std::make_unique<QMutex>();
-        }
-    }
-
-
+    /**
+     * change the size of the cells, every cell is dropped and rebuilt from the spheres
+     * @param size in pixel
+     */
+    void setCellSize(float size);
+
+    /**
+     * coordinates (col, row) of the cell containing a position, can be negative
+     * @param position
+     */
+    [[nodiscard]] cell2 cellOf(const vec2 &position) const;
+
+    /**
+     * @return index of the cell (col, row) in cells, -1 if no sphere is inside it
+     */
+    [[nodiscard]] int findCell(int col, int row) const;
+
+    /**
+     * put a sphere already in bodies in its cell, creating the cell if needed
+     * @param bodyIndex
+     */
+    void insert(int bodyIndex);
+
+    /**
+     * give a handle to the sphere at bodyIndex, the handles of removed spheres are reused first
+     * @param bodyIndex the sphere has to be the last one of bodyHandle + 1
+     * @return the handle
+     */
+    int acquireHandle(int bodyIndex);
+
+    /**
+     * put the handle of a removed sphere in the free list, it does not designate any sphere until it is reused
+     * @param handle
+     */
+    void releaseHandle(int handle);
+
+    /**
+     * recompute every cells from the position of the spheres. The cells are sorted row by row
+     * so that a contiguous range of cells is a compact zone of the scene
+     */
+    void rebuild();
+
+    /**
+     * grow the storage so that this many spheres in this many cells are inserted and rebuilt without any allocation
+     * @param sphereCount
+     * @param cellCount
+     * @param cellOccupancy spheres each cell holds before its storage grows
+     */
+    void reserve(int sphereCount, int cellCount, int cellOccupancy);
+
+    /**
+     * measure again how far the spheres reach out of their cell, to be called once they moved.
+     * insert and rebuild keep it up to date on their own
+     */
+    void refreshReach();
+
+    /**
+     * largest distance between the box of a cell and a point of a sphere stored in it (its radius plus
+     * how far its center left the cell since it was put there). A sphere touching a point is stored in a
+     * cell closer than this to the point, the spatial queries search that far around what they look for
+     */
+    [[nodiscard]] float reach() const { return reach_; }
+
+    /**
+     * area covered by the occupied cells, empty if there is none. Only grows between two rebuilds
+     */
+    [[nodiscard]] box2 bounds() const;
+
+    /**
+     * list again the cells holding a sphere, after spheres were dropped from their cell without a rebuild
+     */
+    void refreshActiveCells();
+
+    /**
+     * compute the occupied neighbors of every active cell, see neighborCells
+     */
+    void refreshNeighbors();
+
+    /**
+     * false once a cell was created or emptied since refreshNeighbors
+     */
+    [[nodiscard]] bool hasNeighbors() const { return neighborStarts.size() == cells.size() + 1; }
+
+    [[nodiscard]] float cellSize() const { return cellSize_; }
     [[nodiscard]] int size()  const { return static_cast<int>(cells.size()); }
-    [[nodiscard]] bool isEmpty() const { return cells.isEmpty(); }
-
-    QVector<QVector<Sphere>> cells;
-    std::vector<std::unique_ptr<QMutex>> locks; // we don't use QVector because it does not support Qmutex to have copy constructor deleted
-    unsigned int gridRows;
-    unsigned int gridCols;
-    //const float targetCellSize = 200;
-
-
+    [[nodiscard]] bool isEmpty() const { return cells.empty(); }
+    [[nodiscard]] int bodyCount() const { return static_cast<int>(bodies.size()); }
+
+    std::vector<Sphere> bodies;            // storage of the spheres, an index stay valid until the grid is rebuilt
+    std::vector<std::vector<int>> cells;   // index in bodies of the spheres inside each occupied cell
+    std::vector<cell2> cellCoords;         // coordinates (col, row) of each occupied cell
+    std::vector<int> activeCells;          // cells holding at least one sphere, in increasing order
+    std::vector<int> neighborStarts;       // neighbors of cell c are neighborCells[neighborStarts[c], neighborStarts[c + 1])
+    std::vector<int> neighborCells;        // occupied cells at (1, 0), (0, 1), (1, 1) and (-1, 1), each pair of neighbors is listed once
+    std::vector<int> handleIndex;          // index in bodies of each handle, handles never change when bodies are reordered
+    std::vector<int> bodyHandle;           // handle of each sphere of bodies
+    std::vector<int> freeHandles;          // handles of removed spheres, reused by the next insertions
+    std::vector<std::unique_ptr<std::mutex>> locks; // one per cell, behind a pointer because a mutex can not be moved
+
+private:
+    [[nodiscard]] static std::uint64_t keyOf(int col, int row);
+    [[nodiscard]] int slotFor(std::uint64_t key) const;
+    int findOrCreateCell(int col, int row);
+    void rehash(int minCapacity);
+    void ensureLocks();
+
+    float cellSize_ = 200.f;
+    float reach_    = 0.f;
+    cell2 lowCell {1, 1};   // range of the coordinates of the occupied cells, low > high when there is none
+    cell2 highCell {0, 0};
+    std::vector<int> table; // open addressing hash table, index in cells or -1
+
+    // storage of the cells of the previous rebuild, and scratch of the rebuild, kept to reuse the memory
+    std::vector<std::vector<int>> spareCells;
+    std::vector<std::vector<int>> sortedCells;
+    std::vector<cell2> sortedCoords;
+    std::vector<int> sortOrder;
 };
 
 #endif //SOLVER_GRID_H
@@ -0,0 +1,39 @@
+#ifndef SOLVER_KILLZONE_H
+#define SOLVER_KILLZONE_H
+
+#include "vec2.h"
+
+
+/**
+ * Region where spheres are removed at the beginning of each step. A sphere of a cluster takes its whole cluster with it
+ */
+struct KillZone
+{
+    enum class Kind
+    {
+        Inside,    // inside box
+        Outside,   // outside box, to drop what left the scene
+        HalfPlane  // dot(X, normal) < distance, the same convention as PlaneConstraint
+    };
+
+    Kind kind = Kind::Inside;
+    box2 box;
+    vec2 normal = vec2(0.f, -1.f);
+    float distance = 0.f;
+
+    static KillZone inside(const box2 &box) { return {Kind::Inside, box, vec2(0.f, -1.f), 0.f}; }
+    static KillZone outside(const box2 &box) { return {Kind::Outside, box, vec2(0.f, -1.f), 0.f}; }
+    static KillZone halfPlane(const vec2 &normal, float distance) { return {Kind::HalfPlane, box2(), normal, distance}; }
+
+    [[nodiscard]] bool contains(const vec2 &position) const
+    {
+        switch (kind) {
+            case Kind::Inside:    return box.contains(position);
+            case Kind::Outside:   return !box.contains(position);
+            case Kind::HalfPlane: return dot(position, normal) < distance;
+        }
+        return false;
+    }
+};
+
+#endif //SOLVER_KILLZONE_H
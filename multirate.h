@@ -0,0 +1,51 @@
+#ifndef SOLVER_MULTIRATE_H
+#define SOLVER_MULTIRATE_H
+
+#include <cstdint>
+#include <vector>
+
+constexpr int kMaxSubstepStride = 16;
+
+/**
+ * Multirate stepping (see Context::setMultirate): the calm regions of the scene are stepped less often than the
+ * busy ones. Each cell gets a stride, a power of two: a sphere of stride k is integrated, solved and gets its
+ * velocity once every k substeps, with a k times longer time step, and stays static in between.
+ * Every stride divides the substeps of a frame, so all the spheres meet at the same time at the end of each frame.
+ */
+struct MultirateSettings
+{
+    bool enabled        = false;
+    int maxStride       = 4;     // stride of the calmest regions, lowered to a power of two dividing the substeps
+                                 // and to kMaxSubstepStride
+    float motionBudget  = 0.1f;  // fraction of its radius a sphere may move in one of its own substeps
+    float denseContacts = 2.5f;  // candidate pairs per sphere above which a cell is a pile, stepped at every substep
+};
+
+/**
+ * stride of every sphere and cell for the current frame, and the substep being solved
+ */
+struct SubstepRates
+{
+    std::vector<std::uint8_t> sphereStrides; // one per sphere of Grid::bodies
+    std::vector<std::uint8_t> cellStrides;   // smallest stride of the spheres of each cell of Grid::cells
+    int substep  = 0;
+    int subSteps = 1;
+
+    // scratch of solver::assignSubstepRates, kept to reuse the memory
+    std::vector<int> cellPairs;
+    std::vector<int> groupNodes; // the spheres of a cluster, sorted by group
+
+    /**
+     * a stride is awake on the last substep of each of its periods, so every stride ends with the frame
+     */
+    [[nodiscard]] bool isAwake(int stride) const { return (substep + 1) % stride == 0; }
+    [[nodiscard]] bool isSphereAwake(int sphere) const { return isAwake(sphereStrides[sphere]); }
+    [[nodiscard]] bool isCellAwake(int cell) const { return isAwake(cellStrides[cell]); }
+
+    /**
+     * substeps a sphere gets in a frame, what the per substep stiffness of its constraints is derived from
+     */
+    [[nodiscard]] int substepsOf(int sphere) const { return subSteps / sphereStrides[sphere]; }
+};
+
+#endif //SOLVER_MULTIRATE_H
@@ -4,125 +4,329 @@
 
 
 #include "multithreading.h"
+#include "alloctrack.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 namespace
 {
     /**
-     * apply a function on vertical range. on each sphere
+     * persistent workers waiting for a job split in chunks. The thread that dispatch the job
+     * also take chunks, and only one job run at a time.
+     */
+    class ThreadPool
+    {
+    public:
+        static ThreadPool &instance()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        ~ThreadPool() { stopWorkers(); }
+
+        [[nodiscard]] int threadCount() const { return threadCount_.load(std::memory_order_relaxed); }
+
+        [[nodiscard]] static int currentWorker() { return workerIndex; }
+
+        void setThreadCount(int count)
+        {
+            trace::Scope scope("pool resize", count);
+            std::lock_guard<std::mutex> dispatchLocker(dispatchLock);
+            stopWorkers();
+            threadCount_ = std::max(1, count);
+            quit = false;
+            for (int i = 1; i < threadCount_; ++i) workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+
+        /**
+         * run job(0) ... job(chunks - 1) on the workers and the calling thread, return once they are all done
+         */
+        void run(int chunks, multithreading::TaskRef<void (int)> job)
+        {
+            // a task dispatching from a worker would wait for itself, it is done inline
+            if (insideWorker || workers.empty() || chunks <= 1) {
+                for (int chunk = 0; chunk < chunks; ++chunk) job(chunk);
+                return;
+            }
+
+            trace::Scope scope("dispatch", chunks);
+            std::lock_guard<std::mutex> dispatchLocker(dispatchLock);
+            {
+                std::lock_guard<std::mutex> locker(lock);
+                currentJob = &job;
+                chunkCount = chunks;
+                nextChunk  = 0;
+                busy       = static_cast<int>(workers.size());
+                ++generation;
+            }
+            wake.notify_all();
+
+            takeChunks(job, chunks);
+
+            // the time spent here is the wait for the stragglers
+            trace::Scope waitScope("dispatch join");
+            std::unique_lock<std::mutex> locker(lock);
+            done.wait(locker, [this]() { return busy == 0; });
+            currentJob = nullptr;
+        }
+
+    private:
+        ThreadPool() { setThreadCount(static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))); }
+
+        void takeChunks(multithreading::TaskRef<void (int)> job, int chunks)
+        {
+            for (int chunk = nextChunk++; chunk < chunks; chunk = nextChunk++) job(chunk);
+        }
+
+        void workerLoop(int index)
+        {
+            insideWorker = true;
+            workerIndex = index;
+            trace::setThreadName("worker " + std::to_string(index));
+            unsigned seen = 0;
+            while (true) {
+                const multithreading::TaskRef<void (int)> *job = nullptr;
+                int chunks = 0;
+                {
+                    std::unique_lock<std::mutex> locker(lock);
+                    wake.wait(locker, [&]() { return quit || generation != seen; });
+                    if (quit)
+                        return;
+                    seen   = generation;
+                    job    = currentJob;
+                    chunks = chunkCount;
+                }
+
+                takeChunks(*job, chunks);
+
+                std::lock_guard<std::mutex> locker(lock);
+                if (--busy == 0)
+                    done.notify_one();
+            }
+        }
+
+        void stopWorkers()
+        {
+            {
+                std::lock_guard<std::mutex> locker(lock);
+                quit = true;
+            }
+            wake.notify_all();
+            for (std::thread &worker : workers) worker.join();
+            workers.clear();
+        }
+
+        std::mutex dispatchLock; // one job at a time
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::vector<std::thread> workers;
+
+        const multithreading::TaskRef<void (int)> *currentJob = nullptr;
+        int chunkCount = 0;
+        std::atomic<int> nextChunk {0};
+        int busy = 0;
+        unsigned generation = 0;
+        bool quit = false;
+        std::atomic<int> threadCount_ {1};
+
+        static thread_local bool insideWorker;
+        static thread_local int workerIndex; // 0 outside of the workers
+    };
+
+    thread_local bool ThreadPool::insideWorker = false;
+    thread_local int ThreadPool::workerIndex = 0;
+
+    thread_local bool serialThread = false; // see setSerialOnThisThread
+
+    std::atomic<int> chunksPerThread {1};
+
+    /**
+     * apply a function on each sphere of a range of the storage
      * @param grid
-     * @param colBegin
-     * @param colEnd
+     * @param begin
+     * @param end
      * @param task
      */
     void process(Grid &grid,
-                 int colBegin,
-                 int colEnd,
-                 const std::function<void (Sphere &)> &task)
+                 int begin,
+                 int end,
+                 multithreading::TaskRef<void (Sphere &)> task)
     {
-        if (!task || grid.gridCols == 0 || grid.gridRows == 0)
+        if (!task)
             return;
 
-        colBegin = std::clamp(colBegin, 0, static_cast<int>(grid.gridCols));
-        colEnd   = std::clamp(colEnd,   colBegin, static_cast<int>(grid.gridCols));
-
-        for (unsigned int row = 0; row < grid.gridRows; ++row) {
-            const int baseIndex = static_cast<int>(row * grid.gridCols);
-            for (int col = colBegin; col < colEnd; ++col) {
-                const int cellIndex = baseIndex + col;
-                if (cellIndex >= grid.size())
-                    break;
-                for (Sphere &sphere : grid.cells[cellIndex]) {
-                    task(sphere);
-                }
-            }
+        begin = std::clamp(begin, 0, grid.bodyCount());
+        end   = std::clamp(end,   begin, grid.bodyCount());
+
+        for (int index = begin; index < end; ++index) {
+            task(grid.bodies[index]);
         }
     }
 
     /**
-     * Apply a task verticaly on each cell
+     * Apply a task on each occupied cell of a range of Grid::activeCells, cells are sorted row by row
+     * so a range is a band of the scene
      * @param grid
-     * @param colBegin
-     * @param colEnd
+     * @param begin in activeCells
+     * @param end
      * @param task
      */
     void process(Grid &grid,
-                 int colBegin,
-                 int colEnd,
-                 const std::function<void (unsigned int, unsigned int)> &task)
+                 int begin,
+                 int end,
+                 multithreading::TaskRef<void (int)> task)
     {
         if (!task)
             return;
 
-        colBegin = std::clamp(colBegin, 0, static_cast<int>(grid.gridCols));
-        colEnd   = std::clamp(colEnd,   colBegin, static_cast<int>(grid.gridCols));
+        const int count = static_cast<int>(grid.activeCells.size());
+        begin = std::clamp(begin, 0, count);
+        end   = std::clamp(end,   begin, count);
 
-        for (unsigned int row = 0; row < grid.gridRows; ++row) {
-            for (unsigned int col = colBegin; col < colEnd; ++col) task(row, col);
-        }
+        for (int active = begin; active < end; ++active) task(grid.activeCells[active]);
     }
 
     /**
      * dispatch the thread on different computation zone
-     * @tparam Task either a function that act on Sphere or a function that act on cells
-     * @param grid
+     * @tparam Task a function that act on a range [begin, end)
+     * @param count size of the range to split (cells, spheres, batches...)
      * @param task
      */
     template <typename Task>
-    void dispatch(Grid &grid, Task &&task)
+    void dispatch(int count, Task &&task)
     {
-        const int cols = static_cast<int>(grid.gridCols);
+        if (serialThread) {
+            trace::Scope scope("chunk", 0);
+            task(0, count);
+            return;
+        }
+
         const int maxThreads    = std::max(1, multithreading::maxThreadAllowed());
-        const int usableThreads = std::min(maxThreads, cols);
+        const int usableThreads = std::min(maxThreads, count);
 
         if (usableThreads <= 1) {
-            task(0, cols);
+            trace::Scope scope("chunk", 0);
+            task(0, count);
             return;
         }
 
-        const int chunkWidth = std::max(1, (cols + usableThreads - 1) / usableThreads);
-
-        QVector<QFuture<void>> futures;
-        futures.reserve(usableThreads);
-
-        for (int colStart = 0; colStart < cols; colStart += chunkWidth) {
-            const int colStop = std::min(colStart + chunkWidth, cols);
-
-            futures << QtConcurrent::run(
-                    [colStart, colStop, &task]() { task(colStart, colStop); });
-        }
+        const int wanted     = usableThreads * chunksPerThread.load(std::memory_order_relaxed);
+        const int chunkWidth = std::max(1, (count + wanted - 1) / wanted);
+        const int chunks     = (count + chunkWidth - 1) / chunkWidth;
 
-        for (QFuture<void> &future : futures) {
-            future.waitForFinished();
-        }
+        // the workers count their allocations as the dispatching thread would, see alloctrack
+        const alloctrack::ThreadState state = alloctrack::threadState();
+        ThreadPool::instance().run(chunks, [count, chunkWidth, &task, &state](int chunk) {
+            alloctrack::AdoptScope adopt(state);
+            trace::Scope scope("chunk", chunk);
+            const int start = chunk * chunkWidth;
+            task(start, std::min(start + chunkWidth, count));
+        });
     }
 }
 
 void multithreading::forEachSphere(
         Grid &grid,
-        const std::function<void (Sphere &)> &task)
+        multithreading::TaskRef<void (Sphere &)> task)
 {
-    if (!task || grid.isEmpty() || grid.gridCols == 0 || grid.gridRows == 0)
+    if (!task || grid.bodies.empty())
         return;
 
-    dispatch(grid, [&](int colBegin, int colEnd) {
-        process(grid, colBegin, colEnd, task);
+    dispatch(grid.bodyCount(), [&](int begin, int end) {
+        process(grid, begin, end, task);
     });
 }
 
 void multithreading::forEachCell(
         Grid &grid,
-        const std::function<void (unsigned int, unsigned int)> &task)
+        multithreading::TaskRef<void (int)> task)
+{
+    if (!task || grid.activeCells.empty())
+        return;
+
+    dispatch(static_cast<int>(grid.activeCells.size()), [&](int begin, int end) {
+        process(grid, begin, end, task);
+    });
+}
+
+void multithreading::forEachRange(int count, multithreading::TaskRef<void (int, int)> task)
 {
-    if (!task || grid.isEmpty() || grid.gridCols == 0 || grid.gridRows == 0)
+    if (!task || count <= 0)
         return;
 
-    dispatch(grid, [&](int colBegin, int colEnd) {
-        process(grid, colBegin, colEnd, task);
+    dispatch(count, task);
+}
+
+float multithreading::maxOverSpheres(
+        Grid &grid,
+        multithreading::TaskRef<float (Sphere &)> task)
+{
+    if (!task || grid.bodies.empty())
+        return 0.f;
+
+    return maxOverRange(grid.bodyCount(), [&](int begin, int end) {
+        float localMax = 0.f;
+        for (int index = begin; index < end; ++index) {
+            localMax = std::max(localMax, task(grid.bodies[index]));
+        }
+        return localMax;
     });
 }
 
+float multithreading::maxOverRange(int count, multithreading::TaskRef<float (int, int)> task)
+{
+    if (!task || count <= 0)
+        return 0.f;
+
+    std::mutex resultLock;
+    float result = 0.f;
+
+    dispatch(count, [&](int begin, int end) {
+        const float localMax = task(begin, end);
+
+        std::lock_guard<std::mutex> locker(resultLock);
+        result = std::max(result, localMax);
+    });
+
+    return result;
+}
+
+void multithreading::setSerialOnThisThread(bool serial)
+{
+    serialThread = serial;
+}
+
+void multithreading::setChunksPerThread(int chunks)
+{
+    ::chunksPerThread.store(std::max(1, chunks), std::memory_order_relaxed);
+}
+
+int multithreading::chunksPerThread()
+{
+    return ::chunksPerThread.load(std::memory_order_relaxed);
+}
+
+int multithreading::threadIndex()
+{
+    return ThreadPool::currentWorker();
+}
+
 int multithreading::maxThreadAllowed()
 {
-    return QThreadPool::globalInstance()->maxThreadCount();
-}
\ No newline at end of file
+    return ThreadPool::instance().threadCount();
+}
+
+void multithreading::setMaxThreadCount(int count)
+{
+    ThreadPool::instance().setThreadCount(count);
+}
@@ -6,10 +6,9 @@
 #define SOLVER_MULTITHREADING_H
 
 #include <functional>
-#include <QVector>
-#include <QtConcurrent/QtConcurrentMap>
-#include <QtConcurrent/QtConcurrentRun>
-#include <QThreadPool>
+#include <memory>
+#include <type_traits>
+#include <utility>
 
 #include "physicalbody.h"
 #include "grid.h"
@@ -17,24 +16,113 @@
 
 namespace multithreading
 {
+    template <typename Signature>
+    class TaskRef;
+
+    /**
+     * reference to a callable, what the dispatch functions take. Unlike a std::function it never allocates
+     * (a lambda capturing a few references would), the callable only has to outlive the call it is given to
+     */
+    template <typename Result, typename... Args>
+    class TaskRef<Result (Args...)>
+    {
+    public:
+        template <typename Callable,
+                  typename = std::enable_if_t<!std::is_same_v<std::decay_t<Callable>, TaskRef>>>
+        TaskRef(Callable &&callable) // NOLINT: implicit, a lambda is given where a task is expected
+            : object(const_cast<void *>(static_cast<const void *>(std::addressof(callable))))
+        {
+            using Stored = std::remove_reference_t<Callable>;
+            if constexpr (std::is_constructible_v<bool, Stored &>) {
+                // an empty std::function is an empty task
+                if (!static_cast<bool>(callable))
+                    return;
+            }
+            call = [](void *target, Args... args) -> Result {
+                return (*static_cast<Stored *>(target))(std::forward<Args>(args)...);
+            };
+        }
+
+        Result operator()(Args... args) const { return call(object, std::forward<Args>(args)...); }
+
+        explicit operator bool() const { return call != nullptr; }
+
+    private:
+        void *object = nullptr;
+        Result (*call)(void *, Args...) = nullptr;
+    };
+
     /**
      * for each sphere apply a procedure
      * @param grid reference on grid
      * @param task procdure applied
      */
-    void forEachSphere(Grid &grid, const std::function<void (Sphere &)> &task);
+    void forEachSphere(Grid &grid, TaskRef<void (Sphere &)> task);
 
     /**
-     * for each cell apply a procedure
+     * for each occupied cell apply a procedure, the cells left empty since the last rebuild are skipped
      * @param grid
-     * @param task
+     * @param task procedure applied on the index of the cell in Grid::cells
      */
-    void forEachCell(Grid &grid, const std::function<void (unsigned int, unsigned int)> &task);
+    void forEachCell(Grid &grid, TaskRef<void (int)> task);
+
+    /**
+     * split [0, count) in one contiguous range per thread and apply a procedure on each range
+     * @param count
+     * @param task procedure applied on [begin, end)
+     */
+    void forEachRange(int count, TaskRef<void (int, int)> task);
+
+    /**
+     * for each sphere apply a procedure that return a residual, and keep the largest one.
+     * each thread keep its own maximum, they are merged once at the end of the chunk
+     * @param grid
+     * @param task procedure applied, return the residual for this sphere
+     * @return the largest residual, 0 if the grid is empty
+     */
+    float maxOverSpheres(Grid &grid, TaskRef<float (Sphere &)> task);
+
+    /**
+     * same as forEachRange but each range return a residual and the largest one is kept
+     * @param count
+     * @param task procedure applied on [begin, end), return the residual of the range
+     * @return the largest residual, 0 if count is 0
+     */
+    float maxOverRange(int count, TaskRef<float (int, int)> task);
+
+    /**
+     * run every dispatch made by the calling thread inline on it, without the pool. Used to step many
+     * small scenes side by side, one per thread, without contending on the pool
+     * @param serial
+     */
+    void setSerialOnThisThread(bool serial);
+
+    /**
+     * number of chunks each thread gets in a dispatch. Chunks are taken one by one, so more chunks balance
+     * uneven work better but cost one more synchronization each
+     * @param chunks at least 1
+     */
+    void setChunksPerThread(int chunks);
+    [[nodiscard]] int chunksPerThread();
+
+    /**
+     * index of the calling thread in the pool: 1 to maxThreadAllowed() - 1 for the workers, 0 for any other
+     * thread. Two threads working on the same dispatch never share an index, a task can use it to pick
+     * its own scratch buffer
+     */
+    int threadIndex();
 
     /**
      * Return the number of thread allowed
      */
     int maxThreadAllowed();
+
+    /**
+     * resize the pool of worker threads. The calling thread always take part in the work
+     * so count - 1 workers are kept alive between two dispatch
+     * @param count number of threads working on a dispatch, at least 1
+     */
+    void setMaxThreadCount(int count);
 }
 
 
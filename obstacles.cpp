@@ -0,0 +1,98 @@
+#include "obstacles.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    constexpr int kLeafSize = 4;
+}
+
+void ObstacleSet::build(const std::vector<std::shared_ptr<StaticConstraint>> &constraints)
+{
+    nodes.clear();
+    items.clear();
+    itemBounds.clear();
+    unbounded.clear();
+    owned = constraints;
+
+    for (const auto &constraint : owned) {
+        if (!constraint)
+            continue;
+
+        const box2 box = constraint->bounds();
+        if (box.isInfinite()) {
+            unbounded.push_back(constraint.get());
+        } else if (!box.isEmpty()) {
+            items.push_back(constraint.get());
+            itemBounds.push_back(box);
+        }
+    }
+
+    if (items.empty())
+        return;
+
+    // the tree is complete binary in the worst case, 2n nodes is enough
+    nodes.reserve(2 * items.size());
+    buildNode(0, static_cast<int>(items.size()));
+}
+
+int ObstacleSet::buildNode(int first, int count)
+{
+    const int index = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+
+    box2 bounds;
+    box2 centers;
+    for (int i = first; i < first + count; ++i) {
+        bounds.expand(itemBounds[i]);
+        const vec2 c = itemBounds[i].center();
+        centers.expand(box2(c, c));
+    }
+    nodes[index].bounds = bounds;
+
+    if (count <= kLeafSize) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // median split along the longest axis of the centers, the tree stay balanced so the stack of query is enough
+    const vec2 extent = centers.extent();
+    const bool splitX = extent.x >= extent.y;
+    const int half = count / 2;
+
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) order[i] = first + i;
+    std::nth_element(order.begin(), order.begin() + half, order.end(), [&](int a, int b) {
+        const vec2 ca = itemBounds[a].center();
+        const vec2 cb = itemBounds[b].center();
+        return splitX ? ca.x < cb.x : ca.y < cb.y;
+    });
+
+    std::vector<const StaticConstraint *> sortedItems(count);
+    std::vector<box2> sortedBounds(count);
+    for (int i = 0; i < count; ++i) {
+        sortedItems[i]  = items[order[i]];
+        sortedBounds[i] = itemBounds[order[i]];
+    }
+    std::copy(sortedItems.begin(), sortedItems.end(), items.begin() + first);
+    std::copy(sortedBounds.begin(), sortedBounds.end(), itemBounds.begin() + first);
+
+    buildNode(first, half);
+    const int right = buildNode(first + half, count - half);
+    nodes[index].right = right;
+    return index;
+}
+
+float ObstacleSet::project(Sphere &sphere) const
+{
+    float maxCorrection = 0.f;
+    for (const StaticConstraint *constraint : unbounded)
+        maxCorrection = std::max(maxCorrection, constraint->project(sphere));
+
+    query(box2::around(sphere.position, sphere.radius), [&](const StaticConstraint &constraint) {
+        maxCorrection = std::max(maxCorrection, constraint.project(sphere));
+    });
+    return maxCorrection;
+}
@@ -0,0 +1,94 @@
+#ifndef SOLVER_OBSTACLES_H
+#define SOLVER_OBSTACLES_H
+
+#include <memory>
+#include <vector>
+
+#include "constraints.h"
+
+
+/**
+ * Static constraints of the scene sorted in a bounding volume hierarchy, so that a sphere is only
+ * projected on the obstacles whose box it touches. The cost per sphere depend on the local density
+ * of obstacles instead of their total number. Obstacles without bounds (planes, bowls) are kept apart
+ * and tested against every sphere.
+ */
+class ObstacleSet
+{
+public:
+    /**
+     * rebuild the hierarchy, the constraints are shared and not copied
+     * @param constraints
+     */
+    void build(const std::vector<std::shared_ptr<StaticConstraint>> &constraints);
+
+    /**
+     * project the sphere on every obstacle that can touch it
+     * @param sphere
+     * @return the largest correction applied
+     */
+    float project(Sphere &sphere) const;
+
+    /**
+     * call visit on every bounded obstacle whose box overlap the query box
+     * @tparam Visitor callable taking a const StaticConstraint &
+     */
+    template <typename Visitor>
+    void query(const box2 &box, Visitor &&visit) const;
+
+    [[nodiscard]] int size() const { return static_cast<int>(items.size() + unbounded.size()); }
+    [[nodiscard]] int boundedCount() const { return static_cast<int>(items.size()); }
+    [[nodiscard]] int nodeCount() const { return static_cast<int>(nodes.size()); }
+
+private:
+    /**
+     * a leaf own the items [first, first + count). An inner node has count == 0,
+     * its left child is the next node and its right child is at index right
+     */
+    struct Node
+    {
+        box2 bounds;
+        int first = 0;
+        int count = 0;
+        int right = -1;
+    };
+
+    int buildNode(int first, int count);
+
+    std::vector<Node> nodes;
+    std::vector<const StaticConstraint *> items;      // bounded obstacles in leaf order
+    std::vector<box2> itemBounds;
+    std::vector<const StaticConstraint *> unbounded;
+    std::vector<std::shared_ptr<StaticConstraint>> owned; // keep the obstacles alive
+};
+
+template <typename Visitor>
+void ObstacleSet::query(const box2 &box, Visitor &&visit) const
+{
+    if (nodes.empty())
+        return;
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+        if (!node.bounds.overlaps(box))
+            continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                if (itemBounds[i].overlaps(box))
+                    visit(*items[i]);
+            }
+            continue;
+        }
+
+        const int left = static_cast<int>(&node - nodes.data()) + 1;
+        stack[top++] = node.right;
+        stack[top++] = left;
+    }
+}
+
+#endif //SOLVER_OBSTACLES_H
@@ -5,11 +5,22 @@
 #ifndef SOLVER_PHYSICALBODY_H
 #define SOLVER_PHYSICALBODY_H
 
-#include <QPointF>
-#include <QVector2D>
-#include <QColor>
+#include <cstdint>
 #include <limits>
 
+#include "vec2.h"
+
+
+/**
+ * color stored as 0xAARRGGBB, the same layout as QRgb so the renderer can use it directly
+ */
+using rgba = std::uint32_t;
+
+constexpr rgba makeColor(int r, int g, int b, int a = 255)
+{
+    return (static_cast<rgba>(a & 0xff) << 24) | (static_cast<rgba>(r & 0xff) << 16)
+           | (static_cast<rgba>(g & 0xff) << 8) | static_cast<rgba>(b & 0xff);
+}
 
 /**
  * this class represent a physical objet
@@ -20,11 +31,11 @@ public:
     PhysicalBody() = default;
     virtual ~PhysicalBody() = default;
 
-    QPointF position = QPointF(0.0, 0.0);
-    QPointF prevPosition = QPointF(0.0, 0.0);
-    QVector2D velocity = QVector2D(0.f, 0.f);
+    vec2 position = vec2(0.f, 0.f);
+    vec2 prevPosition = vec2(0.f, 0.f);
+    vec2 velocity = vec2(0.f, 0.f);
     float invMass = 1.f;
-    QColor color = Qt::blue;
+    rgba color = makeColor(0, 0, 255);
 
     void setMass(float mass)
     {
@@ -41,6 +52,19 @@ public:
     }
 };
 
+/**
+ * which spheres collide with which, two spheres collide when the layers of each one are in the mask of the other.
+ * The default filter collides with everything
+ */
+struct CollisionFilter
+{
+    std::uint16_t layers = 1;      // categories the sphere belongs to, one bit per category
+    std::uint16_t mask   = 0xffff; // categories it collides with
+    bool ignoreGroup     = false;  // no contact with the spheres of its own group, they are held by its springs
+
+    [[nodiscard]] bool isDefault() const { return mask == 0xffff && layers != 0 && !ignoreGroup; }
+};
+
 class Sphere : public PhysicalBody
 {
 public:
@@ -52,6 +76,8 @@ public:
 
     int groupId = -1;    // -1 = Independant sphere
     int nodeIndex = -1;  // index in the square 0, 1, 2, 3
+    float lifetime = -1.f; // seconds left before the sphere is removed, negative = never
+    CollisionFilter filter;
 };
 
 #endif // SOLVER_PHYSICALBODY_H
@@ -0,0 +1,107 @@
+#include "prefab.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    void addSpring(Prefab &prefab, int aNode, int bNode, float stiffness)
+    {
+        SpringLink spring;
+        spring.aNode = aNode;
+        spring.bNode = bNode;
+        spring.restLength = (prefab.nodes[bNode].position - prefab.nodes[aNode].position).length();
+        spring.stiffness = stiffness;
+
+        prefab.springs.push_back(spring);
+    }
+
+    Sphere makeNode(const vec2 &offset, int node, float radius, float mass, rgba color)
+    {
+        Sphere sphere;
+        sphere.radius = radius;
+        sphere.position = offset;
+        sphere.prevPosition = offset;
+        sphere.setMass(mass);
+        sphere.color = color;
+        sphere.nodeIndex = node;
+        sphere.filter.ignoreGroup = true; // the nodes are held together by the springs or the shape
+        return sphere;
+    }
+}
+
+Prefab prefab::springCluster()
+{
+    const float radius      = 18.f;
+    const float halfSpacing = 26.f;
+    const float mass        = 6.f;
+    const rgba color = makeColor(220, 80, 80);
+
+    Prefab prefab;
+    prefab.nodes = {
+            makeNode(vec2(0.f, -halfSpacing), 0, radius, mass, color),
+            makeNode(vec2(halfSpacing, 0.f),  1, radius, mass, color),
+            makeNode(vec2(0.f, halfSpacing),  2, radius, mass, color),
+            makeNode(vec2(-halfSpacing, 0.f), 3, radius, mass, color)
+    };
+
+    addSpring(prefab, 0, 1, 0.92f);
+    addSpring(prefab, 1, 2, 0.92f);
+    addSpring(prefab, 2, 3, 0.92f);
+    addSpring(prefab, 3, 0, 0.92f);
+    addSpring(prefab, 0, 2, 0.95f);
+    addSpring(prefab, 1, 3, 0.95f);
+
+    return prefab;
+}
+
+Prefab prefab::softBody(int pairCount, float radius, float spacing, float mass, float stiffness)
+{
+    pairCount = std::max(pairCount, 3);
+    const rgba color = makeColor(240, 140, 70);
+
+    Prefab prefab;
+    prefab.nodes.reserve(pairCount * 2);
+    prefab.springs.reserve(pairCount * 5);
+
+    const float halfWidth = 0.5f * spacing * static_cast<float>(pairCount - 1);
+    const float halfHeight = spacing * 0.5f;
+
+    for (int i = 0; i < pairCount; ++i) {
+        const float x = static_cast<float>(i) * spacing - halfWidth;
+        prefab.nodes.push_back(makeNode(vec2(x, -halfHeight), static_cast<int>(prefab.nodes.size()), radius, mass, color));
+    }
+
+    for (int i = 0; i < pairCount; ++i) {
+        const float x = static_cast<float>(i) * spacing - halfWidth;
+        prefab.nodes.push_back(makeNode(vec2(x, halfHeight), static_cast<int>(prefab.nodes.size()), radius, mass, color));
+    }
+
+    const int topBase    = 0;
+    const int bottomBase = pairCount;
+
+    for (int i = 0; i < pairCount; ++i) {
+        const int next   = (i + 1) % pairCount;
+        const int ai     = topBase + i;
+        const int bi     = bottomBase + i;
+        const int anext  = topBase + next;
+        const int bnext  = bottomBase + next;
+
+        addSpring(prefab, ai, bi, stiffness);
+        addSpring(prefab, ai, anext, stiffness);
+        addSpring(prefab, bi, bnext, stiffness);
+        addSpring(prefab, ai, bnext, stiffness);
+        addSpring(prefab, bi, anext, stiffness);
+    }
+
+    return prefab;
+}
+
+Prefab prefab::shapeMatched(Prefab prefab, float stiffness, float linearDeformation)
+{
+    prefab.springs.clear();
+    prefab.shapeMatching = true;
+    prefab.shapeStiffness = std::clamp(stiffness, 0.f, 1.f);
+    prefab.linearDeformation = std::clamp(linearDeformation, 0.f, 1.f);
+    return prefab;
+}
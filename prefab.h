@@ -0,0 +1,65 @@
+#ifndef SOLVER_PREFAB_H
+#define SOLVER_PREFAB_H
+
+#include <vector>
+
+#include "physicalbody.h"
+#include "springlink.h"
+
+
+/**
+ * Precomputed layout of a compound object: the node positions are offsets from the origin of the prefab
+ * and the springs refer to the nodes by their index (aNode, bNode) with their rest length already computed.
+ * Building it once let us instantiate thousands of copies without recomputing the topology.
+ */
+struct Prefab
+{
+    std::vector<Sphere> nodes;
+    std::vector<SpringLink> springs;
+
+    bool shapeMatching      = false; // one shape matching constraint over all the nodes of each copy
+    float shapeStiffness    = 0.9f;
+    float linearDeformation = 0.f;
+};
+
+/**
+ * how the nodes of the clusters spawned by the context are held together
+ */
+enum class ClusterModel
+{
+    Springs,
+    ShapeMatching
+};
+
+/**
+ * placement of one instance of a prefab
+ */
+struct PrefabTransform
+{
+    vec2 position = vec2(0.f, 0.f);
+    float angle   = 0.f;               // rotation in radian around the origin of the prefab
+    vec2 velocity = vec2(0.f, 0.f);    // initial velocity of every node
+};
+
+namespace prefab
+{
+    /**
+     * square of 4 nodes held by 6 springs, the object spawned by "c"
+     */
+    [[nodiscard]] Prefab springCluster();
+
+    /**
+     * ring of pairCount pairs of nodes with 5 springs per pair, the object spawned by "s"
+     */
+    [[nodiscard]] Prefab softBody(int pairCount, float radius, float spacing, float mass, float stiffness);
+
+    /**
+     * same nodes but held by a single shape matching constraint, the springs are dropped
+     * @param prefab
+     * @param stiffness
+     * @param linearDeformation 0 = rigid, 1 = free linear deformation
+     */
+    [[nodiscard]] Prefab shapeMatched(Prefab prefab, float stiffness, float linearDeformation = 0.f);
+}
+
+#endif //SOLVER_PREFAB_H
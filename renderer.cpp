@@ -10,36 +10,62 @@ namespace
     constexpr QColor kConstraintStroke(0, 102, 255, 200);
     constexpr QColor kConstraintFill(0, 102, 255, 40);
 
-}
+    void drawDisc(QPainter &painter, const vec2 &position, float radius, rgba color)
+    {
+        const QColor qColor = renderer::toColor(color);
+        QPen pen(qColor, 3);
+        painter.setPen(pen);
+        painter.setBrush(QBrush(qColor));
+        painter.drawEllipse(renderer::toPoint(position), radius, radius);
+    }
 
-void renderer::render(QPainter &painter, const Context &context)
-{
-    const Grid &grid = context.grid();
-
-    for (const QVector<Sphere> &cell : grid.cells) {
-        for (const Sphere &sphere : cell) {
-            QPen pen(sphere.color, 3);
-            painter.setPen(pen);
-            painter.setBrush(QBrush(sphere.color));
-            painter.drawEllipse(sphere.position, sphere.radius, sphere.radius);
+    void drawShapes(QPainter &painter, const std::vector<framestate::Shape> &shapes)
+    {
+        QPen constraintPen(kConstraintStroke, 2);
+        constraintPen.setStyle(Qt::DashLine);
+        constraintPen.setCosmetic(true);//doesnt resize the line if the window is risize.
+        painter.setPen(constraintPen);
+        painter.setBrush(QBrush(kConstraintFill));
+
+        for (const framestate::Shape &shape : shapes) {
+            switch (shape.kind) {
+                case framestate::Shape::Segment: {
+                    // drawn with its own pen, the width is the thickness of the wall
+                    painter.save();
+                    QPen segmentPen(kConstraintStroke, std::max(1.f, 2.f * shape.width));
+                    segmentPen.setCapStyle(Qt::RoundCap);
+                    painter.setPen(segmentPen);
+                    painter.drawLine(renderer::toPoint(shape.a), renderer::toPoint(shape.b));
+                    painter.restore();
+                    break;
+                }
+                case framestate::Shape::Line:
+                    painter.drawLine(renderer::toPoint(shape.a), renderer::toPoint(shape.b));
+                    break;
+                case framestate::Shape::Circle:
+                    painter.drawEllipse(renderer::toPoint(shape.a), shape.width, shape.width);
+                    break;
+            }
         }
     }
+}
 
-    QPen constraintPen(kConstraintStroke, 2);
-    constraintPen.setStyle(Qt::DashLine);
-    constraintPen.setCosmetic(true);//doesnt resize the line if the window is risize.
-    painter.setPen(constraintPen);
-    painter.setBrush(QBrush(kConstraintFill));
-
-    for (const auto &constraint : context.constraints()) {
-        if (!constraint)
-            continue;
+void renderer::render(QPainter &painter, const Context &context)
+{
+    for (const Sphere &sphere : context.bodies())
+        drawDisc(painter, sphere.position, sphere.radius, sphere.color);
 
-        if (auto sphereConstraint = std::dynamic_pointer_cast<SphereConstraint>(constraint)) {
-            painter.drawEllipse(sphereConstraint->center(), sphereConstraint->radius(), sphereConstraint->radius());
-        } else if (auto bowlConstraint = std::dynamic_pointer_cast<BowlConstraint>(constraint)) {
-            painter.drawEllipse(bowlConstraint->center(), bowlConstraint->radius(), bowlConstraint->radius());
+    std::vector<framestate::Shape> shapes;
+    framestate::captureShapes(context, shapes);
+    drawShapes(painter, shapes);
+}
 
-        }
+void renderer::render(QPainter &painter, const framestate::Frame &frame)
+{
+    const rgba fallback = makeColor(0, 0, 255);
+    for (const framestate::Disc &disc : frame.discs) {
+        const rgba color = disc.color < frame.palette.size() ? frame.palette[disc.color] : fallback;
+        drawDisc(painter, disc.position, disc.radius, color);
     }
-}
\ No newline at end of file
+    drawShapes(painter, frame.shapes);
+}
@@ -6,24 +6,43 @@
 #define SOLVER_RENDERER_H
 
 #include "context.h"
+#include "framestate.h"
 #include "grid.h"
 #include "constraints.h"
+#include "sdfconstraint.h"
 #include "physicalbody.h"
 
 #include <QPainter>
 #include <QPen>
 #include <QBrush>
+#include <QColor>
+#include <QPointF>
 #include <memory>
 
 
 namespace renderer
 {
+    /**
+     * conversion between the types of the simulation and the types of Qt, only done at drawing time
+     */
+    inline QPointF toPoint(const vec2 &v) { return {v.x, v.y}; }
+    inline vec2 toVec2(const QPointF &p) { return {static_cast<float>(p.x()), static_cast<float>(p.y())}; }
+    inline QColor toColor(rgba color) { return QColor::fromRgba(color); }
+
     /**
      * render the simulation each iteration
      * @param painter
      * @param context owner of the grid
      */
     void render(QPainter &painter, const Context &context) ;
+
+    /**
+     * render a frame captured from a context, possibly in another process (see framestream.h).
+     * The picture is the same as the one of the context it was captured from
+     * @param painter
+     * @param frame
+     */
+    void render(QPainter &painter, const framestate::Frame &frame);
 };
 
 
@@ -0,0 +1,147 @@
+#include "reorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+
+namespace
+{
+    constexpr int kSubCellBits = 8;           // resolution of the key inside a cell: 256 x 256
+    constexpr double kCellOffset = 1 << 23;   // cell coordinates can be negative, shift them to stay unsigned
+
+    /**
+     * spread the 32 bits of value on the even bits of a 64 bits word
+     */
+    std::uint64_t spreadBits(std::uint32_t value)
+    {
+        std::uint64_t x = value;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8))  & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2))  & 0x3333333333333333ull;
+        x = (x | (x << 1))  & 0x5555555555555555ull;
+        return x;
+    }
+
+    std::uint32_t quantize(double value, float cellSize)
+    {
+        const double scaled = (value / static_cast<double>(cellSize) + kCellOffset) * static_cast<double>(1 << kSubCellBits);
+        return static_cast<std::uint32_t>(std::clamp(scaled, 0.0, 4294967295.0));
+    }
+}
+
+std::uint64_t reorder::mortonCode(std::uint32_t x, std::uint32_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+void reorder::reserve(Scratch &scratch, int sphereCount, int springCount)
+{
+    scratch.keys.reserve(sphereCount);
+    scratch.order.reserve(sphereCount);
+    scratch.newIndex.reserve(sphereCount);
+    scratch.bodies.reserve(sphereCount);
+    scratch.bodyHandle.reserve(sphereCount);
+    scratch.springOrder.reserve(springCount);
+    scratch.springs.reserve(springCount);
+}
+
+void reorder::mortonOrder(const Grid &grid, Scratch &scratch)
+{
+    const int count = grid.bodyCount();
+    std::vector<std::uint64_t> &keys = scratch.keys;
+    keys.resize(count);
+
+    const float cellSize = grid.cellSize();
+
+    // the high bits of the quantized coordinate are the cell coordinates, so a cell is a contiguous range of keys
+    for (int i = 0; i < count; ++i) {
+        const vec2 &position = grid.bodies[i].position;
+        keys[i] = mortonCode(quantize(position.x, cellSize), quantize(position.y, cellSize));
+    }
+
+    // equal keys keep their order, as a stable sort would without its temporary buffer
+    scratch.order.resize(count);
+    std::iota(scratch.order.begin(), scratch.order.end(), 0);
+    std::sort(scratch.order.begin(), scratch.order.end(), [&keys](int a, int b) {
+        return keys[a] != keys[b] ? keys[a] < keys[b] : a < b;
+    });
+}
+
+void reorder::applyOrder(Grid &grid, std::vector<SpringLink> &springLinks, Scratch &scratch)
+{
+    const int count = grid.bodyCount();
+    const std::vector<int> &order = scratch.order;
+    std::vector<int> &newIndex = scratch.newIndex;
+    newIndex.assign(count, -1);
+    if (static_cast<int>(order.size()) != count)
+        return;
+
+    std::vector<Sphere> &bodies = scratch.bodies;
+    bodies.clear();
+    std::vector<int> &bodyHandle = scratch.bodyHandle;
+    bodyHandle.assign(count, -1);
+
+    for (int i = 0; i < count; ++i) {
+        const int oldIndex = order[i];
+        bodies.push_back(grid.bodies[oldIndex]);
+        newIndex[oldIndex] = i;
+        if (oldIndex < static_cast<int>(grid.bodyHandle.size()))
+            bodyHandle[i] = grid.bodyHandle[oldIndex];
+    }
+
+    // the previous storage becomes the scratch of the next reordering
+    grid.bodies.swap(bodies);
+    grid.bodyHandle.swap(bodyHandle);
+
+    for (int &index : grid.handleIndex) {
+        if (index >= 0 && index < count)
+            index = newIndex[index];
+    }
+
+    for (std::vector<int> &cell : grid.cells) {
+        for (int &index : cell)
+            index = newIndex[index];
+    }
+
+    for (SpringLink &spring : springLinks) {
+        if (spring.a >= 0 && spring.a < count)
+            spring.a = newIndex[spring.a];
+        if (spring.b >= 0 && spring.b < count)
+            spring.b = newIndex[spring.b];
+    }
+
+    // springs of a same first endpoint keep their order
+    std::vector<int> &springOrder = scratch.springOrder;
+    springOrder.resize(springLinks.size());
+    std::iota(springOrder.begin(), springOrder.end(), 0);
+    std::sort(springOrder.begin(), springOrder.end(), [&springLinks](int l, int r) {
+        const int left = std::min(springLinks[l].a, springLinks[l].b);
+        const int right = std::min(springLinks[r].a, springLinks[r].b);
+        return left != right ? left < right : l < r;
+    });
+    scratch.springs.clear();
+    for (int index : springOrder)
+        scratch.springs.push_back(springLinks[index]);
+    springLinks.swap(scratch.springs);
+}
+
+double reorder::meanPairSpan(const std::vector<ContactPair> &pairs, const std::vector<int> *newIndex)
+{
+    if (pairs.empty())
+        return 0.0;
+
+    double total = 0.0;
+    for (const ContactPair &pair : pairs) {
+        int a = pair.a;
+        int b = pair.b;
+        if (newIndex) {
+            const int count = static_cast<int>(newIndex->size());
+            a = a >= 0 && a < count ? (*newIndex)[a] : a;
+            b = b >= 0 && b < count ? (*newIndex)[b] : b;
+        }
+        total += std::abs(a - b);
+    }
+    return total / static_cast<double>(pairs.size());
+}
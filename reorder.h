@@ -0,0 +1,64 @@
+#ifndef SOLVER_REORDER_H
+#define SOLVER_REORDER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "grid.h"
+#include "springlink.h"
+#include "contactlist.h"
+
+
+/**
+ * Reorder the storage of the spheres along a Z-order (Morton) curve so that spheres close in space
+ * are close in memory. Contact pairs and springs then read neighbor cache lines instead of random ones.
+ */
+namespace reorder
+{
+    /**
+     * interleave the bits of x and y (x on even bits)
+     */
+    [[nodiscard]] std::uint64_t mortonCode(std::uint32_t x, std::uint32_t y);
+
+    /**
+     * buffers of a reordering, kept by the caller to reuse their memory
+     */
+    struct Scratch
+    {
+        std::vector<std::uint64_t> keys;
+        std::vector<int> order;    // order[newIndex] = oldIndex
+        std::vector<int> newIndex; // new index of each old index, -1 if the order did not match the storage
+        std::vector<Sphere> bodies;
+        std::vector<int> bodyHandle;
+        std::vector<int> springOrder;
+        std::vector<SpringLink> springs;
+    };
+
+    /**
+     * grow the buffers so that reordering this many spheres and springs does not allocate
+     */
+    void reserve(Scratch &scratch, int sphereCount, int springCount);
+
+    /**
+     * compute the new order of the spheres in scratch.order. The key is the Morton code of the cell coordinates,
+     * refined inside the cell so that spheres of a same cell stay contiguous.
+     * @param grid
+     * @param scratch
+     */
+    void mortonOrder(const Grid &grid, Scratch &scratch);
+
+    /**
+     * move the spheres according to scratch.order, remap the handles and the spring endpoints and fill
+     * scratch.newIndex. springs are sorted by their first endpoint so the spring pass walk the storage forward
+     */
+    void applyOrder(Grid &grid, std::vector<SpringLink> &springLinks, Scratch &scratch);
+
+    /**
+     * mean distance in the storage between the two spheres of a pair, the lower the better
+     * @param pairs
+     * @param newIndex optional remapping applied to the pairs before measuring
+     */
+    [[nodiscard]] double meanPairSpan(const std::vector<ContactPair> &pairs, const std::vector<int> *newIndex = nullptr);
+}
+
+#endif //SOLVER_REORDER_H
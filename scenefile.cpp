@@ -0,0 +1,171 @@
+#include "scenefile.h"
+#include "sdfconstraint.h"
+
+#include <fstream>
+#include <sstream>
+
+
+namespace
+{
+    bool fail(std::string *error, int line, const std::string &message)
+    {
+        if (error)
+            *error = "line " + std::to_string(line) + ": " + message;
+        return false;
+    }
+}
+
+bool scenefile::parseObstacles(std::istream &in, std::vector<std::shared_ptr<StaticConstraint>> &obstacles, std::string *error,
+                               const std::string &directory)
+{
+    std::string text;
+    int lineNumber = 0;
+
+    // polylines of the sdf block being read
+    bool inSdf = false;
+    float sdfCellSize = 0.f;
+    float sdfThickness = 0.f;
+    std::vector<std::vector<vec2>> polylines;
+
+    while (std::getline(in, text)) {
+        ++lineNumber;
+        const std::size_t comment = text.find('#');
+        if (comment != std::string::npos)
+            text.erase(comment);
+
+        std::istringstream line(text);
+        std::string kind;
+        if (!(line >> kind))
+            continue;
+
+        float v[4] = {0.f, 0.f, 0.f, 0.f};
+        auto read = [&line, &v](int count) {
+            for (int i = 0; i < count; ++i) {
+                if (!(line >> v[i]))
+                    return false;
+            }
+            return true;
+        };
+
+        if (inSdf) {
+            if (kind == "end") {
+                obstacles.push_back(SdfConstraint::fromPolylines(polylines, sdfCellSize, sdfThickness));
+                polylines.clear();
+                inSdf = false;
+            } else if (kind == "polyline") {
+                std::vector<vec2> polyline;
+                float x, y;
+                bool pairs = true;
+                while (pairs && line >> x) {
+                    pairs = static_cast<bool>(line >> y);
+                    polyline.emplace_back(x, y);
+                }
+                // a bad token or a lone coordinate stops the read before the end of the line
+                if (!pairs || !line.eof() || polyline.size() < 2)
+                    return fail(error, lineNumber, "polyline expects at least 2 x y pairs");
+                polylines.push_back(std::move(polyline));
+            } else {
+                return fail(error, lineNumber, "only polyline and end are allowed in a sdf block");
+            }
+        } else if (kind == "sdf") {
+            if (!read(1) || v[0] <= 0.f)
+                return fail(error, lineNumber, "sdf expects a positive cellSize");
+            sdfCellSize = v[0];
+            sdfThickness = 0.f;
+            line >> sdfThickness;
+            inSdf = true;
+        } else if (kind == "sdf_image") {
+            std::string file;
+            if (!(line >> file) || !read(3) || v[2] <= 0.f)
+                return fail(error, lineNumber, "sdf_image expects file ox oy pixelSize");
+            if (!directory.empty() && file.front() != '/')
+                file = directory + "/" + file;
+
+            std::vector<std::uint8_t> pixels;
+            int width = 0, height = 0;
+            if (!loadPgm(file, pixels, width, height))
+                return fail(error, lineNumber, "cannot read the PGM image " + file);
+            obstacles.push_back(SdfConstraint::fromMask(pixels, width, height, vec2(v[0], v[1]), v[2]));
+        } else if (kind == "plane") {
+            if (!read(3))
+                return fail(error, lineNumber, "plane expects nx ny distance");
+            obstacles.push_back(std::make_shared<PlaneConstraint>(vec2(v[0], v[1]), v[2]));
+        } else if (kind == "sphere") {
+            if (!read(3))
+                return fail(error, lineNumber, "sphere expects cx cy radius");
+            obstacles.push_back(std::make_shared<SphereConstraint>(vec2(v[0], v[1]), v[2]));
+        } else if (kind == "bowl") {
+            if (!read(3))
+                return fail(error, lineNumber, "bowl expects cx cy radius");
+            obstacles.push_back(std::make_shared<BowlConstraint>(vec2(v[0], v[1]), v[2]));
+        } else if (kind == "segment") {
+            if (!read(4))
+                return fail(error, lineNumber, "segment expects ax ay bx by [thickness]");
+            float thickness = 0.f;
+            line >> thickness;
+            obstacles.push_back(std::make_shared<SegmentConstraint>(vec2(v[0], v[1]), vec2(v[2], v[3]), thickness));
+        } else {
+            return fail(error, lineNumber, "unknown obstacle '" + kind + "'");
+        }
+    }
+
+    if (inSdf)
+        return fail(error, lineNumber, "sdf block without end");
+    return true;
+}
+
+bool scenefile::loadObstacles(const std::string &path, std::vector<std::shared_ptr<StaticConstraint>> &obstacles, std::string *error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot open " + path;
+        return false;
+    }
+    const std::size_t slash = path.find_last_of('/');
+    return parseObstacles(file, obstacles, error, slash == std::string::npos ? std::string() : path.substr(0, slash));
+}
+
+bool scenefile::loadPgm(const std::string &path, std::vector<std::uint8_t> &pixels, int &width, int &height)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    if (!(file >> magic) || (magic != "P5" && magic != "P2"))
+        return false;
+
+    // header fields can be separated by comments
+    int header[3] = {0, 0, 0};
+    for (int &field : header) {
+        while (file >> std::ws && file.peek() == '#') {
+            std::string comment;
+            std::getline(file, comment);
+        }
+        if (!(file >> field))
+            return false;
+    }
+    width = header[0];
+    height = header[1];
+    const int maxValue = header[2];
+    if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255)
+        return false;
+
+    pixels.resize(static_cast<std::size_t>(width) * height);
+    if (magic == "P5") {
+        file.get(); // single whitespace before the data
+        file.read(reinterpret_cast<char *>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+        if (file.gcount() != static_cast<std::streamsize>(pixels.size()))
+            return false;
+    } else {
+        for (std::uint8_t &pixel : pixels) {
+            int value;
+            if (!(file >> value))
+                return false;
+            pixel = static_cast<std::uint8_t>(value);
+        }
+    }
+
+    if (maxValue != 255) {
+        for (std::uint8_t &pixel : pixels) pixel = static_cast<std::uint8_t>(pixel * 255 / maxValue);
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef SOLVER_SCENEFILE_H
+#define SOLVER_SCENEFILE_H
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "constraints.h"
+
+
+/**
+ * Text format for the static obstacles of a level, one obstacle per line:
+ *
+ *     # comment
+ *     plane   nx ny distance          dot(X, n) >= distance
+ *     sphere  cx cy radius
+ *     bowl    cx cy radius
+ *     segment ax ay bx by [thickness]
+ *
+ *     sdf cellSize [thickness]        signed distance field baked from the polylines until "end",
+ *     polyline x0 y0 x1 y1 ...        a polyline ending on its first point is a solid polygon
+ *     end
+ *
+ *     sdf_image file.pgm ox oy pixelSize   field baked from a grayscale PGM, dark pixels are solid
+ *
+ * Blank lines and anything after a '#' are ignored. Image paths are relative to the scene file.
+ */
+namespace scenefile
+{
+    /**
+     * parse the obstacles of a stream and append them to obstacles
+     * @param error message with the line number of the first bad line, can be nullptr
+     * @return false if a line could not be parsed, the obstacles read before it are kept
+     */
+    bool parseObstacles(std::istream &in, std::vector<std::shared_ptr<StaticConstraint>> &obstacles, std::string *error = nullptr,
+                        const std::string &directory = std::string());
+
+    /**
+     * read a binary (P5) or ascii (P2) PGM image, 8 bits per pixel
+     * @return false if the file is not a PGM image
+     */
+    bool loadPgm(const std::string &path, std::vector<std::uint8_t> &pixels, int &width, int &height);
+
+    /**
+     * same as parseObstacles on the content of a file
+     */
+    bool loadObstacles(const std::string &path, std::vector<std::shared_ptr<StaticConstraint>> &obstacles, std::string *error = nullptr);
+}
+
+#endif //SOLVER_SCENEFILE_H
@@ -0,0 +1,239 @@
+#include "sdfconstraint.h"
+#include "multithreading.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+    constexpr float kFar = 1e20f;
+
+    float segmentDistance(const vec2 &p, const vec2 &a, const vec2 &b)
+    {
+        const vec2 ab = b - a;
+        const float lengthSquared = ab.lengthSquared();
+        const float t = lengthSquared > 0.f ? std::clamp(dot(p - a, ab) / lengthSquared, 0.f, 1.f) : 0.f;
+        return (p - (a + ab * t)).length();
+    }
+
+    /**
+     * squared euclidean distance transform of a line (Felzenszwalb and Huttenlocher)
+     * @param f squared distance of each sample, 0 on the features and kFar elsewhere
+     * @param d output
+     */
+    void distanceTransform1d(const float *f, int n, float *d, std::vector<int> &v, std::vector<float> &z)
+    {
+        v.resize(n);
+        z.resize(n + 1);
+        int k = 0;
+        v[0] = 0;
+        z[0] = -kFar;
+        z[1] = kFar;
+
+        for (int q = 1; q < n; ++q) {
+            float s;
+            while (true) {
+                const int r = v[k];
+                s = ((f[q] + static_cast<float>(q * q)) - (f[r] + static_cast<float>(r * r))) / static_cast<float>(2 * q - 2 * r);
+                if (s > z[k] || k == 0)
+                    break;
+                --k;
+            }
+            if (s <= z[k]) {
+                // k == 0 and the parabola of q hide the first one completely
+                v[0] = q;
+                z[0] = -kFar;
+                z[1] = kFar;
+                continue;
+            }
+            ++k;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = kFar;
+        }
+
+        k = 0;
+        for (int q = 0; q < n; ++q) {
+            while (z[k + 1] < static_cast<float>(q)) ++k;
+            const int r = v[k];
+            d[q] = static_cast<float>((q - r) * (q - r)) + f[r];
+        }
+    }
+
+    /**
+     * squared distance of each pixel to the closest pixel where features is true
+     */
+    std::vector<float> distanceTransform(const std::vector<bool> &features, int width, int height)
+    {
+        std::vector<float> grid(static_cast<std::size_t>(width) * height);
+        for (std::size_t i = 0; i < grid.size(); ++i) grid[i] = features[i] ? 0.f : kFar;
+
+        std::vector<float> line(std::max(width, height));
+        std::vector<float> out(line.size());
+        std::vector<int> v;
+        std::vector<float> z;
+
+        for (int x = 0; x < width; ++x) {
+            for (int y = 0; y < height; ++y) line[y] = grid[y * width + x];
+            distanceTransform1d(line.data(), height, out.data(), v, z);
+            for (int y = 0; y < height; ++y) grid[y * width + x] = out[y];
+        }
+        for (int y = 0; y < height; ++y) {
+            distanceTransform1d(&grid[y * width], width, out.data(), v, z);
+            std::copy(out.begin(), out.begin() + width, grid.begin() + y * width);
+        }
+        return grid;
+    }
+}
+
+std::shared_ptr<SdfConstraint> SdfConstraint::fromPolylines(const std::vector<std::vector<vec2>> &polylines,
+                                                            float cellSize, float thickness, float margin)
+{
+    auto sdf = std::make_shared<SdfConstraint>();
+    sdf->m_outline = polylines;
+
+    box2 region;
+    for (const auto &polyline : polylines) {
+        for (const vec2 &p : polyline) region.expand(box2(p, p));
+    }
+    if (region.isEmpty() || cellSize <= 0.f)
+        return sdf;
+
+    const float grow = std::max(0.f, thickness) + std::max(0.f, margin);
+    region = box2(region.min - vec2(grow, grow), region.max + vec2(grow, grow));
+
+    sdf->m_cellSize = cellSize;
+    sdf->m_origin = region.min;
+    // sample interpolates between 2 x 2 samples, a flat region (a horizontal segment, a point) still gets them
+    sdf->m_width  = std::max(2, static_cast<int>(std::ceil(region.extent().x / cellSize)) + 1);
+    sdf->m_height = std::max(2, static_cast<int>(std::ceil(region.extent().y / cellSize)) + 1);
+    sdf->m_distances.assign(static_cast<std::size_t>(sdf->m_width) * sdf->m_height, kFar);
+    sdf->m_bounds = box2(sdf->m_origin, sdf->m_origin + vec2(static_cast<float>(sdf->m_width - 1),
+                                                             static_cast<float>(sdf->m_height - 1)) * cellSize);
+
+    SdfConstraint &field = *sdf;
+    multithreading::forEachRange(field.m_height, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int x = 0; x < field.m_width; ++x) {
+                const vec2 p = field.m_origin + vec2(static_cast<float>(x), static_cast<float>(y)) * cellSize;
+                float unsignedDistance = kFar;
+                bool inside = false;
+
+                for (const auto &polyline : polylines) {
+                    const std::size_t count = polyline.size();
+                    if (count == 1)
+                        unsignedDistance = std::min(unsignedDistance, (p - polyline[0]).length());
+                    for (std::size_t i = 0; i + 1 < count; ++i)
+                        unsignedDistance = std::min(unsignedDistance, segmentDistance(p, polyline[i], polyline[i + 1]));
+
+                    // even odd rule on the closed polylines
+                    if (count > 2 && polyline.front() == polyline.back()) {
+                        for (std::size_t i = 0; i + 1 < count; ++i) {
+                            const vec2 &a = polyline[i];
+                            const vec2 &b = polyline[i + 1];
+                            if ((a.y > p.y) != (b.y > p.y)
+                                && p.x < a.x + (p.y - a.y) * (b.x - a.x) / (b.y - a.y))
+                                inside = !inside;
+                        }
+                    }
+                }
+
+                field.m_distances[y * field.m_width + x] = (inside ? -unsignedDistance : unsignedDistance) - thickness;
+            }
+        }
+    });
+    return sdf;
+}
+
+std::shared_ptr<SdfConstraint> SdfConstraint::fromMask(const std::vector<std::uint8_t> &mask, int width, int height,
+                                                       const vec2 &origin, float pixelSize, std::uint8_t threshold,
+                                                       float margin)
+{
+    auto sdf = std::make_shared<SdfConstraint>();
+    if (width < 2 || height < 2 || pixelSize <= 0.f || mask.size() < static_cast<std::size_t>(width) * height)
+        return sdf;
+
+    // the image is framed by free pixels, a solid touching the border can then be left from the outside,
+    // and a sphere moving fast toward a thin wall is seen before it crosses it
+    const int pad = std::max(2, static_cast<int>(std::ceil(std::max(0.f, margin) / pixelSize)));
+    const int paddedWidth = width + 2 * pad;
+    const int paddedHeight = height + 2 * pad;
+    const std::size_t count = static_cast<std::size_t>(paddedWidth) * paddedHeight;
+    std::vector<bool> solid(count, false);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x)
+            solid[(y + pad) * paddedWidth + x + pad] = mask[y * width + x] < threshold;
+    }
+    std::vector<bool> free(count);
+    for (std::size_t i = 0; i < count; ++i) free[i] = !solid[i];
+
+    const std::vector<float> toSolid = distanceTransform(solid, paddedWidth, paddedHeight);
+    const std::vector<float> toFree = distanceTransform(free, paddedWidth, paddedHeight);
+
+    // samples are the pixel centers, the boundary is half a pixel away from the last solid one
+    width = paddedWidth;
+    height = paddedHeight;
+    sdf->m_cellSize = pixelSize;
+    sdf->m_origin = origin + vec2(0.5f - static_cast<float>(pad), 0.5f - static_cast<float>(pad)) * pixelSize;
+    sdf->m_width = width;
+    sdf->m_height = height;
+    sdf->m_distances.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const float d = solid[i] ? -(std::sqrt(toFree[i]) - 0.5f) : std::sqrt(toSolid[i]) - 0.5f;
+        sdf->m_distances[i] = std::min(d, kFar) * pixelSize;
+    }
+    sdf->m_bounds = box2(sdf->m_origin, sdf->m_origin + vec2(static_cast<float>(width - 1),
+                                                             static_cast<float>(height - 1)) * pixelSize);
+    return sdf;
+}
+
+bool SdfConstraint::sample(const vec2 &position, float &distance, vec2 &gradient) const
+{
+    if (m_distances.empty() || !m_bounds.contains(position))
+        return false;
+
+    const float gx = (position.x - m_origin.x) / m_cellSize;
+    const float gy = (position.y - m_origin.y) / m_cellSize;
+    const int x = std::clamp(static_cast<int>(gx), 0, m_width - 2);
+    const int y = std::clamp(static_cast<int>(gy), 0, m_height - 2);
+    const float tx = gx - static_cast<float>(x);
+    const float ty = gy - static_cast<float>(y);
+
+    const float *row = &m_distances[y * m_width + x];
+    const float d00 = row[0];
+    const float d10 = row[1];
+    const float d01 = row[m_width];
+    const float d11 = row[m_width + 1];
+
+    distance = (1.f - ty) * ((1.f - tx) * d00 + tx * d10) + ty * ((1.f - tx) * d01 + tx * d11);
+    gradient = vec2((1.f - ty) * (d10 - d00) + ty * (d11 - d01),
+                    (1.f - tx) * (d01 - d00) + tx * (d11 - d10)) / m_cellSize;
+    return true;
+}
+
+float SdfConstraint::distance(const vec2 &position) const
+{
+    float d;
+    vec2 gradient;
+    return sample(position, d, gradient) ? d : kFar;
+}
+
+float SdfConstraint::project(Sphere &sphere) const
+{
+    if (sphere.invMass <= 0.f)
+        return 0.f;
+
+    float d;
+    vec2 gradient;
+    if (!sample(sphere.position, d, gradient) || d >= sphere.radius)
+        return 0.f;
+
+    const float length = gradient.length();
+    if (length < 1e-6f)
+        return 0.f;
+
+    const float penetration = sphere.radius - d;
+    sphere.position += gradient / length * penetration;
+    return penetration;
+}
@@ -0,0 +1,77 @@
+#ifndef SOLVER_SDFCONSTRAINT_H
+#define SOLVER_SDFCONSTRAINT_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "constraints.h"
+
+
+/**
+ * Static boundary of any shape stored as a grid of signed distances (negative inside the solid).
+ * It is baked once from polylines or from an image, then the projection is a bilinear lookup of the
+ * distance and of its gradient, so the cost per sphere does not depend on the complexity of the shape.
+ */
+class SdfConstraint : public StaticConstraint
+{
+public:
+    SdfConstraint() = default;
+
+    /**
+     * bake the field around polylines. A closed polyline (last point equal to the first) is a solid polygon,
+     * an open one is a wall. Both are grown by thickness.
+     * @param polylines
+     * @param cellSize distance between two samples, the shape is smoothed below this size
+     * @param thickness
+     * @param margin free space kept around the shape, spheres further than that are ignored
+     */
+    static std::shared_ptr<SdfConstraint> fromPolylines(const std::vector<std::vector<vec2>> &polylines,
+                                                        float cellSize, float thickness = 0.f, float margin = 64.f);
+
+    /**
+     * bake the field of a mask, one sample per pixel
+     * @param mask row major pixels, a pixel is solid when its value is below threshold (dark is solid)
+     * @param width
+     * @param height
+     * @param origin position of the top left pixel in the scene
+     * @param pixelSize size of a pixel in the scene
+     * @param threshold
+     * @param margin free space kept around the image, spheres further than that are ignored
+     */
+    static std::shared_ptr<SdfConstraint> fromMask(const std::vector<std::uint8_t> &mask, int width, int height,
+                                                   const vec2 &origin, float pixelSize, std::uint8_t threshold = 128,
+                                                   float margin = 64.f);
+
+    /**
+     * push the sphere out of the solid along the gradient of the field
+     * @param sphere
+     */
+    float project(Sphere &sphere) const override;
+
+    [[nodiscard]] box2 bounds() const override { return m_bounds; }
+
+    /**
+     * bilinear interpolation of the distance, +infinity outside of the field
+     */
+    [[nodiscard]] float distance(const vec2 &position) const;
+
+    [[nodiscard]] const std::vector<std::vector<vec2>> &outline() const { return m_outline; }
+
+private:
+    /**
+     * distance and gradient at position
+     * @return false outside of the field
+     */
+    bool sample(const vec2 &position, float &distance, vec2 &gradient) const;
+
+    vec2 m_origin = vec2(0.f, 0.f);
+    float m_cellSize = 1.f;
+    int m_width = 0;   // number of samples along x
+    int m_height = 0;  // number of samples along y
+    std::vector<float> m_distances;
+    box2 m_bounds;
+    std::vector<std::vector<vec2>> m_outline; // source polylines, for drawing
+};
+
+#endif //SOLVER_SDFCONSTRAINT_H
@@ -0,0 +1,47 @@
+#include "shapecluster.h"
+
+#include <cmath>
+
+
+namespace
+{
+    constexpr float kPinnedWeight = 1e6f;
+}
+
+void ShapeCluster::setRestShape(const std::vector<vec2> &positions, const std::vector<float> &invMasses)
+{
+    const std::size_t count = positions.size();
+    weights.resize(count);
+    restShape.resize(count);
+
+    totalWeight = 0.f;
+    vec2 center;
+    for (std::size_t i = 0; i < count; ++i) {
+        const float invMass = i < invMasses.size() ? invMasses[i] : 1.f;
+        weights[i] = invMass > 0.f ? 1.f / invMass : kPinnedWeight;
+        totalWeight += weights[i];
+        center += positions[i] * weights[i];
+    }
+    if (totalWeight > 0.f)
+        center /= totalWeight;
+
+    float xx = 0.f, xy = 0.f, yy = 0.f;
+    for (std::size_t i = 0; i < count; ++i) {
+        const vec2 q = positions[i] - center;
+        restShape[i] = q;
+        xx += weights[i] * q.x * q.x;
+        xy += weights[i] * q.x * q.y;
+        yy += weights[i] * q.y * q.y;
+    }
+
+    // a line of nodes has no inverse, the linear mode then fall back to the rotation
+    const float det = xx * yy - xy * xy;
+    if (std::abs(det) > 1e-6f) {
+        invAqq[0] =  yy / det;
+        invAqq[1] = -xy / det;
+        invAqq[2] = -xy / det;
+        invAqq[3] =  xx / det;
+    } else {
+        invAqq[0] = invAqq[1] = invAqq[2] = invAqq[3] = 0.f;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SOLVER_SHAPECLUSTER_H
+#define SOLVER_SHAPECLUSTER_H
+
+#include <vector>
+
+#include "vec2.h"
+
+
+/**
+ * Meshless shape matching (Müller et al. 2005): the nodes of a cluster are pulled toward the rest shape
+ * moved by the best fit rotation (and optionally linear deformation) of their current positions.
+ * One constraint per cluster replace the springs, it is solved in O(nodes) and does not need more
+ * iterations when the body is large.
+ */
+struct ShapeCluster
+{
+    int groupId = -1;
+    std::vector<int> bodies;        // index in Grid::bodies of each node
+    std::vector<vec2> restShape;    // rest position of each node relative to the rest center of mass
+    std::vector<float> weights;     // mass of each node, pinned nodes get a very large one
+    float totalWeight = 0.f;
+
+    float stiffness         = 0.9f;
+    float linearDeformation = 0.f;  // 0 = rigid, 1 = free linear deformation (stretch and shear)
+
+    // inverse of sum(m q q^T), row major. only used when linearDeformation > 0
+    float invAqq[4] = {0.f, 0.f, 0.f, 0.f};
+
+    /**
+     * set the rest shape, positions are recentered on their center of mass
+     * @param positions rest position of each node, in the same order as bodies
+     * @param invMasses inverse mass of each node
+     */
+    void setRestShape(const std::vector<vec2> &positions, const std::vector<float> &invMasses);
+
+    [[nodiscard]] int size() const { return static_cast<int>(bodies.size()); }
+};
+
+#endif //SOLVER_SHAPECLUSTER_H
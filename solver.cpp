@@ -3,90 +3,420 @@
 //
 
 #include "solver.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
 
 
 namespace
 {
-    constexpr QVector2D kGravity(0.f, 1200.f);
+    constexpr vec2 kGravity(0.f, 1200.f);
     //constexpr unsigned int kSubsteps = 4;
-    //constexpr QVector2D kGravity(0.f, 600.f);
-    //constexpr QVector2D kGravity(0.f, 400.f);
+    //constexpr vec2 kGravity(0.f, 600.f);
+    //constexpr vec2 kGravity(0.f, 400.f);
 
-    void resolveSpherePair(Sphere &a, Sphere &b)
+    /**
+     * position of the sphere at the beginning of the substep, static spheres are never integrated
+     */
+    vec2 startPosition(const Sphere &sphere)
     {
-        auto delta = QVector2D(b.position - a.position);
-        float dist = delta.length();
-        float minDist = a.radius + b.radius;
+        return sphere.invMass > 0.f ? sphere.prevPosition : sphere.position;
+    }
 
-        if (dist >= minDist)
-            return;
+    /**
+     * speculative contact: find the first time the relative path of the spheres over the substep reach the
+     * contact distance and keep them on that side of the contact plane. A pair that crossed or went deep into
+     * each other during the substep is pushed back to the point of impact, a pair that was already touching
+     * at the beginning of the substep is separated along its initial normal so it can not be pushed through
+     * @return the correction applied, 0 if their paths do not meet during the substep
+     */
+    float resolveSpeculativePair(Sphere &a, Sphere &b)
+    {
+        const float totalInvMass = a.invMass + b.invMass;
+        if (totalInvMass <= 0.f)
+            return 0.f;
+
+        const vec2 start = startPosition(b) - startPosition(a);
+        const vec2 delta = b.position - a.position;
+        const float minDist = a.radius + b.radius;
+        const float c = start.lengthSquared() - minDist * minDist;
+
+        vec2 impact = start;
+        if (c > 0.f) {
+            // |start + t * motion| = minDist, first root in [0, 1]
+            const vec2 motion = delta - start;
+            const float halfB = dot(start, motion);
+            if (halfB >= 0.f)
+                return 0.f; // moving apart
 
-        if (dist < 1e-6f) {
-            delta = QVector2D(1.f, 0.f);
-            dist = 1.f;
+            const float quadA = motion.lengthSquared();
+            const float discriminant = halfB * halfB - quadA * c;
+            if (discriminant < 0.f)
+                return 0.f;
+
+            const float t = (-halfB - std::sqrt(discriminant)) / quadA;
+            if (t > 1.f)
+                return 0.f;
+            impact = start + motion * t;
         }
 
-        float totalInvMass = a.invMass + b.invMass;
-        if (totalInvMass <= 0.f)
-            return;
+        const float impactLength = impact.length();
+        if (impactLength < 1e-6f)
+            return solver::resolveSpherePair(a, b);
 
-        float penetration = minDist - dist;
-        QVector2D normal = delta / dist;
-        QVector2D correction = normal * penetration;
+        const vec2 normal = impact / impactLength;
+        const float penetration = minDist - dot(delta, normal);
+        if (penetration <= 0.f)
+            return 0.f;
 
-        float shareA = a.invMass / totalInvMass;
-        float shareB = b.invMass / totalInvMass;
+        const vec2 correction = normal * penetration;
+        a.position -= correction * (a.invMass / totalInvMass);
+        b.position += correction * (b.invMass / totalInvMass);
+        return penetration;
+    }
 
-        a.position -= QPointF(correction.x() * shareA, correction.y() * shareA);
-        b.position += QPointF(correction.x() * shareB, correction.y() * shareB);
+    void integrate(Sphere &sphere, float dt)
+    {
+        sphere.velocity += kGravity * dt;
+        sphere.prevPosition = sphere.position;
+        sphere.position += sphere.velocity * dt;
     }
 
-    Sphere *findSphereNode(Grid &grid, int groupId, int nodeIndex)
+    /**
+     * true if the two spheres are closer than the sum of their radius plus their margins
+     */
+    bool isContactCandidate(const Sphere &a, const Sphere &b, float marginA, float marginB)
     {
-        for (QVector<Sphere> &cell : grid.cells) {
-            for (Sphere &sphere : cell) {
-                if (sphere.groupId == groupId && sphere.nodeIndex == nodeIndex) {
-                    return &sphere;
-                }
+        const float reach = a.radius + b.radius + marginA + marginB;
+        return (b.position - a.position).lengthSquared() < reach * reach;
+    }
+
+    /**
+     * collision filter of a sphere in one word: layers, mask, ignore group flag, group + 1
+     */
+    std::uint64_t filterKey(const Sphere &sphere)
+    {
+        return static_cast<std::uint64_t>(sphere.filter.layers)
+               | static_cast<std::uint64_t>(sphere.filter.mask) << 16
+               | static_cast<std::uint64_t>(sphere.filter.ignoreGroup ? 1 : 0) << 32
+               | static_cast<std::uint64_t>(static_cast<std::uint32_t>(sphere.groupId + 1)) << 33;
+    }
+
+    /**
+     * true if the filters of two spheres let them collide: the layers of each one are in the mask of the other,
+     * and they are not in the same group when one of them ignores its group
+     */
+    bool filtersCollide(std::uint64_t a, std::uint64_t b)
+    {
+        if ((a & (b >> 16) & 0xffff) == 0 || (b & (a >> 16) & 0xffff) == 0)
+            return false;
+        const std::uint64_t group = a >> 33;
+        return group == 0 || group != (b >> 33) || ((a | b) & (1ull << 32)) == 0;
+    }
+
+    /**
+     * lock the mutex of a cell, the time spent waiting for another thread is traced
+     */
+    void lockCell(std::mutex &mutex)
+    {
+        if (!mutex.try_lock()) {
+            trace::Scope scope("cell lock wait");
+            mutex.lock();
+        }
+    }
+
+    /**
+     * resolve the pairs of a batch in their order, the caller own the two cells
+     * @return the largest penetration
+     */
+    float resolveBatch(Grid &grid, const ContactList &contacts, const ContactBatch &batch)
+    {
+        float maxPenetration = 0.f;
+        for (int p = batch.begin; p < batch.end; ++p) {
+            const ContactPair &pair = contacts.pairs[p];
+            Sphere &a = grid.bodies[pair.a];
+            Sphere &b = grid.bodies[pair.b];
+            maxPenetration = std::max(maxPenetration, contacts.speculative ? resolveSpeculativePair(a, b)
+                                                                           : solver::resolveSpherePair(a, b));
+        }
+        return maxPenetration;
+    }
+
+    /**
+     * false when both cells of the batch sleep during the substep of a multirate step, their spheres are static
+     */
+    bool isBatchAwake(const ContactBatch &batch, const SubstepRates *rates)
+    {
+        return !rates || rates->isCellAwake(batch.firstCell) || rates->isCellAwake(batch.secondCell);
+    }
+
+    /**
+     * sort the batches by color of their owner cell. An owner only touch the cells of [x-1, x+1] x [y, y+1],
+     * so two owners of the same color (x mod 3, y mod 2) never touch the same cell
+     */
+    void groupByColor(const Grid &grid, ContactList &contacts)
+    {
+        constexpr int kColors = 6;
+        auto colorOf = [&grid, &contacts](int batch) {
+            const cell2 &coords = grid.cellCoords[contacts.batches[batch].ownerCell];
+            return ((coords.x % 3 + 3) % 3) * 2 + ((coords.y % 2 + 2) % 2);
+        };
+
+        // first batch of each owner
+        const int batchCount = static_cast<int>(contacts.batches.size());
+        std::vector<int> &groups = contacts.colorGroups;
+        groups.clear();
+        for (int b = 0; b < batchCount; ++b) {
+            if (b == 0 || contacts.batches[b].ownerCell != contacts.batches[b - 1].ownerCell)
+                groups.push_back(b);
+        }
+
+        std::vector<ContactBatch> &sorted = contacts.sortedBatches;
+        sorted.clear();
+        sorted.reserve(contacts.batches.size());
+        contacts.groupStarts.clear();
+        contacts.colorStarts.clear();
+
+        for (int color = 0; color < kColors; ++color) {
+            contacts.colorStarts.push_back(static_cast<int>(contacts.groupStarts.size()));
+            for (int first : groups) {
+                if (colorOf(first) != color)
+                    continue;
+                contacts.groupStarts.push_back(static_cast<int>(sorted.size()));
+                for (int b = first; b < batchCount && contacts.batches[b].ownerCell == contacts.batches[first].ownerCell; ++b)
+                    sorted.push_back(contacts.batches[b]);
+            }
+        }
+        contacts.colorStarts.push_back(static_cast<int>(contacts.groupStarts.size()));
+        contacts.groupStarts.push_back(static_cast<int>(sorted.size()));
+        contacts.batches.swap(sorted);
+    }
+
+    /**
+     * insertion sort along x, close to linear when the spheres are already almost in order
+     */
+    void sortAlongX(std::vector<int> &indices, const std::vector<Sphere> &bodies)
+    {
+        for (std::size_t i = 1; i < indices.size(); ++i) {
+            const int moved = indices[i];
+            const float x = bodies[moved].position.x;
+            std::size_t j = i;
+            for (; j > 0 && bodies[indices[j - 1]].position.x > x; --j)
+                indices[j] = indices[j - 1];
+            indices[j] = moved;
+        }
+    }
+
+    /**
+     * largest radius plus margin of the spheres, no two of them can be further apart along x than the sum of their reach
+     */
+    float maxReach(const std::vector<int> &indices, const std::vector<Sphere> &bodies, const std::vector<float> &margins)
+    {
+        float reach = 0.f;
+        for (int i : indices)
+            reach = std::max(reach, bodies[i].radius + margins[i]);
+        return reach;
+    }
+
+    /**
+     * give each overloaded cell an entry of the pool: a cell that was already overloaded at the last build
+     * keeps its entry and its order, the entries of the cells that are no longer overloaded are freed
+     * with their memory and handed to the newly overloaded ones
+     * @param sweeping false when no cell is overloaded, sweepSlots is then not sized
+     */
+    void assignSweepOrders(const Grid &grid, ContactList &contacts, bool sweeping)
+    {
+        std::size_t kept = 0;
+        for (int entry : contacts.sweepActive) {
+            const cell2 &coords = contacts.sweepPool[entry].cell;
+            const int index = sweeping ? grid.findCell(coords.x, coords.y) : -1;
+            if (index >= 0 && static_cast<int>(grid.cells[index].size()) > contacts.sweepThreshold
+                && contacts.sweepSlots[index] < 0) {
+                contacts.sweepSlots[index] = entry;
+                contacts.sweepActive[kept++] = entry;
+            } else {
+                contacts.sweepFree.push_back(entry);
+            }
+        }
+        contacts.sweepActive.resize(kept);
+
+        for (int index : contacts.sweepCells) {
+            if (contacts.sweepSlots[index] >= 0)
+                continue;
+            if (contacts.sweepFree.empty()) {
+                contacts.sweepFree.push_back(static_cast<int>(contacts.sweepPool.size()));
+                contacts.sweepPool.emplace_back();
+            }
+            const int entry = contacts.sweepFree.back();
+            contacts.sweepFree.pop_back();
+            SweepOrder &order = contacts.sweepPool[entry];
+            order.cell = grid.cellCoords[index];
+            order.handles.clear();
+            contacts.sweepSlots[index] = entry;
+            contacts.sweepActive.push_back(entry);
+        }
+    }
+
+    /**
+     * sort an overloaded cell, starting from its order of the last build: the spheres still in the cell
+     * keep their order, the ones that entered it are appended
+     */
+    void sortOverloadedCell(const Grid &grid, ContactList &contacts, int index, SweepOrder &order)
+    {
+        const std::vector<int> &cell = grid.cells[index];
+        std::vector<std::uint64_t> &stamps = contacts.sweepStamps;
+        const std::uint64_t inCell = static_cast<std::uint64_t>(contacts.buildCount) << 32
+                                     | static_cast<std::uint32_t>(index);
+        const std::uint64_t placed = inCell | std::uint64_t(1) << 63;
+        for (int i : cell)
+            stamps[i] = inCell;
+
+        order.sorted.clear();
+        for (int handle : order.handles) {
+            const bool known = handle >= 0 && handle < static_cast<int>(grid.handleIndex.size());
+            const int i = known ? grid.handleIndex[handle] : -1;
+            if (i >= 0 && stamps[i] == inCell) {
+                order.sorted.push_back(i);
+                stamps[i] = placed;
+            }
+        }
+        for (int i : cell) {
+            if (stamps[i] == inCell)
+                order.sorted.push_back(i);
+        }
+
+        sortAlongX(order.sorted, grid.bodies);
+        order.handles.resize(order.sorted.size());
+        // a ghost has no handle, it is placed again as a newcomer
+        const int handled = static_cast<int>(grid.bodyHandle.size());
+        for (std::size_t k = 0; k < order.sorted.size(); ++k)
+            order.handles[k] = order.sorted[k] < handled ? grid.bodyHandle[order.sorted[k]] : -1;
+        order.reach = maxReach(order.sorted, grid.bodies, contacts.margins);
+    }
+
+    /**
+     * pairs of a cell sorted along x: each sphere is only tested against the next ones until they are out of reach
+     */
+    template<typename Candidate>
+    void sweepCell(const std::vector<int> &sorted, float reach, const Grid &grid, const std::vector<float> &margins,
+                   const Candidate &isCandidate, std::vector<ContactPair> &pairs)
+    {
+        for (std::size_t i = 0; i < sorted.size(); ++i) {
+            const int a = sorted[i];
+            const Sphere &sphere = grid.bodies[a];
+            const float end = sphere.position.x + sphere.radius + margins[a] + reach;
+            for (std::size_t j = i + 1; j < sorted.size() && grid.bodies[sorted[j]].position.x <= end; ++j) {
+                if (isCandidate(a, sorted[j]))
+                    pairs.push_back({a, sorted[j]});
+            }
+        }
+    }
+
+    /**
+     * pairs between two cells sorted along x: the window of the second cell within reach of a sphere of the
+     * first one only moves forward
+     */
+    template<typename Candidate>
+    void sweepCells(const std::vector<int> &first, float firstReach, const std::vector<int> &second, float secondReach,
+                    const Grid &grid, const Candidate &isCandidate, std::vector<ContactPair> &pairs)
+    {
+        const float reach = firstReach + secondReach;
+        std::size_t start = 0;
+        for (int a : first) {
+            const float x = grid.bodies[a].position.x;
+            while (start < second.size() && grid.bodies[second[start]].position.x < x - reach)
+                ++start;
+            for (std::size_t j = start; j < second.size() && grid.bodies[second[j]].position.x <= x + reach; ++j) {
+                if (isCandidate(a, second[j]))
+                    pairs.push_back({a, second[j]});
             }
         }
-        return nullptr;
     }
 }
 
-void solver::integrateBodies(Grid &grid, float dt)
+float solver::resolveSpherePair(Sphere &a, Sphere &b)
+{
+    vec2 delta = b.position - a.position;
+    float dist = delta.length();
+    float minDist = a.radius + b.radius;
+
+    if (dist >= minDist)
+        return 0.f;
+
+    if (dist < 1e-6f) {
+        delta = vec2(1.f, 0.f);
+        dist = 1.f;
+    }
+
+    float totalInvMass = a.invMass + b.invMass;
+    if (totalInvMass <= 0.f)
+        return 0.f;
+
+    float penetration = minDist - dist;
+    vec2 normal = delta / dist;
+    vec2 correction = normal * penetration;
+
+    float shareA = a.invMass / totalInvMass;
+    float shareB = b.invMass / totalInvMass;
+
+    a.position -= correction * shareA;
+    b.position += correction * shareB;
+    return penetration;
+}
+
+void solver::integrateBodies(Grid &grid, float dt, const SubstepRates *rates)
 {
+    trace::Scope scope("integrate");
+    if (rates) {
+        multithreading::forEachRange(grid.bodyCount(), [&grid, dt, rates](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (grid.bodies[i].invMass > 0.f && rates->isSphereAwake(i))
+                    integrate(grid.bodies[i], dt * static_cast<float>(rates->sphereStrides[i]));
+            }
+        });
+        return;
+    }
+
     multithreading::forEachSphere(grid, [dt](Sphere &sphere) {
         if (sphere.invMass <= 0.f)
             return;
-
-        sphere.velocity += kGravity * dt;
-        sphere.prevPosition = sphere.position;
-        sphere.position += QPointF(sphere.velocity.x() * dt, sphere.velocity.y() * dt);
+        integrate(sphere, dt);
     });
 }
 
-void solver::satisfyStaticConstraints(Grid &grid, const QVector<std::shared_ptr<StaticConstraint>> &constraints)
+float solver::satisfyStaticConstraints(Grid &grid, const ObstacleSet &obstacles)
 {
-    for (const auto &constraint : constraints) {
-        if (!constraint)
-            continue;
+    trace::Scope scope("static constraints");
+    if (obstacles.size() == 0)
+        return 0.f;
 
-        multithreading::forEachSphere(grid, [&constraint](Sphere &sphere) {
-            constraint->project(sphere);
-        });
-    }
+    return multithreading::maxOverSpheres(grid, [&obstacles](Sphere &sphere) {
+        return obstacles.project(sphere);
+    });
 }
 
-void solver::satisfySpringConstraints(Grid &grid, QVector<SpringLink> &springLinks, unsigned int subSteps)
+float solver::satisfySpringConstraints(Grid &grid, std::vector<SpringLink> &springLinks, unsigned int subSteps,
+                                       const SubstepRates *rates)
 {
+    trace::Scope scope("springs");
+    float maxCorrection = 0.f;
     for (const SpringLink &spring : springLinks) {
-        Sphere *a = findSphereNode(grid, spring.groupId, spring.aNode);
-        Sphere *b = findSphereNode(grid, spring.groupId, spring.bNode);
-        if (!a || !b)
+        if (spring.a < 0 || spring.b < 0 || spring.a >= grid.bodyCount() || spring.b >= grid.bodyCount())
+            continue;
+
+        // the nodes of a cluster share their stride, a sleeping spring has two static nodes
+        if (rates && !rates->isSphereAwake(spring.a) && !rates->isSphereAwake(spring.b))
             continue;
 
-        auto delta = QVector2D(b->position - a->position);
+        Sphere *a = &grid.bodies[spring.a];
+        Sphere *b = &grid.bodies[spring.b];
+
+        vec2 delta = b->position - a->position;
         float dist = delta.length();
         if (dist <= 1e-5f)
             continue;
@@ -96,102 +426,667 @@ void solver::satisfySpringConstraints(Grid &grid, QVector<SpringLink> &springLin
             continue;
 
         const float C = (dist - spring.restLength) ;
-        const float beta = 1.0f - std::pow(1.0f - spring.stiffness, 1.0f / static_cast<float>(subSteps));
-        QVector2D correction =  C * beta * (delta/dist);
+        const int steps = rates ? rates->substepsOf(spring.a) : static_cast<int>(subSteps);
+        const float beta = 1.0f - std::pow(1.0f - spring.stiffness, 1.0f / static_cast<float>(steps));
+        vec2 correction =  C * beta * (delta/dist);
+        maxCorrection = std::max(maxCorrection, std::abs(C * beta));
 
         float shareA = a->invMass / totalInvMass;
         float shareB = b->invMass / totalInvMass;
 
-        a->position += QPointF(correction.x() * shareA, correction.y() * shareA);
-        b->position -= QPointF(correction.x() * shareB, correction.y() * shareB);
+        a->position += correction * shareA;
+        b->position -= correction * shareB;
     }
+    return maxCorrection;
+}
+
+float solver::satisfyShapeConstraints(Grid &grid, const std::vector<ShapeCluster> &clusters, unsigned int subSteps,
+                                      const SubstepRates *rates)
+{
+    trace::Scope scope("shape matching");
+    if (clusters.empty())
+        return 0.f;
+
+    return multithreading::maxOverRange(static_cast<int>(clusters.size()), [&](int begin, int end) {
+        float maxCorrection = 0.f;
+        for (int c = begin; c < end; ++c) {
+            const ShapeCluster &cluster = clusters[c];
+            if (cluster.size() < 2 || cluster.totalWeight <= 0.f)
+                continue;
+            if (rates && !rates->isSphereAwake(cluster.bodies[0]))
+                continue;
+
+            // current center of mass
+            vec2 center;
+            for (int i = 0; i < cluster.size(); ++i)
+                center += grid.bodies[cluster.bodies[i]].position * cluster.weights[i];
+            center /= cluster.totalWeight;
+
+            // Apq = sum m p q^T
+            float a00 = 0.f, a01 = 0.f, a10 = 0.f, a11 = 0.f;
+            for (int i = 0; i < cluster.size(); ++i) {
+                const vec2 p = grid.bodies[cluster.bodies[i]].position - center;
+                const vec2 &q = cluster.restShape[i];
+                const float m = cluster.weights[i];
+                a00 += m * p.x * q.x;
+                a01 += m * p.x * q.y;
+                a10 += m * p.y * q.x;
+                a11 += m * p.y * q.y;
+            }
+
+            // in 2D the rotation of the polar decomposition of Apq is given by a single angle
+            const float angle = std::atan2(a10 - a01, a00 + a11);
+            const float cosA = std::cos(angle);
+            const float sinA = std::sin(angle);
+            float t00 = cosA, t01 = -sinA, t10 = sinA, t11 = cosA;
+
+            if (cluster.linearDeformation > 0.f) {
+                // A = Apq * inv(Aqq), scaled to keep the area
+                const float *inv = cluster.invAqq;
+                float l00 = a00 * inv[0] + a01 * inv[2];
+                float l01 = a00 * inv[1] + a01 * inv[3];
+                float l10 = a10 * inv[0] + a11 * inv[2];
+                float l11 = a10 * inv[1] + a11 * inv[3];
+                const float det = l00 * l11 - l01 * l10;
+                if (det > 1e-6f) {
+                    const float scale = 1.f / std::sqrt(det);
+                    l00 *= scale; l01 *= scale; l10 *= scale; l11 *= scale;
+
+                    const float beta = std::min(1.f, cluster.linearDeformation);
+                    t00 = beta * l00 + (1.f - beta) * t00;
+                    t01 = beta * l01 + (1.f - beta) * t01;
+                    t10 = beta * l10 + (1.f - beta) * t10;
+                    t11 = beta * l11 + (1.f - beta) * t11;
+                }
+            }
+
+            const int steps = rates ? rates->substepsOf(cluster.bodies[0]) : static_cast<int>(subSteps);
+            const float alpha = 1.0f - std::pow(1.0f - cluster.stiffness, 1.0f / static_cast<float>(steps));
+
+            for (int i = 0; i < cluster.size(); ++i) {
+                Sphere &node = grid.bodies[cluster.bodies[i]];
+                if (node.invMass <= 0.f)
+                    continue;
+
+                const vec2 &q = cluster.restShape[i];
+                const vec2 goal = center + vec2(t00 * q.x + t01 * q.y, t10 * q.x + t11 * q.y);
+                const vec2 correction = (goal - node.position) * alpha;
+                node.position += correction;
+                maxCorrection = std::max(maxCorrection, correction.length());
+            }
+        }
+        return maxCorrection;
+    });
 }
 
-void solver::solveSphereContacts(Grid &grid, int gridCols, int gridRows,
-                                 const std::function<bool(int, int)> &isValidCell)
+void solver::buildContactList(Grid &grid, ContactList &contacts, const SubstepRates *rates)
 {
-    if (gridCols <= 0 || gridRows <= 0 || grid.cells.isEmpty())
+    trace::Scope scope("broadphase");
+    contacts.pairs.clear();
+    contacts.batches.clear();
+    contacts.groupStarts.clear();
+    contacts.colorStarts.clear();
+    const int owned = contacts.ghostBegin < 0 ? grid.bodyCount() : contacts.ghostBegin;
+    contacts.referencePositions.resize(owned);
+    contacts.margins.resize(grid.bodyCount());
+    contacts.filterKeys.resize(grid.bodyCount());
+    contacts.filtered = false;
+
+    // a pair is only searched in neighbor cells, so the reach of two spheres can not exceed the size of a cell
+    const float halfSkin = 0.5f * contacts.skin;
+    const float maxMargin = std::max(halfSkin, 0.25f * grid.cellSize());
+    for (int i = 0; i < grid.bodyCount(); ++i) {
+        const Sphere &sphere = grid.bodies[i];
+        if (i < owned)
+            contacts.referencePositions[i] = sphere.position;
+        if (contacts.speculative) {
+            // a sphere of a long stride is static while it sleeps, its next step is as long as its last one
+            const bool longStride = rates && rates->sphereStrides[i] > 1;
+            const float sweep = (sphere.position - (longStride ? sphere.prevPosition : startPosition(sphere))).length();
+            contacts.margins[i] = std::min(halfSkin + sweep, maxMargin);
+        } else {
+            contacts.margins[i] = halfSkin;
+        }
+        contacts.filterKeys[i] = filterKey(sphere);
+        contacts.filtered = contacts.filtered || !sphere.filter.isDefault();
+    }
+    contacts.valid = true;
+    contacts.builtPairs = contacts.builtBatches = contacts.builtGroups = contacts.builtColors = 0;
+
+    if (grid.activeCells.empty())
         return;
+    if (!grid.hasNeighbors())
+        grid.refreshNeighbors();
 
-    static const QPoint neighborOffsets[] = {
-            QPoint(1, 0),
-            QPoint(0, 1),
-            QPoint(1, 1),
-            QPoint(-1, 1)
+    const std::vector<float> &margins = contacts.margins;
+    const std::vector<std::uint64_t> &keys = contacts.filterKeys;
+    const bool filtered = contacts.filtered;
+
+    // filtered pairs are rejected before any distance is computed, the ghosts are paired by refreshGhostPairs
+    auto isCandidate = [&](int a, int b) {
+        return a < owned && b < owned
+               && (!filtered || filtersCollide(keys[a], keys[b]))
+               && isContactCandidate(grid.bodies[a], grid.bodies[b], margins[a], margins[b]);
     };
 
-    auto cellJob = [&grid, gridCols, &isValidCell](unsigned int row, unsigned int col) {
-        const int index = static_cast<int>(row * gridCols + col);
-        if (index < 0 || index >= grid.cells.size())
-            return;
+    // the overloaded cells are sorted along x before the threads start, the order of a cell is then read by
+    // every thread visiting it as a neighbor
+    ++contacts.buildCount;
+    contacts.sweepCells.clear();
+    if (contacts.sweepThreshold > 0) {
+        for (int index : grid.activeCells) {
+            if (static_cast<int>(grid.cells[index].size()) > contacts.sweepThreshold)
+                contacts.sweepCells.push_back(index);
+        }
+    }
+    const bool sweeping = !contacts.sweepCells.empty();
+    if (sweeping) {
+        contacts.sweepStamps.resize(grid.bodyCount());
+        contacts.sweepSlots.assign(grid.cells.size(), -1);
+    }
+    assignSweepOrders(grid, contacts, sweeping);
+    for (int index : contacts.sweepCells)
+        sortOverloadedCell(grid, contacts, index, contacts.sweepPool[contacts.sweepSlots[index]]);
+    auto orderOf = [&contacts, sweeping](int index) -> const SweepOrder * {
+        const int entry = sweeping ? contacts.sweepSlots[index] : -1;
+        return entry >= 0 ? &contacts.sweepPool[entry] : nullptr;
+    };
+
+    // each thread appends to its own buffer, the chunks are put back in the order of the cells afterwards
+    if (contacts.buffers.size() < static_cast<std::size_t>(multithreading::maxThreadAllowed()))
+        contacts.buffers.resize(multithreading::maxThreadAllowed());
+    for (BroadphaseBuffer &buffer : contacts.buffers) {
+        buffer.pairs.clear();
+        buffer.batches.clear();
+    }
+    std::mutex chunksLock;
+    contacts.chunks.clear();
+
+    // only the occupied cells and their occupied neighbors are visited
+    multithreading::forEachRange(static_cast<int>(grid.activeCells.size()), [&](int activeBegin, int activeEnd) {
+        const int thread = multithreading::threadIndex();
+        BroadphaseBuffer &chunk = contacts.buffers[thread];
+        const int pairBegin = static_cast<int>(chunk.pairs.size());
+        const int batchBegin = static_cast<int>(chunk.batches.size());
+
+        auto closeBatch = [&chunk](int firstCell, int secondCell, int begin, int owner) {
+            if (static_cast<int>(chunk.pairs.size()) > begin)
+                chunk.batches.push_back({firstCell, secondCell, begin, static_cast<int>(chunk.pairs.size()), owner});
+        };
+
+        // a cell that is not overloaded is sorted on the fly when it meets an overloaded neighbor
+        std::vector<int> &sortedCell = chunk.sortedCell;
+        std::vector<int> &sortedNeighbor = chunk.sortedNeighbor;
+
+        for (int active = activeBegin; active < activeEnd; ++active) {
+            const int index = grid.activeCells[active];
+            const std::vector<int> &cell = grid.cells[index];
+            const SweepOrder *order = orderOf(index);
 
-        {
-            QMutexLocker locker(grid.locks[index].get());
-            auto &cell = grid.cells[index];
-            for (int i = 0; i < cell.size(); ++i) {
-                for (int j = i + 1; j < cell.size(); ++j) {
-                    resolveSpherePair(cell[i], cell[j]);
+            int begin = static_cast<int>(chunk.pairs.size());
+            if (order) {
+                sweepCell(order->sorted, order->reach, grid, margins, isCandidate, chunk.pairs);
+            } else {
+                for (std::size_t i = 0; i < cell.size(); ++i) {
+                    for (std::size_t j = i + 1; j < cell.size(); ++j) {
+                        if (isCandidate(cell[i], cell[j]))
+                            chunk.pairs.push_back({cell[i], cell[j]});
+                    }
+                }
+            }
+            closeBatch(index, index, begin, index);
+
+            float cellReach = -1.f; // not sorted yet
+            for (int link = grid.neighborStarts[index]; link < grid.neighborStarts[index + 1]; ++link) {
+                const int neighborIndex = grid.neighborCells[link];
+                const std::vector<int> &neighbor = grid.cells[neighborIndex];
+                const SweepOrder *neighborOrder = orderOf(neighborIndex);
+
+                begin = static_cast<int>(chunk.pairs.size());
+                if (order || neighborOrder) {
+                    if (!order && cellReach < 0.f) {
+                        sortedCell = cell;
+                        sortAlongX(sortedCell, grid.bodies);
+                        cellReach = maxReach(sortedCell, grid.bodies, margins);
+                    }
+                    float neighborReach = 0.f;
+                    if (!neighborOrder) {
+                        sortedNeighbor = neighbor;
+                        sortAlongX(sortedNeighbor, grid.bodies);
+                        neighborReach = maxReach(sortedNeighbor, grid.bodies, margins);
+                    }
+                    sweepCells(order ? order->sorted : sortedCell, order ? order->reach : cellReach,
+                               neighborOrder ? neighborOrder->sorted : sortedNeighbor,
+                               neighborOrder ? neighborOrder->reach : neighborReach, grid, isCandidate, chunk.pairs);
+                } else {
+                    for (int a : cell) {
+                        for (int b : neighbor) {
+                            if (isCandidate(a, b))
+                                chunk.pairs.push_back({a, b});
+                        }
+                    }
                 }
+                closeBatch(std::min(index, neighborIndex), std::max(index, neighborIndex), begin, index);
             }
         }
 
-        auto &cell = grid.cells[index];
-        for (const QPoint &offset : neighborOffsets) {
-            const int neighborCol = static_cast<int>(col) + offset.x();
-            const int neighborRow = static_cast<int>(row) + offset.y();
-            if (!isValidCell(neighborCol, neighborRow))
-                continue;
+        std::lock_guard<std::mutex> locker(chunksLock);
+        contacts.chunks.push_back({activeBegin, thread, pairBegin, static_cast<int>(chunk.pairs.size()),
+                                   batchBegin, static_cast<int>(chunk.batches.size())});
+    });
 
-            const int neighborIndex = neighborRow * gridCols + neighborCol;
-            if (neighborIndex < 0 || neighborIndex >= grid.cells.size())
-                continue;
+    // keep the spatial order of the cells so that each thread of the narrow phase get a compact zone
+    std::sort(contacts.chunks.begin(), contacts.chunks.end(), [](const BroadphaseChunk &a, const BroadphaseChunk &b) {
+        return a.activeBegin < b.activeBegin;
+    });
 
-            const int firstIndex  = std::min(index, neighborIndex);
-            const int secondIndex = std::max(index, neighborIndex);
+    for (const BroadphaseChunk &chunk : contacts.chunks) {
+        const BroadphaseBuffer &buffer = contacts.buffers[chunk.buffer];
+        const int offset = static_cast<int>(contacts.pairs.size()) - chunk.pairBegin;
+        contacts.pairs.insert(contacts.pairs.end(), buffer.pairs.begin() + chunk.pairBegin,
+                              buffer.pairs.begin() + chunk.pairEnd);
+        for (int b = chunk.batchBegin; b < chunk.batchEnd; ++b) {
+            ContactBatch batch = buffer.batches[b];
+            batch.begin += offset;
+            batch.end   += offset;
+            contacts.batches.push_back(batch);
+        }
+    }
 
-            QMutex *firstMutex  = grid.locks[firstIndex].get();
-            QMutex *secondMutex = grid.locks[secondIndex].get();
-            if (!firstMutex || !secondMutex)
-                continue;
+    if (contacts.deterministic)
+        groupByColor(grid, contacts);
+
+    contacts.builtPairs = static_cast<int>(contacts.pairs.size());
+    contacts.builtBatches = static_cast<int>(contacts.batches.size());
+    contacts.builtGroups = static_cast<int>(contacts.groupStarts.size());
+    contacts.builtColors = static_cast<int>(contacts.colorStarts.size());
+    if (contacts.ghostBegin >= 0)
+        refreshGhostPairs(grid, contacts);
+}
+
+void solver::refreshGhostPairs(const Grid &grid, ContactList &contacts)
+{
+    const bool hadGhosts = static_cast<int>(contacts.batches.size()) != contacts.builtBatches;
+    if (!hadGhosts && contacts.ghostBegin < 0)
+        return;
+
+    trace::Scope scope("ghost pairs");
+    contacts.pairs.resize(contacts.builtPairs);
+    contacts.batches.resize(contacts.builtBatches);
+    contacts.groupStarts.resize(contacts.builtGroups);
+    contacts.colorStarts.resize(contacts.builtColors);
+    if (contacts.ghostBegin < 0 || contacts.ghostBegin >= grid.bodyCount() || !contacts.valid)
+        return;
 
-            auto processPairs = [&]() {
-                auto &neighbor = grid.cells[neighborIndex];
-                for (Sphere &a : cell) {
-                    for (Sphere &b : neighbor) {
-                        resolveSpherePair(a, b);
+    const int owned = contacts.ghostBegin;
+    std::vector<int> &ghostCells = contacts.ghostCells;
+    ghostCells.clear();
+    for (int g = owned; g < grid.bodyCount(); ++g) {
+        const cell2 cell = grid.cellOf(grid.bodies[g].position);
+        const int index = grid.findCell(cell.x, cell.y);
+        if (index >= 0)
+            ghostCells.push_back(index);
+    }
+    std::sort(ghostCells.begin(), ghostCells.end());
+    ghostCells.erase(std::unique(ghostCells.begin(), ghostCells.end()), ghostCells.end());
+
+    // the ghosts are new at every substep, their margin only has to cover the skin
+    const float ghostMargin = 0.5f * contacts.skin;
+    for (int ghostCell : ghostCells) {
+        const cell2 &coords = grid.cellCoords[ghostCell];
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                const int index = grid.findCell(coords.x + dx, coords.y + dy);
+                if (index < 0)
+                    continue;
+
+                const int begin = static_cast<int>(contacts.pairs.size());
+                for (int g : grid.cells[ghostCell]) {
+                    if (g < owned)
+                        continue;
+                    const Sphere &ghost = grid.bodies[g];
+                    const std::uint64_t ghostKey = filterKey(ghost);
+                    for (int i : grid.cells[index]) {
+                        if (i < owned && filtersCollide(contacts.filterKeys[i], ghostKey)
+                            && isContactCandidate(grid.bodies[i], ghost, contacts.margins[i], ghostMargin))
+                            contacts.pairs.push_back({i, g});
                     }
                 }
-            };
+                if (static_cast<int>(contacts.pairs.size()) > begin)
+                    contacts.batches.push_back({std::min(index, ghostCell), std::max(index, ghostCell), begin,
+                                                static_cast<int>(contacts.pairs.size()), ghostCell});
+            }
+        }
+    }
+
+    // deterministic order: the ghost batches share cells, they are one more color of a single group
+    if (contacts.deterministic && !contacts.colorStarts.empty()
+        && static_cast<int>(contacts.batches.size()) > contacts.builtBatches) {
+        contacts.groupStarts.push_back(static_cast<int>(contacts.batches.size()));
+        contacts.colorStarts.push_back(static_cast<int>(contacts.groupStarts.size()) - 1);
+    }
+}
+
+bool solver::contactListNeedsRebuild(const Grid &grid, const ContactList &contacts)
+{
+    trace::Scope scope("rebuild check");
+    const int owned = contacts.ghostBegin < 0 ? grid.bodyCount() : contacts.ghostBegin;
+    if (!contacts.valid || static_cast<int>(contacts.referencePositions.size()) != owned)
+        return true;
+
+    for (int i = 0; i < owned; ++i) {
+        const Sphere &sphere = grid.bodies[i];
+        const float limit = contacts.margins[i] * contacts.margins[i];
+        if ((sphere.position - contacts.referencePositions[i]).lengthSquared() > limit)
+            return true;
+        // the whole path of the substep has to be covered, the margin is a disc so both ends are enough
+        if (contacts.speculative && (startPosition(sphere) - contacts.referencePositions[i]).lengthSquared() > limit)
+            return true;
+    }
+    return false;
+}
+
+float solver::solveSphereContacts(Grid &grid, const ContactList &contacts, const SubstepRates *rates)
+{
+    trace::Scope scope("contacts");
+    if (contacts.batches.empty() || grid.locks.empty())
+        return 0.f;
+
+    if (contacts.deterministic && !contacts.colorStarts.empty()) {
+        // one dispatch per color, the groups of a color never share a cell so they need no lock
+        float maxPenetration = 0.f;
+        for (std::size_t color = 0; color + 1 < contacts.colorStarts.size(); ++color) {
+            const int firstGroup = contacts.colorStarts[color];
+            const int groupCount = contacts.colorStarts[color + 1] - firstGroup;
+            if (groupCount <= 0)
+                continue;
+
+            maxPenetration = std::max(maxPenetration, multithreading::maxOverRange(groupCount, [&](int begin, int end) {
+                float localMax = 0.f;
+                const int batchBegin = contacts.groupStarts[firstGroup + begin];
+                const int batchEnd   = contacts.groupStarts[firstGroup + end];
+                for (int batchIndex = batchBegin; batchIndex < batchEnd; ++batchIndex) {
+                    const ContactBatch &batch = contacts.batches[batchIndex];
+                    if (!isBatchAwake(batch, rates))
+                        continue;
+                    localMax = std::max(localMax, resolveBatch(grid, contacts, batch));
+                }
+                return localMax;
+            }));
+        }
+        return maxPenetration;
+    }
+
+    auto batchJob = [&grid, &contacts, rates](int batchBegin, int batchEnd) {
+        float maxPenetration = 0.f;
+
+        for (int batchIndex = batchBegin; batchIndex < batchEnd; ++batchIndex) {
+            const ContactBatch &batch = contacts.batches[batchIndex];
+            if (!isBatchAwake(batch, rates))
+                continue;
+
+            std::mutex *firstMutex  = grid.locks[batch.firstCell].get();
+            std::mutex *secondMutex = grid.locks[batch.secondCell].get();
+            if (!firstMutex || !secondMutex)
+                continue;
 
-            QMutexLocker firstLocker(firstMutex);
+            lockCell(*firstMutex);
+            std::lock_guard<std::mutex> firstLocker(*firstMutex, std::adopt_lock);
             if (secondMutex != firstMutex) {
-                QMutexLocker secondLocker(secondMutex);
-                processPairs();
+                lockCell(*secondMutex);
+                std::lock_guard<std::mutex> secondLocker(*secondMutex, std::adopt_lock);
+                maxPenetration = std::max(maxPenetration, resolveBatch(grid, contacts, batch));
             } else {
-                processPairs();
+                maxPenetration = std::max(maxPenetration, resolveBatch(grid, contacts, batch));
             }
         }
+        return maxPenetration;
     };
 
-    multithreading::forEachCell(grid, cellJob);
+    return multithreading::maxOverRange(static_cast<int>(contacts.batches.size()), batchJob);
 }
 
 
-void solver::updateVelocities(Grid &grid, float dt)
+void solver::updateVelocities(Grid &grid, float dt, const SubstepRates *rates)
 {
+    trace::Scope scope("velocities");
     if (dt <= 0.f)
         return;
 
+    if (rates) {
+        multithreading::forEachRange(grid.bodyCount(), [&grid, dt, rates](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (!rates->isSphereAwake(i))
+                    continue;
+                Sphere &sphere = grid.bodies[i];
+                sphere.velocity = (sphere.position - sphere.prevPosition) / (dt * static_cast<float>(rates->sphereStrides[i]));
+            }
+        });
+        return;
+    }
+
     multithreading::forEachSphere(grid, [dt](Sphere &sphere) {
-        auto delta = QVector2D(sphere.position - sphere.prevPosition);
-        sphere.velocity = delta / dt;
+        sphere.velocity = (sphere.position - sphere.prevPosition) / dt;
     });
 }
 
-void solver::applyVelocityDamping(Grid &grid, float dampingFactor)
+void solver::applyVelocityDamping(Grid &grid, float dampingFactor, const SubstepRates *rates)
 {
+    trace::Scope scope("damping");
+    if (rates) {
+        // a sphere of stride k is damped once for the k substeps it slept
+        std::array<float, kMaxSubstepStride + 1> factors {};
+        for (int stride = 1; stride <= kMaxSubstepStride; ++stride)
+            factors[stride] = std::pow(dampingFactor, static_cast<float>(stride));
+
+        multithreading::forEachRange(grid.bodyCount(), [&grid, &factors, rates](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (rates->isSphereAwake(i))
+                    grid.bodies[i].velocity *= factors[rates->sphereStrides[i]];
+            }
+        });
+        return;
+    }
+
     multithreading::forEachSphere(grid, [dampingFactor](Sphere &sphere) {
         sphere.velocity *= dampingFactor;
     });
 }
 
+
+void solver::assignSubstepRates(Grid &grid, const ContactList &contacts, const MultirateSettings &settings,
+                                int subSteps, float dt, SubstepRates &rates)
+{
+    trace::Scope scope("substep rates");
+    rates.substep = 0;
+    rates.subSteps = std::max(1, subSteps);
+
+    // the largest power of two allowed that divides the substeps, so every stride ends with the frame
+    const int strideLimit = std::min(settings.maxStride, kMaxSubstepStride);
+    int maxStride = 1;
+    while (maxStride * 2 <= strideLimit && rates.subSteps % (maxStride * 2) == 0)
+        maxStride *= 2;
+
+    const int cellCount = grid.size();
+    rates.cellPairs.assign(cellCount, 0);
+    if (contacts.valid) {
+        for (const ContactBatch &batch : contacts.batches) {
+            if (batch.firstCell >= cellCount || batch.secondCell >= cellCount)
+                continue;
+            rates.cellPairs[batch.firstCell] += batch.end - batch.begin;
+            if (batch.secondCell != batch.firstCell)
+                rates.cellPairs[batch.secondCell] += batch.end - batch.begin;
+        }
+    }
+
+    rates.cellStrides.assign(cellCount, static_cast<std::uint8_t>(maxStride));
+    multithreading::forEachRange(static_cast<int>(grid.activeCells.size()), [&](int activeBegin, int activeEnd) {
+        for (int active = activeBegin; active < activeEnd; ++active) {
+            const int index = grid.activeCells[active];
+            const std::vector<int> &cell = grid.cells[index];
+            if (cell.empty())
+                continue;
+
+            // the stiffness of a pile comes from the small steps, with longer ones it sinks and bounces back
+            if (static_cast<float>(rates.cellPairs[index]) > settings.denseContacts * static_cast<float>(cell.size())) {
+                rates.cellStrides[index] = 1;
+                continue;
+            }
+
+            float maxSpeed = 0.f;
+            float minRadius = std::numeric_limits<float>::max();
+            for (int i : cell) {
+                maxSpeed = std::max(maxSpeed, grid.bodies[i].velocity.length());
+                minRadius = std::min(minRadius, grid.bodies[i].radius);
+            }
+
+            const float budget = settings.motionBudget * minRadius;
+            int stride = maxStride;
+            while (stride > 1 && maxSpeed * dt * static_cast<float>(stride) > budget)
+                stride /= 2;
+            rates.cellStrides[index] = static_cast<std::uint8_t>(stride);
+        }
+    });
+
+    // a neighbor of a cell is at most twice as slow, each pass spread the constraint one cell further
+    if (!grid.hasNeighbors())
+        grid.refreshNeighbors();
+    for (int spread = 1; spread < maxStride; spread *= 2) {
+        for (int index : grid.activeCells) {
+            for (int link = grid.neighborStarts[index]; link < grid.neighborStarts[index + 1]; ++link) {
+                std::uint8_t &stride = rates.cellStrides[index];
+                std::uint8_t &neighbor = rates.cellStrides[grid.neighborCells[link]];
+                stride = std::min<std::uint8_t>(stride, static_cast<std::uint8_t>(2 * neighbor));
+                neighbor = std::min<std::uint8_t>(neighbor, static_cast<std::uint8_t>(2 * stride));
+            }
+        }
+    }
+
+    rates.sphereStrides.assign(grid.bodies.size(), 1);
+    for (int index : grid.activeCells) {
+        for (int i : grid.cells[index])
+            rates.sphereStrides[i] = rates.cellStrides[index];
+    }
+
+    // the nodes of a cluster are held together by its springs or its shape, the whole cluster takes the
+    // stride of its busiest node
+    // the nodes are sorted by group rather than indexed by group id, the ids only grow as clusters are created
+    // and removed while the nodes stay within the sphere budget
+    rates.groupNodes.clear();
+    for (int i = 0; i < grid.bodyCount(); ++i) {
+        if (grid.bodies[i].groupId >= 0)
+            rates.groupNodes.push_back(i);
+    }
+    std::sort(rates.groupNodes.begin(), rates.groupNodes.end(), [&grid](int a, int b) {
+        return grid.bodies[a].groupId < grid.bodies[b].groupId;
+    });
+    for (std::size_t first = 0; first < rates.groupNodes.size();) {
+        const int group = grid.bodies[rates.groupNodes[first]].groupId;
+        std::size_t last = first;
+        std::uint8_t stride = static_cast<std::uint8_t>(maxStride);
+        for (; last < rates.groupNodes.size() && grid.bodies[rates.groupNodes[last]].groupId == group; ++last)
+            stride = std::min(stride, rates.sphereStrides[rates.groupNodes[last]]);
+        for (; first < last; ++first)
+            rates.sphereStrides[rates.groupNodes[first]] = stride;
+    }
+
+    refreshCellStrides(grid, rates);
+}
+
+void solver::refreshCellStrides(const Grid &grid, SubstepRates &rates)
+{
+    rates.cellStrides.assign(grid.cells.size(), static_cast<std::uint8_t>(kMaxSubstepStride));
+    for (int index : grid.activeCells) {
+        std::uint8_t stride = static_cast<std::uint8_t>(kMaxSubstepStride);
+        for (int i : grid.cells[index])
+            stride = std::min(stride, rates.sphereStrides[i]);
+        rates.cellStrides[index] = stride;
+    }
+}
+
+int solver::freezeSleeping(Grid &grid, const SubstepRates &rates, std::vector<float> &savedInvMass)
+{
+    trace::Scope scope("freeze sleeping");
+    savedInvMass.resize(grid.bodies.size());
+    std::atomic<int> awake {0};
+
+    multithreading::forEachRange(grid.bodyCount(), [&](int begin, int end) {
+        int localAwake = 0;
+        for (int i = begin; i < end; ++i) {
+            Sphere &sphere = grid.bodies[i];
+            savedInvMass[i] = sphere.invMass;
+            if (rates.isSphereAwake(i))
+                ++localAwake;
+            else
+                sphere.invMass = 0.f;
+        }
+        awake.fetch_add(localAwake, std::memory_order_relaxed);
+    });
+    return awake.load();
+}
+
+void solver::thawSleeping(Grid &grid, const SubstepRates &rates, const std::vector<float> &savedInvMass)
+{
+    trace::Scope scope("thaw sleeping");
+    multithreading::forEachRange(grid.bodyCount(), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            if (!rates.isSphereAwake(i))
+                grid.bodies[i].invMass = savedInvMass[i];
+        }
+    });
+}
+
+void solver::reserveContactList(ContactList &contacts, int sphereCount, int cellCount, int pairCount,
+                                int cellOccupancy)
+{
+    // a batch holds at least one pair
+    contacts.pairs.reserve(pairCount);
+    contacts.batches.reserve(pairCount);
+    contacts.sortedBatches.reserve(pairCount);
+    contacts.colorGroups.reserve(cellCount);
+    contacts.groupStarts.reserve(cellCount + 1);
+    contacts.colorStarts.reserve(7);
+    contacts.referencePositions.reserve(sphereCount);
+    contacts.margins.reserve(sphereCount);
+    contacts.filterKeys.reserve(sphereCount);
+
+    contacts.sweepCells.reserve(cellCount);
+    contacts.sweepSlots.reserve(cellCount);
+    contacts.sweepStamps.reserve(sphereCount);
+
+    // as many overloaded cells as the spheres can fill, each order holding as many spheres as a cell
+    if (contacts.sweepThreshold > 0) {
+        const int orderCount = sphereCount / (contacts.sweepThreshold + 1) + 1;
+        const int orderSize = std::max(cellOccupancy, contacts.sweepThreshold + 1);
+        contacts.sweepActive.reserve(orderCount);
+        contacts.sweepFree.reserve(orderCount);
+        contacts.sweepPool.reserve(orderCount);
+        while (static_cast<int>(contacts.sweepPool.size()) < orderCount) {
+            contacts.sweepFree.push_back(static_cast<int>(contacts.sweepPool.size()));
+            contacts.sweepPool.emplace_back();
+        }
+        for (SweepOrder &order : contacts.sweepPool) {
+            order.handles.reserve(orderSize);
+            order.sorted.reserve(orderSize);
+        }
+    }
+
+    const int threads = multithreading::maxThreadAllowed();
+    if (contacts.buffers.size() < static_cast<std::size_t>(threads))
+        contacts.buffers.resize(threads);
+    contacts.chunks.reserve(threads * multithreading::chunksPerThread());
+    for (BroadphaseBuffer &buffer : contacts.buffers) {
+        buffer.pairs.reserve(pairCount);
+        buffer.batches.reserve(pairCount);
+        buffer.sortedCell.reserve(contacts.sweepThreshold);
+        buffer.sortedNeighbor.reserve(contacts.sweepThreshold);
+    }
+}
+
+void solver::reserveSubstepRates(SubstepRates &rates, int sphereCount, int cellCount)
+{
+    rates.sphereStrides.reserve(sphereCount);
+    rates.cellStrides.reserve(cellCount);
+    rates.cellPairs.reserve(cellCount);
+    rates.groupNodes.reserve(sphereCount);
+}
@@ -8,15 +8,16 @@
 #include "grid.h"
 #include "physicalbody.h"
 #include "constraints.h"
+#include "obstacles.h"
 #include "springlink.h"
+#include "shapecluster.h"
+#include "contactlist.h"
+#include "multirate.h"
 #include "multithreading.h"
 
-#include <QMutexLocker>
-#include <QPoint>
-#include <QVector2D>
-#include <QVector>
 #include <functional>
 #include <memory>
+#include <vector>
 
 /**
  * Position based dynamics solver
@@ -28,41 +29,136 @@ namespace solver
     /**
      * Apply the external forces and compute the new position
      * @param dt
+     * @param rates multirate step: only the awake spheres are integrated, over their stride times dt
      */
-    void integrateBodies(Grid &grid, float dt) ;
+    void integrateBodies(Grid &grid, float dt, const SubstepRates *rates = nullptr) ;
 
     /**
-     * resolve static constraint with method project from static Constraint
+     * resolve static constraint with method project from static Constraint.
+     * each sphere is only projected on the obstacles of the set whose box it touches
+     * @return the largest correction applied to a sphere
      */
-    void satisfyStaticConstraints(Grid &grid, const QVector<std::shared_ptr<StaticConstraint>> &constraints) ;
+    float satisfyStaticConstraints(Grid &grid, const ObstacleSet &obstacles) ;
 
     /**
      * resolve spring constraint cluster by cluster
      * @param grid
      * @param springLinks
+     * @param rates multirate step: the stiffness of a spring is spread over the substeps of its first node
+     * @return the largest correction applied by a spring
      */
-    void satisfySpringConstraints(Grid &grid, QVector<SpringLink> &springLinks, unsigned int subSteps);
+    float satisfySpringConstraints(Grid &grid, std::vector<SpringLink> &springLinks, unsigned int subSteps,
+                                   const SubstepRates *rates = nullptr);
 
     /**
-    * resolve sphere contact with method resolveSpherePair
-    * this funcrion call multithreading lockers are assure with QMutex
+     * pull the nodes of each cluster toward the goal positions of its shape matching constraint.
+     * clusters do not share nodes so they are solved in parallel
+     * @param grid
+     * @param clusters
+     * @param rates multirate step: the stiffness of a cluster is spread over the substeps of its first node
+     * @return the largest correction applied to a node
+     */
+    float satisfyShapeConstraints(Grid &grid, const std::vector<ShapeCluster> &clusters, unsigned int subSteps,
+                                  const SubstepRates *rates = nullptr);
+
+    /**
+     * push two overlapping spheres apart along the line of their centers
+     * @return the penetration that has been corrected, 0 if they were not touching
+     */
+    float resolveSpherePair(Sphere &a, Sphere &b);
+
+    /**
+     * broadphase: walk every cell and its neighbors and store each pair of spheres
+     * closer than the sum of their radius plus their margins (see ContactList).
+     * the cells of the grid have to be up to date, and the spheres integrated when the list is speculative
+     * @param contacts list rebuilt, its skin is kept
+     * @param rates multirate step: the margin of a sphere covers its whole stride
+     */
+    void buildContactList(Grid &grid, ContactList &contacts, const SubstepRates *rates = nullptr) ;
+
+    /**
+     * @return true if a sphere moved further than its margin since the list was built,
+     * or if spheres has been added, in which case some contacts may be missing. The ghosts are not checked
+     */
+    [[nodiscard]] bool contactListNeedsRebuild(const Grid &grid, const ContactList &contacts) ;
+
+    /**
+     * replace the pairs with the ghosts of the last substep by the pairs with the current ones, without
+     * rebuilding the pairs of the other spheres. Only drop them when there is no ghost anymore
+     * @param grid the ghosts are in their cells
+     * @param contacts list built, its ghostBegin up to date
+     */
+    void refreshGhostPairs(const Grid &grid, ContactList &contacts);
+
+    /**
+    * narrow phase: resolve the candidate pairs of the list with method resolveSpherePair.
+    * when the list is speculative, two spheres that were apart at the beginning of the substep are
+    * stopped where their paths meet instead, so they can not cross each other within a substep
+    * this funcrion call multithreading, each batch lock the mutex of its two cells.
+    * when the list is deterministic the groups of batches of one color are solved in parallel without lock,
+    * one color after the other, so the result does not depend on the number of threads nor on their timing
+    * @param rates multirate step: the batches between two sleeping cells are skipped
+    * @return the largest penetration found between two spheres
     */
-    void solveSphereContacts(Grid &grid,
-                             int gridCols,
-                             int gridRows,
-                             const std::function<bool(int, int)> &isValidCell) ;
+    float solveSphereContacts(Grid &grid, const ContactList &contacts, const SubstepRates *rates = nullptr) ;
 
     /**
      * Recompute velicities accoding to position and previous position acording to position based dynamics
      * @param dt
+     * @param rates multirate step: only the awake spheres, over their stride times dt
      */
-    void updateVelocities(Grid &grid, float dt) ;
+    void updateVelocities(Grid &grid, float dt, const SubstepRates *rates = nullptr) ;
 
     /**
      * Apply damping
      * @param Dampingfactor
+     * @param rates multirate step: only the awake spheres, once per substep of their stride
+     */
+    void applyVelocityDamping(Grid &grid, float dampingFactor, const SubstepRates *rates = nullptr) ;
+
+    /**
+     * choose the stride of every cell for the frame from the speed of its spheres and its number of candidate
+     * pairs, then give each sphere the stride of its cell and each cluster the smallest stride of its nodes.
+     * A dense cell (a pile) is stepped at every substep, and the stride of two neighbor cells differs by
+     * at most a factor two so the busy regions are surrounded by a band stepped at an intermediate rate
+     * @param contacts candidate pairs of the cells, used when the list is valid
+     * @param dt duration of a substep
+     * @param rates filled, its substep is reset
+     */
+    void assignSubstepRates(Grid &grid, const ContactList &contacts, const MultirateSettings &settings,
+                            int subSteps, float dt, SubstepRates &rates);
+
+    /**
+     * recompute the stride of each cell from its spheres, after the cells were rebuilt
+     */
+    void refreshCellStrides(const Grid &grid, SubstepRates &rates);
+
+    /**
+     * make the spheres that sleep during the current substep static (null inverse mass), so no constraint
+     * moves them and the awake spheres collide with them as with a wall
+     * @param savedInvMass receive the inverse mass of every sphere
+     * @return number of awake spheres
+     */
+    int freezeSleeping(Grid &grid, const SubstepRates &rates, std::vector<float> &savedInvMass);
+
+    /**
+     * give the sleeping spheres their inverse mass back
+     */
+    void thawSleeping(Grid &grid, const SubstepRates &rates, const std::vector<float> &savedInvMass);
+
+    /**
+     * grow the buffers of a contact list so that building and solving it does not allocate within a budget
+     * @param sphereCount
+     * @param cellCount
+     * @param pairCount candidate pairs, each thread of the broadphase can find all of them
+     * @param cellOccupancy spheres a cell holds, the size of the sorted orders of the overloaded cells
+     */
+    void reserveContactList(ContactList &contacts, int sphereCount, int cellCount, int pairCount, int cellOccupancy);
+
+    /**
+     * grow the buffers of the multirate strides so that assigning them does not allocate within a budget
      */
-    void applyVelocityDamping(Grid &grid, float dampingFactor) ;
+    void reserveSubstepRates(SubstepRates &rates, int sphereCount, int cellCount);
 
 
 
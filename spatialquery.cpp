@@ -0,0 +1,370 @@
+#include "spatialquery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include "multithreading.h"
+
+
+namespace
+{
+    constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+    [[nodiscard]] bool isGhost(const Grid &grid, int index)
+    {
+        return index >= static_cast<int>(grid.bodyHandle.size());
+    }
+
+    [[nodiscard]] box2 grown(const box2 &box, float margin)
+    {
+        return {box.min - vec2(margin, margin), box.max + vec2(margin, margin)};
+    }
+
+    /**
+     * apply visit on the index of every occupied cell overlapping area. When the area covers more cells
+     * than there are occupied cells, the occupied cells are scanned instead of looking each one up
+     */
+    template <typename Visit>
+    void forEachCellIn(const Grid &grid, const box2 &area, Visit &&visit)
+    {
+        const box2 bounds = grid.bounds();
+        if (bounds.isEmpty() || !area.overlaps(bounds))
+            return;
+
+        const vec2 low(std::max(area.min.x, bounds.min.x), std::max(area.min.y, bounds.min.y));
+        const vec2 high(std::min(area.max.x, bounds.max.x), std::min(area.max.y, bounds.max.y));
+        const cell2 first = grid.cellOf(low);
+        const cell2 last  = grid.cellOf(high);
+
+        const long long span = static_cast<long long>(last.x - first.x + 1) * (last.y - first.y + 1);
+        if (span > grid.size()) {
+            for (int index = 0; index < grid.size(); ++index) {
+                const cell2 &cell = grid.cellCoords[index];
+                if (cell.x >= first.x && cell.x <= last.x && cell.y >= first.y && cell.y <= last.y)
+                    visit(index);
+            }
+            return;
+        }
+
+        for (int row = first.y; row <= last.y; ++row) {
+            for (int col = first.x; col <= last.x; ++col) {
+                const int index = grid.findCell(col, row);
+                if (index >= 0)
+                    visit(index);
+            }
+        }
+    }
+
+    /**
+     * distance along dir (normalized) from origin to the first point of the sphere, negative if it is missed
+     */
+    [[nodiscard]] float rayDistance(const vec2 &origin, const vec2 &dir, const Sphere &sphere)
+    {
+        const vec2 m = origin - sphere.position;
+        const float b = dot(m, dir);
+        const float c = dot(m, m) - sphere.radius * sphere.radius;
+        if (c <= 0.f)
+            return 0.f; // the origin is inside
+        if (b > 0.f)
+            return -1.f; // outside and going away
+        const float discriminant = b * b - c;
+        if (discriminant < 0.f)
+            return -1.f;
+        return -b - std::sqrt(discriminant);
+    }
+
+    struct Candidate
+    {
+        float distance2;
+        int index;
+
+        bool operator<(const Candidate &o) const
+        {
+            return distance2 != o.distance2 ? distance2 < o.distance2 : index < o.index;
+        }
+    };
+
+    /**
+     * run one query per input over the thread pool and pack their handles in input order
+     * @param query procedure (input index, handles found)
+     */
+    template <typename Query>
+    void runBatch(int count, query::Results &results, Query &&query)
+    {
+        results.offsets.assign(static_cast<std::size_t>(count) + 1, 0);
+        results.handles.clear();
+        if (count <= 0)
+            return;
+
+        // each range packs its own handles, the ranges are concatenated once every thread is done
+        std::mutex lock;
+        std::vector<std::pair<int, std::vector<int>>> chunks;
+        multithreading::forEachRange(count, [&](int begin, int end) {
+            std::vector<int> packed;
+            std::vector<int> found;
+            for (int i = begin; i < end; ++i) {
+                query(i, found);
+                results.offsets[i + 1] = static_cast<int>(found.size());
+                packed.insert(packed.end(), found.begin(), found.end());
+            }
+            std::lock_guard<std::mutex> locker(lock);
+            chunks.emplace_back(begin, std::move(packed));
+        });
+
+        for (int i = 0; i < count; ++i) results.offsets[i + 1] += results.offsets[i];
+
+        std::sort(chunks.begin(), chunks.end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+        results.handles.reserve(results.offsets.back());
+        for (const auto &chunk : chunks)
+            results.handles.insert(results.handles.end(), chunk.second.begin(), chunk.second.end());
+    }
+}
+
+void query::radius(const Grid &grid, const vec2 &center, float radius, std::vector<int> &handles)
+{
+    handles.clear();
+    radius = std::max(0.f, radius);
+
+    forEachCellIn(grid, box2::around(center, radius + grid.reach()), [&](int cell) {
+        for (int index : grid.cells[cell]) {
+            if (isGhost(grid, index))
+                continue;
+            const Sphere &sphere = grid.bodies[index];
+            const float reach = radius + sphere.radius;
+            if ((sphere.position - center).lengthSquared() <= reach * reach)
+                handles.push_back(grid.bodyHandle[index]);
+        }
+    });
+}
+
+void query::box(const Grid &grid, const box2 &area, std::vector<int> &handles)
+{
+    handles.clear();
+    if (area.isEmpty())
+        return;
+
+    forEachCellIn(grid, grown(area, grid.reach()), [&](int cell) {
+        for (int index : grid.cells[cell]) {
+            if (isGhost(grid, index))
+                continue;
+            const Sphere &sphere = grid.bodies[index];
+            const vec2 closest(std::clamp(sphere.position.x, area.min.x, area.max.x),
+                               std::clamp(sphere.position.y, area.min.y, area.max.y));
+            if ((sphere.position - closest).lengthSquared() <= sphere.radius * sphere.radius)
+                handles.push_back(grid.bodyHandle[index]);
+        }
+    });
+}
+
+void query::nearest(const Grid &grid, const vec2 &point, int k, std::vector<int> &handles)
+{
+    handles.clear();
+    if (k <= 0 || grid.isEmpty())
+        return;
+
+    // max heap of the k best candidates found so far, the worst one on top
+    std::vector<Candidate> best;
+    best.reserve(static_cast<std::size_t>(k));
+    auto consider = [&](int cell) {
+        for (int index : grid.cells[cell]) {
+            if (isGhost(grid, index))
+                continue;
+            const Candidate candidate {(grid.bodies[index].position - point).lengthSquared(), index};
+            if (static_cast<int>(best.size()) < k) {
+                best.push_back(candidate);
+                std::push_heap(best.begin(), best.end());
+            } else if (candidate < best.front()) {
+                std::pop_heap(best.begin(), best.end());
+                best.back() = candidate;
+                std::push_heap(best.begin(), best.end());
+            }
+        }
+    };
+
+    // rings of cells around the cell of the point. A center stored in a cell outside ring r is at least
+    // r * cellSize - reach away, once the k-th candidate is closer than that the search is over
+    const cell2 center = grid.cellOf(point);
+    for (int ring = 0;; ++ring) {
+        const long long side = 2LL * ring + 1;
+        if (side * side > grid.size()) {
+            // cheaper to look at the cells left than to look up the next rings
+            for (int index = 0; index < grid.size(); ++index) {
+                const cell2 &cell = grid.cellCoords[index];
+                if (std::max(std::abs(cell.x - center.x), std::abs(cell.y - center.y)) >= ring)
+                    consider(index);
+            }
+            break;
+        }
+
+        auto visit = [&](int col, int row) {
+            const int index = grid.findCell(col, row);
+            if (index >= 0)
+                consider(index);
+        };
+        if (ring == 0) {
+            visit(center.x, center.y);
+        } else {
+            for (int d = -ring; d <= ring; ++d) {
+                visit(center.x + d, center.y - ring);
+                visit(center.x + d, center.y + ring);
+            }
+            for (int d = -ring + 1; d < ring; ++d) {
+                visit(center.x - ring, center.y + d);
+                visit(center.x + ring, center.y + d);
+            }
+        }
+
+        const float bound = static_cast<float>(ring) * grid.cellSize() - grid.reach();
+        if (static_cast<int>(best.size()) == k && bound > 0.f && best.front().distance2 <= bound * bound)
+            break;
+    }
+
+    std::sort_heap(best.begin(), best.end());
+    handles.reserve(best.size());
+    for (const Candidate &candidate : best) handles.push_back(grid.bodyHandle[candidate.index]);
+}
+
+bool query::rayCast(const Grid &grid, const Ray &ray, RayHit &hit)
+{
+    hit = RayHit();
+    const float length = ray.direction.length();
+    if (length <= 0.f || grid.isEmpty())
+        return false;
+    const vec2 dir = ray.direction / length;
+
+    // the ray is clipped to the occupied cells, so an unbounded ray stops where the spheres end
+    const float reach = grid.reach();
+    const box2 bounds = grown(grid.bounds(), reach);
+    float tMin = 0.f;
+    float tMax = std::max(0.f, ray.maxDistance);
+    for (int axis = 0; axis < 2; ++axis) {
+        const float o  = axis == 0 ? ray.origin.x : ray.origin.y;
+        const float d  = axis == 0 ? dir.x : dir.y;
+        const float lo = axis == 0 ? bounds.min.x : bounds.min.y;
+        const float hi = axis == 0 ? bounds.max.x : bounds.max.y;
+        if (d == 0.f) {
+            if (o < lo || o > hi)
+                return false;
+            continue;
+        }
+        float t0 = (lo - o) / d;
+        float t1 = (hi - o) / d;
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tMin = std::max(tMin, t0);
+        tMax = std::min(tMax, t1);
+    }
+    if (tMin > tMax)
+        return false;
+
+    float bestDistance = kInfinity;
+    int bestIndex = -1;
+    auto test = [&](int cell) {
+        for (int index : grid.cells[cell]) {
+            if (isGhost(grid, index))
+                continue;
+            const float t = rayDistance(ray.origin, dir, grid.bodies[index]);
+            if (t >= 0.f && t <= ray.maxDistance && (t < bestDistance || (t == bestDistance && index < bestIndex))) {
+                bestDistance = t;
+                bestIndex = index;
+            }
+        }
+    };
+
+    const float cellSize = grid.cellSize();
+    const double crossed = static_cast<double>(tMax - tMin) * (std::abs(dir.x) + std::abs(dir.y)) / cellSize + 2.0;
+    if (crossed > grid.size()) {
+        // the ray crosses more cells than there are occupied ones
+        for (int cell = 0; cell < grid.size(); ++cell) test(cell);
+    } else {
+        // walk the cells crossed by the ray (Amanatides & Woo). A sphere hit inside the current cell is
+        // stored at most `around` cells away from it, so the walk stops once the best hit is in a visited cell
+        const int around = std::max(1, static_cast<int>(std::ceil(reach / cellSize)));
+        const vec2 start = ray.origin + dir * tMin;
+        cell2 cell = grid.cellOf(start);
+
+        const int stepX = dir.x > 0.f ? 1 : -1;
+        const int stepY = dir.y > 0.f ? 1 : -1;
+        const float deltaX = dir.x != 0.f ? cellSize / std::abs(dir.x) : kInfinity;
+        const float deltaY = dir.y != 0.f ? cellSize / std::abs(dir.y) : kInfinity;
+        float nextX = dir.x != 0.f
+                      ? tMin + ((dir.x > 0.f ? static_cast<float>(cell.x + 1) * cellSize - start.x
+                                             : start.x - static_cast<float>(cell.x) * cellSize) / std::abs(dir.x))
+                      : kInfinity;
+        float nextY = dir.y != 0.f
+                      ? tMin + ((dir.y > 0.f ? static_cast<float>(cell.y + 1) * cellSize - start.y
+                                             : start.y - static_cast<float>(cell.y) * cellSize) / std::abs(dir.y))
+                      : kInfinity;
+
+        // the neighborhoods of two consecutive cells mostly overlap. The walk only goes forward along each axis,
+        // so a cell tested before and still in the neighborhood was in the previous one: only the new cells are tested
+        bool first = true;
+        cell2 previous = cell;
+
+        while (true) {
+            for (int row = cell.y - around; row <= cell.y + around; ++row) {
+                for (int col = cell.x - around; col <= cell.x + around; ++col) {
+                    if (!first && std::abs(col - previous.x) <= around && std::abs(row - previous.y) <= around)
+                        continue;
+                    const int index = grid.findCell(col, row);
+                    if (index >= 0)
+                        test(index);
+                }
+            }
+            first = false;
+            previous = cell;
+
+            const float exit = std::min(nextX, nextY);
+            if (bestIndex >= 0 && bestDistance <= exit)
+                break;
+            if (exit > tMax)
+                break;
+
+            if (nextX < nextY) {
+                cell.x += stepX;
+                nextX += deltaX;
+            } else {
+                cell.y += stepY;
+                nextY += deltaY;
+            }
+        }
+    }
+
+    if (bestIndex < 0)
+        return false;
+
+    const Sphere &sphere = grid.bodies[bestIndex];
+    hit.handle = grid.bodyHandle[bestIndex];
+    hit.distance = bestDistance;
+    hit.point = ray.origin + dir * bestDistance;
+    hit.normal = (hit.point - sphere.position).normalized();
+    if (hit.normal.isNull())
+        hit.normal = -dir;
+    return true;
+}
+
+void query::radiusBatch(const Grid &grid, const std::vector<vec2> &centers, float radius, Results &results)
+{
+    runBatch(static_cast<int>(centers.size()), results, [&](int i, std::vector<int> &found) {
+        query::radius(grid, centers[i], radius, found);
+    });
+}
+
+void query::nearestBatch(const Grid &grid, const std::vector<vec2> &points, int k, Results &results)
+{
+    runBatch(static_cast<int>(points.size()), results, [&](int i, std::vector<int> &found) {
+        query::nearest(grid, points[i], k, found);
+    });
+}
+
+void query::rayCastBatch(const Grid &grid, const std::vector<Ray> &rays, std::vector<RayHit> &hits)
+{
+    hits.assign(rays.size(), RayHit());
+    multithreading::forEachRange(static_cast<int>(rays.size()), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) query::rayCast(grid, rays[i], hits[i]);
+    });
+}
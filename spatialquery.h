@@ -0,0 +1,80 @@
+#ifndef SOLVER_SPATIALQUERY_H
+#define SOLVER_SPATIALQUERY_H
+
+#include <vector>
+
+#include "grid.h"
+
+
+/**
+ * Read only spatial queries answered through the cells of the grid instead of a scan of every sphere:
+ * spheres touching a disc or a box, the k nearest spheres of a point and the first sphere hit by a ray.
+ * Results are handles (see Context::sphere). Ghosts are never returned.
+ * The queries only read the grid, so any number of them can run at the same time between two steps.
+ */
+namespace query
+{
+    struct Ray
+    {
+        vec2 origin;
+        vec2 direction = vec2(1.f, 0.f); // does not need to be normalized
+        float maxDistance = 1e30f;
+    };
+
+    struct RayHit
+    {
+        int handle = -1;     // -1 when nothing was hit
+        float distance = 0.f; // along the normalized direction, 0 if the origin is inside the sphere
+        vec2 point;
+        vec2 normal;         // outward normal of the sphere at point
+    };
+
+    /**
+     * handles found by a batch of queries, packed one query after the other
+     */
+    struct Results
+    {
+        std::vector<int> offsets {0}; // the handles of query i are [offsets[i], offsets[i + 1])
+        std::vector<int> handles;
+
+        [[nodiscard]] int queryCount() const { return static_cast<int>(offsets.size()) - 1; }
+        [[nodiscard]] BufferView<const int> of(int query) const
+        {
+            return {handles.data() + offsets[query], static_cast<std::size_t>(offsets[query + 1] - offsets[query])};
+        }
+    };
+
+    /**
+     * spheres touching the disc
+     * @param radius 0 to pick the spheres under a point
+     * @param handles cleared then filled, in no particular order
+     */
+    void radius(const Grid &grid, const vec2 &center, float radius, std::vector<int> &handles);
+
+    /**
+     * spheres touching the box
+     * @param handles cleared then filled, in no particular order
+     */
+    void box(const Grid &grid, const box2 &area, std::vector<int> &handles);
+
+    /**
+     * the k spheres whose center is the closest to point
+     * @param handles cleared then filled from the closest, less than k if there are not enough spheres
+     */
+    void nearest(const Grid &grid, const vec2 &point, int k, std::vector<int> &handles);
+
+    /**
+     * first sphere crossed by the ray
+     * @return false if no sphere is closer than ray.maxDistance
+     */
+    bool rayCast(const Grid &grid, const Ray &ray, RayHit &hit);
+
+    /**
+     * the same queries for many inputs at once, split over the thread pool
+     */
+    void radiusBatch(const Grid &grid, const std::vector<vec2> &centers, float radius, Results &results);
+    void nearestBatch(const Grid &grid, const std::vector<vec2> &points, int k, Results &results);
+    void rayCastBatch(const Grid &grid, const std::vector<Ray> &rays, std::vector<RayHit> &hits);
+}
+
+#endif //SOLVER_SPATIALQUERY_H
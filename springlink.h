@@ -10,6 +10,8 @@ struct SpringLink
     int groupId    = -1;
     int aNode      = -1;
     int bNode      = -1;
+    int a          = -1; // index in Grid::bodies of the node aNode
+    int b          = -1; // index in Grid::bodies of the node bNode
     float restLength = 0.f;
     float stiffness  = 0.9f;
 };
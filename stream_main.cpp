@@ -0,0 +1,104 @@
+#include "autotune.h"
+#include "framestream.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+
+namespace
+{
+    /**
+     * whole text as a non negative integer
+     */
+    bool parseCount(const char *text, int &value)
+    {
+        char *end = nullptr;
+        const long parsed = std::strtol(text, &end, 10);
+        if (end == text || *end != '\0' || parsed < 0 || parsed > INT_MAX)
+            return false;
+        value = static_cast<int>(parsed);
+        return true;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr, "usage: SOLVER_stream [frames, 0 = forever] [scene file] [stream name]\n");
+    }
+}
+
+/**
+ * headless simulation publishing its frames for SOLVER_viewer
+ * usage: SOLVER_stream [frames, 0 = forever] [scene file] [stream name]
+ * the frames are paced at 60 per second, a viewer never slows the simulation down
+ */
+int main(int argc, char *argv[])
+{
+    int frames = 0;
+    if (argc > 4 || (argc > 1 && !parseCount(argv[1], frames))) {
+        usage();
+        return 2;
+    }
+    const std::string name = argc > 3 ? argv[3] : framestream::kDefaultName;
+    const float frameDt = 1.f / 60.f;
+
+    Context context;
+    context.initialize(vec2(1280.f, 720.f));
+    context.setSubsteps(2);
+    context.setReorderInterval(120);
+    if (argc > 2 && argv[2][0] != '\0') {
+        std::string error;
+        if (!context.loadObstacles(argv[2], &error))
+            std::fprintf(stderr, "%s\n", error.c_str());
+    }
+
+    autotune::apply(autotune::loadOrCalibrate(context), context);
+
+    Emitter emitter;
+    emitter.position = vec2(640.f, 80.f);
+    emitter.rate = 300.f;
+    emitter.lifetime = 60.f;
+    context.addEmitter(emitter);
+
+    framestream::Publisher publisher;
+    std::string error;
+    if (!publisher.open(name, framestream::Config(), &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    std::printf("publishing on %s\n", name.c_str());
+
+    using Clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(frameDt));
+    auto next = Clock::now();
+    double stepMs = 0.0;
+    double publishMs = 0.0;
+
+    for (int frame = 1; frames == 0 || frame <= frames; ++frame) {
+        if (frame % 240 == 0)
+            context.createSoftBody(vec2(320.f + static_cast<float>(frame / 240 % 3) * 320.f, 200.f));
+
+        const auto start = Clock::now();
+        context.step(frameDt);
+        const auto stepped = Clock::now();
+        publisher.publish(context);
+        const auto published = Clock::now();
+
+        stepMs += std::chrono::duration<double, std::milli>(stepped - start).count();
+        publishMs += std::chrono::duration<double, std::milli>(published - stepped).count();
+        if (frame % 60 == 0) {
+            std::printf("frame %d  spheres %zu  step %.2f ms  publish %.3f ms\n", frame, context.bodies().size,
+                        stepMs / 60.0, publishMs / 60.0);
+            stepMs = publishMs = 0.0;
+        }
+
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
+
+    publisher.close();
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include "alloctrack.h"
+#include "context.h"
+#include "multithreading.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+
+/**
+ * consistency checks run by ctest: the storage of the spheres with its handles, springs and clusters
+ * through removals and Morton reordering, the allocations of a step within a fixed capacity, the
+ * deterministic mode across thread counts, the pairs of sort and sweep, and the spatial queries against a
+ * scan of every sphere.
+ * usage: SOLVER_test, the exit code is 1 when a check failed
+ */
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const char *what, int detail = 0)
+    {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED %s (%d)\n", what, detail);
+            ++failures;
+        }
+    }
+
+    /**
+     * a scene with free spheres, spring clusters and shape clusters, reordered at every frame
+     */
+    void fillScene(Context &context, std::mt19937 &random, std::vector<int> &handles, int count = 1200)
+    {
+        context.seed(11);
+        context.initialize(vec2(1000.f, 700.f));
+        context.setReorderInterval(1);
+
+        std::uniform_real_distribution<float> x(20.f, 980.f);
+        std::uniform_real_distribution<float> y(20.f, 400.f);
+        std::uniform_real_distribution<float> radius(3.f, 9.f);
+        std::vector<Sphere> spheres;
+        for (int i = 0; i < count; ++i) {
+            Sphere sphere(radius(random));
+            sphere.setMass(1.f);
+            sphere.position = vec2(x(random), y(random));
+            sphere.prevPosition = sphere.position;
+            sphere.color = static_cast<rgba>(i); // identity of the sphere, kept through the reordering
+            spheres.push_back(sphere);
+        }
+        context.spawnSpheres(spheres, &handles);
+
+        context.setClusterModel(ClusterModel::Springs);
+        context.createSpringCluster(vec2(250.f, 200.f));
+        context.createSoftBody(vec2(500.f, 250.f), 6);
+        context.setClusterModel(ClusterModel::ShapeMatching);
+        context.createSpringCluster(vec2(750.f, 200.f));
+        context.createSoftBody(vec2(500.f, 450.f), 6);
+    }
+
+    /**
+     * every handle resolves to its sphere and back, every spring and cluster points at a node of its group
+     */
+    void checkStorage(const Context &context)
+    {
+        const Grid &grid = context.grid();
+        check(grid.bodyHandle.size() == grid.bodies.size(), "a handle per sphere");
+        for (int i = 0; i < grid.bodyCount(); ++i) {
+            const int handle = grid.bodyHandle[i];
+            check(handle >= 0 && handle < static_cast<int>(grid.handleIndex.size()) && grid.handleIndex[handle] == i,
+                  "handle resolves to its sphere", i);
+        }
+        int live = 0;
+        for (int index : grid.handleIndex) live += index >= 0;
+        check(live == grid.bodyCount(), "no handle left on a removed sphere", live);
+        for (int handle : grid.freeHandles)
+            check(grid.handleIndex[handle] == -1, "free handle resolves to nothing", handle);
+
+        for (const SpringLink &link : context.springs()) {
+            const bool inside = link.a >= 0 && link.a < grid.bodyCount() && link.b >= 0 && link.b < grid.bodyCount();
+            check(inside, "spring inside the storage");
+            if (!inside)
+                continue;
+            check(grid.bodies[link.a].groupId == link.groupId && grid.bodies[link.a].nodeIndex == link.aNode,
+                  "spring on its first node", link.groupId);
+            check(grid.bodies[link.b].groupId == link.groupId && grid.bodies[link.b].nodeIndex == link.bNode,
+                  "spring on its second node", link.groupId);
+        }
+
+        for (const ShapeCluster &cluster : context.shapeClusters()) {
+            check(cluster.bodies.size() == cluster.restShape.size(), "a rest position per node", cluster.groupId);
+            for (int index : cluster.bodies) {
+                const bool inside = index >= 0 && index < grid.bodyCount();
+                check(inside && grid.bodies[index].groupId == cluster.groupId, "cluster node of its group",
+                      cluster.groupId);
+            }
+        }
+    }
+
+    void testRemovalAndReorder()
+    {
+        std::mt19937 random(5);
+        Context context;
+        std::vector<int> handles;
+        fillScene(context, random, handles);
+
+        // the color of each free sphere is its number, handle -> number never changes
+        std::unordered_map<int, rgba> identity;
+        for (std::size_t i = 0; i < handles.size(); ++i) identity[handles[i]] = static_cast<rgba>(i);
+
+        for (int frame = 0; frame < 60; ++frame) {
+            context.step(1.f / 60.f);
+
+            // remove a few free spheres, a node of a cluster now and then
+            std::vector<int> removed;
+            for (int k = 0; k < 8 && !identity.empty(); ++k) {
+                auto it = identity.begin();
+                std::advance(it, std::uniform_int_distribution<int>(0, static_cast<int>(identity.size()) - 1)(random));
+                removed.push_back(it->first);
+                identity.erase(it);
+            }
+            check(context.removeSpheres(removed) == static_cast<int>(removed.size()), "every sphere removed");
+            if (frame % 10 == 5) {
+                for (const Sphere &sphere : context.bodies()) {
+                    if (sphere.groupId >= 0) {
+                        const int index = static_cast<int>(&sphere - context.bodies().begin());
+                        context.removeSphere(context.grid().bodyHandle[index]);
+                        break;
+                    }
+                }
+            }
+            for (int handle : removed)
+                check(context.sphere(handle) == nullptr, "removed handle resolves to nothing", handle);
+
+            // new spheres take the handles just freed, they must not be confused with the removed ones
+            std::vector<Sphere> added;
+            for (std::size_t k = 0; k < removed.size() / 2; ++k) {
+                Sphere sphere(4.f);
+                sphere.position = vec2(100.f + 20.f * static_cast<float>(k), 50.f);
+                sphere.prevPosition = sphere.position;
+                sphere.color = static_cast<rgba>(100000 + frame * 16 + static_cast<int>(k));
+                added.push_back(sphere);
+            }
+            std::vector<int> addedHandles;
+            context.spawnSpheres(added, &addedHandles);
+            for (std::size_t k = 0; k < addedHandles.size(); ++k) {
+                const Sphere *sphere = context.sphere(addedHandles[k]);
+                check(sphere && sphere->color == added[k].color, "recycled handle resolves to the new sphere", frame);
+                identity[addedHandles[k]] = added[k].color;
+            }
+
+            for (const auto &[handle, color] : identity) {
+                const Sphere *sphere = context.sphere(handle);
+                check(sphere && sphere->color == color, "handle resolves to the same sphere after reordering", handle);
+            }
+            checkStorage(context);
+        }
+        check(context.lastReorderStats().frame >= 0, "the storage was reordered");
+    }
+
+    std::uint64_t violationCount = 0;
+
+    void countViolation(std::size_t) { ++violationCount; }
+
+    /**
+     * within its budget a step never allocates: springs, shape clusters, multirate, deterministic mode and
+     * reordering, while clusters are created and removed between the frames
+     */
+    void testFixedCapacity()
+    {
+        std::mt19937 random(3);
+        Context context(30.f);
+        std::vector<int> handles;
+        fillScene(context, random, handles, 300);
+        context.setFixedCapacity({600, 2000});
+        context.setMultirate({true});
+        context.setDeterministic(true);
+
+        alloctrack::setViolationHandler(countViolation);
+        const std::uint64_t before = alloctrack::violations();
+        std::vector<int> groups;
+        for (int frame = 0; frame < 300; ++frame) {
+            // the clusters of the previous frame are replaced, the group ids keep growing past the sphere budget
+            // while the number of spheres does not
+            if (frame >= 50) {
+                for (int group : groups) check(context.removeGroup(group) > 0, "cluster removed", group);
+                groups.clear();
+                for (int k = 0; k < 3; ++k) {
+                    context.setClusterModel(k % 2 ? ClusterModel::ShapeMatching : ClusterModel::Springs);
+                    context.createSpringCluster(vec2(200.f + 300.f * static_cast<float>(k), 550.f));
+                    const BufferView<const Sphere> bodies = context.bodies();
+                    groups.push_back(bodies[bodies.size - 1].groupId);
+                }
+            }
+            context.step(1.f / 60.f);
+        }
+        check(alloctrack::violations() == before, "no allocation in a step within the budget",
+              static_cast<int>(alloctrack::violations() - before));
+        check(violationCount == alloctrack::violations() - before, "every violation handled");
+        alloctrack::setViolationHandler(nullptr);
+    }
+
+    /**
+     * in deterministic mode the positions do not depend on the number of threads, bit for bit
+     */
+    void testDeterminism()
+    {
+        const int threads = multithreading::maxThreadAllowed();
+        std::vector<vec2> positions[2];
+        for (int run = 0; run < 2; ++run) {
+            multithreading::setMaxThreadCount(run == 0 ? 1 : 4);
+            std::mt19937 random(7);
+            Context context;
+            std::vector<int> handles;
+            fillScene(context, random, handles);
+            context.setDeterministic(true);
+            for (int frame = 0; frame < 120; ++frame) context.step(1.f / 60.f);
+            for (const Sphere &sphere : context.bodies()) positions[run].push_back(sphere.position);
+        }
+        multithreading::setMaxThreadCount(threads);
+
+        check(positions[0].size() == positions[1].size(), "as many spheres at 1 and 4 threads");
+        const std::size_t bytes = positions[0].size() * sizeof(vec2);
+        const bool same = positions[0].size() == positions[1].size()
+                          && std::memcmp(positions[0].data(), positions[1].data(), bytes) == 0;
+        check(same, "same positions at 1 and 4 threads");
+    }
+
+    std::vector<ContactPair> sortedPairs(const ContactList &contacts)
+    {
+        std::vector<ContactPair> pairs(contacts.pairs.begin(), contacts.pairs.end());
+        for (ContactPair &pair : pairs) {
+            if (pair.a > pair.b)
+                std::swap(pair.a, pair.b);
+        }
+        std::sort(pairs.begin(), pairs.end(), [](const ContactPair &l, const ContactPair &r) {
+            return l.a != r.a ? l.a < r.a : l.b < r.b;
+        });
+        return pairs;
+    }
+
+    /**
+     * sort and sweep of the crowded cells finds the same candidate pairs as testing every pair, also when the
+     * order of a cell is kept from the previous build
+     */
+    void testSweep()
+    {
+        std::mt19937 random(13);
+        std::uniform_real_distribution<float> position(0.f, 600.f);
+        std::uniform_real_distribution<float> radius(2.f, 6.f);
+        std::uniform_real_distribution<float> shake(-3.f, 3.f);
+
+        Grid grid(200.f);
+        for (int i = 0; i < 3000; ++i) {
+            Sphere sphere(radius(random));
+            sphere.position = vec2(position(random), position(random));
+            sphere.prevPosition = sphere.position;
+            grid.bodies.push_back(sphere);
+        }
+
+        ContactList swept;
+        ContactList allPairs;
+        swept.skin = allPairs.skin = 4.f;
+        swept.sweepThreshold = 1;    // every cell of more than one sphere is swept
+        allPairs.sweepThreshold = 0; // never
+        for (int round = 0; round < 5; ++round) {
+            grid.rebuild();
+            solver::buildContactList(grid, swept);
+            solver::buildContactList(grid, allPairs);
+            const std::vector<ContactPair> found = sortedPairs(swept);
+            const std::vector<ContactPair> expected = sortedPairs(allPairs);
+            auto equal = [](const ContactPair &l, const ContactPair &r) { return l.a == r.a && l.b == r.b; };
+            const bool same = found.size() == expected.size()
+                              && std::equal(found.begin(), found.end(), expected.begin(), equal);
+            check(!expected.empty() && same, "sweep finds the same pairs", round);
+
+            for (Sphere &sphere : grid.bodies) sphere.position += vec2(shake(random), shake(random));
+        }
+    }
+
+    float rayDistance(const query::Ray &ray, const Sphere &sphere)
+    {
+        const vec2 dir = ray.direction.normalized();
+        const vec2 m = ray.origin - sphere.position;
+        const float b = dot(m, dir);
+        const float c = dot(m, m) - sphere.radius * sphere.radius;
+        if (c <= 0.f)
+            return 0.f;
+        if (b > 0.f || b * b - c < 0.f)
+            return -1.f;
+        return -b - std::sqrt(b * b - c);
+    }
+
+    void testQueries()
+    {
+        std::mt19937 random(9);
+        Context context(30.f);
+        std::vector<int> handles;
+        fillScene(context, random, handles);
+        std::uniform_real_distribution<float> x(-50.f, 1050.f);
+        std::uniform_real_distribution<float> y(-50.f, 750.f);
+        std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+
+        for (int frame = 0; frame < 90; ++frame) {
+            context.step(1.f / 60.f);
+            if (frame % 15 != 14)
+                continue;
+
+            const BufferView<const Sphere> bodies = context.bodies();
+            const Grid &grid = context.grid();
+            std::vector<int> found;
+            for (int q = 0; q < 100; ++q) {
+                const vec2 point(x(random), y(random));
+
+                const float radius = std::uniform_real_distribution<float>(0.f, 60.f)(random);
+                context.queryRadius(point, radius, found);
+                std::vector<int> expected;
+                for (std::size_t i = 0; i < bodies.size; ++i) {
+                    const float reach = radius + bodies[i].radius;
+                    if ((bodies[i].position - point).lengthSquared() <= reach * reach)
+                        expected.push_back(grid.bodyHandle[i]);
+                }
+                std::sort(found.begin(), found.end());
+                std::sort(expected.begin(), expected.end());
+                check(found == expected, "radius query matches a scan", q);
+
+                const int k = 1 + q % 12;
+                context.queryNearest(point, k, found);
+                std::vector<float> distances;
+                for (const Sphere &sphere : bodies) distances.push_back((sphere.position - point).lengthSquared());
+                std::sort(distances.begin(), distances.end());
+                bool same = static_cast<int>(found.size()) == std::min(k, static_cast<int>(bodies.size));
+                for (std::size_t j = 0; same && j < found.size(); ++j) {
+                    const Sphere *sphere = context.sphere(found[j]);
+                    same = sphere && (sphere->position - point).lengthSquared() == distances[j];
+                }
+                check(same, "nearest query matches a scan", q);
+
+                const float theta = angle(random);
+                const query::Ray ray {point, vec2(std::cos(theta), std::sin(theta)), q % 3 ? 1e30f : 300.f};
+                query::RayHit hit;
+                const bool hitSomething = context.rayCast(ray, hit);
+                float best = -1.f;
+                for (const Sphere &sphere : bodies) {
+                    const float t = rayDistance(ray, sphere);
+                    if (t >= 0.f && t <= ray.maxDistance && (best < 0.f || t < best))
+                        best = t;
+                }
+                const bool sameHit = hitSomething ? best >= 0.f && std::abs(hit.distance - best) <= 1e-4f * (1.f + best)
+                                                   : best < 0.f;
+                check(sameHit, "ray cast matches a scan", q);
+            }
+        }
+    }
+}
+
+int main()
+{
+    testRemovalAndReorder();
+    testFixedCapacity();
+    testDeterminism();
+    testSweep();
+    testQueries();
+    if (failures == 0)
+        std::printf("all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
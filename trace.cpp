@@ -0,0 +1,193 @@
+#include "trace.h"
+#include "alloctrack.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace
+{
+    constexpr std::uint32_t kBufferCapacity = 1u << 16; // events per thread, about 2 MB
+
+    struct Event
+    {
+        const char *name;
+        std::int64_t begin;
+        std::int64_t end;
+        int arg;
+    };
+
+    /**
+     * events of one thread. Only the owner thread writes, count is published with release
+     * so the exporting thread can read the events below it
+     */
+    struct ThreadBuffer
+    {
+        int id = 0;
+        std::string name;
+        std::unique_ptr<Event[]> events {new Event[kBufferCapacity]};
+        std::atomic<std::uint32_t> count {0};
+        std::atomic<std::int64_t> dropped {0};
+    };
+
+    /**
+     * every buffer ever created. Buffers are never freed, so a thread that exited (the pool was resized)
+     * still appear in the export
+     */
+    struct Registry
+    {
+        std::mutex lock;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::int64_t origin = 0;
+    };
+
+    Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    thread_local ThreadBuffer *localBuffer = nullptr; // created by the first event of the thread
+    thread_local std::string localName;
+
+    ThreadBuffer &threadBuffer()
+    {
+        if (!localBuffer) {
+            // once per thread, not part of the work that may be forbidden to allocate
+            alloctrack::AllowScope allow;
+            Registry &reg = registry();
+            std::lock_guard<std::mutex> locker(reg.lock);
+            reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+            localBuffer = reg.buffers.back().get();
+            localBuffer->id = static_cast<int>(reg.buffers.size());
+            localBuffer->name = localName;
+        }
+        return *localBuffer;
+    }
+
+    /**
+     * escape the characters that would break a JSON string
+     */
+    std::string escaped(const std::string &text)
+    {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                result += c;
+        }
+        return result;
+    }
+}
+
+std::atomic<bool> trace::detail::enabled {false};
+
+std::int64_t trace::detail::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace::detail::record(const char *name, std::int64_t begin, std::int64_t end, int arg)
+{
+    ThreadBuffer &buffer = threadBuffer();
+    const std::uint32_t index = buffer.count.load(std::memory_order_relaxed);
+    if (index >= kBufferCapacity) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.events[index] = {name, begin, end, arg};
+    buffer.count.store(index + 1, std::memory_order_release);
+}
+
+void trace::start()
+{
+    Registry &reg = registry();
+    {
+        std::lock_guard<std::mutex> locker(reg.lock);
+        for (const auto &buffer : reg.buffers) {
+            buffer->count.store(0, std::memory_order_relaxed);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+        }
+        reg.origin = detail::now();
+    }
+    detail::enabled.store(true, std::memory_order_release);
+}
+
+void trace::stop()
+{
+    detail::enabled.store(false, std::memory_order_release);
+}
+
+void trace::setThreadName(const std::string &name)
+{
+    localName = name;
+    if (localBuffer) {
+        std::lock_guard<std::mutex> locker(registry().lock);
+        localBuffer->name = name;
+    }
+}
+
+std::int64_t trace::droppedEvents()
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> locker(reg.lock);
+    std::int64_t dropped = 0;
+    for (const auto &buffer : reg.buffers) dropped += buffer->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+bool trace::writeChromeTrace(const std::string &path, std::string *error)
+{
+    std::ofstream file(path);
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> locker(reg.lock);
+
+    // complete events ("X"), timestamps in microseconds from the start of the recording
+    file << std::fixed;
+    file.precision(3);
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&first, &file]() {
+        if (!first)
+            file << ",\n";
+        first = false;
+    };
+
+    for (const auto &buffer : reg.buffers) {
+        const std::string name = buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name;
+        separator();
+        file << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << buffer->id
+             << R"(,"args":{"name":")" << escaped(name) << "\"}}";
+
+        const std::uint32_t count = buffer->count.load(std::memory_order_acquire);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            const Event &event = buffer->events[i];
+            separator();
+            file << R"({"name":")" << escaped(event.name) << R"(","ph":"X","pid":1,"tid":)" << buffer->id
+                 << ",\"ts\":" << static_cast<double>(event.begin - reg.origin) * 1e-3
+                 << ",\"dur\":" << static_cast<double>(event.end - event.begin) * 1e-3;
+            if (event.arg >= 0)
+                file << ",\"args\":{\"index\":" << event.arg << '}';
+            file << '}';
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!file) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
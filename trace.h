@@ -0,0 +1,90 @@
+#ifndef SOLVER_TRACE_H
+#define SOLVER_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+/**
+ * Timeline of what each thread is doing (frames, solver phases, chunks of the thread pool), exported in the
+ * Chrome trace event format so it can be opened in chrome://tracing or Perfetto.
+ * Each thread writes in its own buffer without any lock. When tracing is off a scope only read one atomic flag.
+ */
+namespace trace
+{
+    namespace detail
+    {
+        extern std::atomic<bool> enabled;
+
+        std::int64_t now();
+        void record(const char *name, std::int64_t begin, std::int64_t end, int arg);
+    }
+
+    [[nodiscard]] inline bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * clear the events recorded so far and start recording.
+     * to be called between two frames, while no dispatch is running
+     */
+    void start();
+
+    /**
+     * stop recording, the events are kept until the next start
+     */
+    void stop();
+
+    /**
+     * name shown for the calling thread in the viewer
+     * @param name
+     */
+    void setThreadName(const std::string &name);
+
+    /**
+     * write the recorded events as a Chrome trace JSON file. to be called after stop
+     * @param error can be nullptr
+     * @return false if the file could not be written
+     */
+    bool writeChromeTrace(const std::string &path, std::string *error = nullptr);
+
+    /**
+     * number of events lost because the buffer of their thread was full
+     */
+    [[nodiscard]] std::int64_t droppedEvents();
+
+    /**
+     * record the lifetime of the scope as one event on the calling thread
+     */
+    class Scope
+    {
+    public:
+        /**
+         * @param name has to outlive the export, a string literal
+         * @param arg shown in the viewer when it is not negative (chunk index...)
+         */
+        explicit Scope(const char *name, int arg = -1)
+        {
+            if (isEnabled()) {
+                m_name  = name;
+                m_arg   = arg;
+                m_begin = detail::now();
+            }
+        }
+
+        ~Scope()
+        {
+            if (m_name)
+                detail::record(m_name, m_begin, detail::now(), m_arg);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *m_name = nullptr;
+        int m_arg = -1;
+        std::int64_t m_begin = 0;
+    };
+}
+
+#endif //SOLVER_TRACE_H
@@ -0,0 +1,122 @@
+#ifndef SOLVER_VEC2_H
+#define SOLVER_VEC2_H
+
+#include <cmath>
+#include <cstddef>
+
+
+/**
+ * 2D vector of float used by the whole simulation for positions, velocities and normals.
+ * Plain aggregate of two floats so arrays of it are tightly packed and easy to vectorize,
+ * and no conversion between double points and float vectors in the solver.
+ */
+struct alignas(8) vec2
+{
+    float x = 0.f;
+    float y = 0.f;
+
+    constexpr vec2() = default;
+    constexpr vec2(float x, float y) : x(x), y(y) {}
+
+    constexpr vec2 &operator+=(const vec2 &o) { x += o.x; y += o.y; return *this; }
+    constexpr vec2 &operator-=(const vec2 &o) { x -= o.x; y -= o.y; return *this; }
+    constexpr vec2 &operator*=(float f) { x *= f; y *= f; return *this; }
+    constexpr vec2 &operator/=(float f) { x /= f; y /= f; return *this; }
+
+    [[nodiscard]] float lengthSquared() const { return x * x + y * y; }
+    [[nodiscard]] float length() const { return std::sqrt(lengthSquared()); }
+    [[nodiscard]] bool isNull() const { return x == 0.f && y == 0.f; }
+
+    /**
+     * unit vector with the same direction, the null vector stay null
+     */
+    [[nodiscard]] vec2 normalized() const
+    {
+        const float l = length();
+        return l > 0.f ? vec2(x / l, y / l) : vec2();
+    }
+};
+
+constexpr vec2 operator+(vec2 a, const vec2 &b) { return a += b; }
+constexpr vec2 operator-(vec2 a, const vec2 &b) { return a -= b; }
+constexpr vec2 operator-(const vec2 &a) { return {-a.x, -a.y}; }
+constexpr vec2 operator*(vec2 a, float f) { return a *= f; }
+constexpr vec2 operator*(float f, vec2 a) { return a *= f; }
+constexpr vec2 operator/(vec2 a, float f) { return a /= f; }
+constexpr bool operator==(const vec2 &a, const vec2 &b) { return a.x == b.x && a.y == b.y; }
+constexpr bool operator!=(const vec2 &a, const vec2 &b) { return !(a == b); }
+
+constexpr float dot(const vec2 &a, const vec2 &b) { return a.x * b.x + a.y * b.y; }
+constexpr float cross(const vec2 &a, const vec2 &b) { return a.x * b.y - a.y * b.x; }
+
+/**
+ * axis aligned box, an empty box has min > max
+ */
+struct box2
+{
+    vec2 min = vec2(1e30f, 1e30f);
+    vec2 max = vec2(-1e30f, -1e30f);
+
+    constexpr box2() = default;
+    constexpr box2(const vec2 &min, const vec2 &max) : min(min), max(max) {}
+
+    /**
+     * box of a disc
+     */
+    static constexpr box2 around(const vec2 &center, float radius)
+    {
+        return {vec2(center.x - radius, center.y - radius), vec2(center.x + radius, center.y + radius)};
+    }
+
+    /**
+     * box that contains everything, used for obstacles without bounds like planes
+     */
+    static constexpr box2 infinite() { return {vec2(-1e30f, -1e30f), vec2(1e30f, 1e30f)}; }
+
+    [[nodiscard]] bool isEmpty() const { return min.x > max.x || min.y > max.y; }
+    [[nodiscard]] bool isInfinite() const { return min.x <= -1e30f || min.y <= -1e30f || max.x >= 1e30f || max.y >= 1e30f; }
+    [[nodiscard]] vec2 center() const { return (min + max) * 0.5f; }
+    [[nodiscard]] vec2 extent() const { return max - min; }
+
+    [[nodiscard]] bool overlaps(const box2 &o) const
+    {
+        return min.x <= o.max.x && o.min.x <= max.x && min.y <= o.max.y && o.min.y <= max.y;
+    }
+
+    [[nodiscard]] bool contains(const vec2 &p) const
+    {
+        return p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y;
+    }
+
+    void expand(const box2 &o)
+    {
+        min = vec2(std::fmin(min.x, o.min.x), std::fmin(min.y, o.min.y));
+        max = vec2(std::fmax(max.x, o.max.x), std::fmax(max.y, o.max.y));
+    }
+};
+
+/**
+ * integer coordinates of a cell of the grid
+ */
+struct cell2
+{
+    int x = 0;
+    int y = 0;
+};
+
+/**
+ * read or write view on a contiguous buffer owned by the simulation, nothing is copied
+ */
+template <typename T>
+struct BufferView
+{
+    T *data = nullptr;
+    std::size_t size = 0;
+
+    [[nodiscard]] T *begin() const { return data; }
+    [[nodiscard]] T *end() const { return data + size; }
+    [[nodiscard]] bool empty() const { return size == 0; }
+    T &operator[](std::size_t i) const { return data[i]; }
+};
+
+#endif //SOLVER_VEC2_H
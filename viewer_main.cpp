@@ -0,0 +1,85 @@
+#include "framestream.h"
+#include "renderer.h"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QTimer>
+#include <QWidget>
+#include <iostream>
+
+
+namespace
+{
+    constexpr qint64 kReattachMs = 1000; // without a new frame for that long the stream is looked up again
+
+    /**
+     * draw the latest frame of the stream, scaled to the window
+     */
+    class ViewerWidget : public QWidget
+    {
+    public:
+        explicit ViewerWidget(std::string name) : name(std::move(name))
+        {
+            setStyleSheet("background: white;");
+            resize(1280, 720);
+            subscriber.attach(this->name);
+
+            QObject::connect(&timer, &QTimer::timeout, this, [this] { poll(); });
+            timer.start(16);
+            sinceFrame.start();
+        }
+
+    protected:
+        void paintEvent(QPaintEvent *) override
+        {
+            QPainter painter(this);
+            painter.setRenderHint(QPainter::Antialiasing);
+            if (frame.sceneSize.x > 0.f && frame.sceneSize.y > 0.f) {
+                const qreal scale = std::min(width() / frame.sceneSize.x, height() / frame.sceneSize.y);
+                painter.scale(scale, scale);
+            }
+            renderer::render(painter, frame);
+        }
+
+    private:
+        void poll()
+        {
+            if (subscriber.latest(frame)) {
+                sinceFrame.restart();
+                setWindowTitle(QString("SOLVER viewer - frame %1, %2 spheres, %3 skipped%4")
+                                       .arg(frame.number).arg(frame.discs.size()).arg(subscriber.skipped())
+                                       .arg(frame.truncated ? ", truncated" : ""));
+                update();
+                return;
+            }
+
+            // the publisher quit or restarted: keep the last picture and follow the new stream when it comes
+            if (subscriber.isClosed() || sinceFrame.elapsed() > kReattachMs) {
+                subscriber.attach(name);
+                sinceFrame.restart();
+            }
+        }
+
+        std::string name;
+        framestream::Subscriber subscriber;
+        framestate::Frame frame;
+        QTimer timer;
+        QElapsedTimer sinceFrame;
+    };
+}
+
+/**
+ * viewer of a simulation published by SOLVER_stream, as many viewers as wanted can attach or quit at any time
+ * usage: SOLVER_viewer [stream name]
+ */
+int main(int argc, char *argv[])
+{
+    QApplication application(argc, argv);
+    const std::string name = argc > 1 ? argv[1] : framestream::kDefaultName;
+
+    ViewerWidget viewer(name);
+    viewer.show();
+    std::cout << "viewing " << name << std::endl;
+    return QApplication::exec();
+}